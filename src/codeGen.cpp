@@ -1,6 +1,9 @@
 #include <string.h>
 #include <cstdlib>
+#include <vector>
+#include <map>
 #include "codeGen.h"
+#include "tmImage.h"
 
 int goffset; // current global offset in data memory
 int foffset; // current frame offset in data memory
@@ -9,6 +12,13 @@ bool inFunc; // whether or not a function is currently being traversed
 FILE* codeFile; // file to output code to
 std::string divider; // string of stars to visually separate functions in the code
 extern TreeNode* ast; // abstract syntax tree
+bool binaryImage = false; // whether or not a binary TM image (.tmb) is also written
+std::vector<TMIMAGE_INSTR> imageCode; // instructions for the binary image indexed by address
+std::string imageLits; // LIT section for the binary image (records and their chars)
+int imageLitCount; // number of LIT records in imageLits
+int imageLitWords; // number of chars in imageLits
+std::string imageComments; // comment section for the binary image
+std::map<std::string, int> imageCommentOffsets; // offset of each comment already in imageComments
 
 // evaluates expressions and then stores the result in ac1
 void evaluateExp(TreeNode* node);
@@ -28,6 +38,47 @@ int outputRTMInstruction(int addr, std::string instr, int r, int d, int s, std::
 int outputRTMInstruction(std::string instr, int r, char d, int s, std::string comment);
 int outputInstruction(std::string instr, int r, int s, int t, std::string comment);
 void outputLitInstruction(int addr, char* str, int size);
+void recordInstruction(int addr, std::string instr, int a1, int a2, int a3, std::string comment);
+void recordLit(int addr, char* str);
+void writeImage(char* fileName);
+
+// an instruction of one of the built in functions written by genHeader
+struct HeaderInstr
+{
+	const char* instr;
+	int a1, a2, a3;
+	bool isRA; // printed as r,d(s) instead of r,s,t
+	const char* comment;
+};
+
+// a built in function written by genHeader
+struct HeaderFunc
+{
+	const char* name;
+	int size;
+	HeaderInstr code[6];
+};
+
+const HeaderFunc headerFuncs[] =
+{
+	{"input", 5, {{"ST", 3, -1, 1, true, "Store return address"}, {"IN", 2, 2, 2, false, "Grab int input"},
+		{"LD", 3, -1, 1, true, "Load return address"}, {"LD", 1, 0, 1, true, "Adjust fp"}, {"JMP", 7, 0, 3, true, "Return"}}},
+	{"inputb", 5, {{"ST", 3, -1, 1, true, "Store return address"}, {"INB", 2, 2, 2, false, "Grab bool input"},
+		{"LD", 3, -1, 1, true, "Load return address"}, {"LD", 1, 0, 1, true, "Adjust fp"}, {"JMP", 7, 0, 3, true, "Return"}}},
+	{"inputc", 5, {{"ST", 3, -1, 1, true, "Store return address"}, {"INC", 2, 2, 2, false, "Grab char input"},
+		{"LD", 3, -1, 1, true, "Load return address"}, {"LD", 1, 0, 1, true, "Adjust fp"}, {"JMP", 7, 0, 3, true, "Return"}}},
+	{"output", 6, {{"ST", 3, -1, 1, true, "Store return address"}, {"LD", 3, -2, 1, true, "Load parameter"},
+		{"OUT", 3, 3, 3, false, "Output integer"}, {"LD", 3, -1, 1, true, "Load return address"},
+		{"LD", 1, 0, 1, true, "Adjust fp"}, {"JMP", 7, 0, 3, true, "Return"}}},
+	{"outputb", 6, {{"ST", 3, -1, 1, true, "Store return address"}, {"LD", 3, -2, 1, true, "Load parameter"},
+		{"OUTB", 3, 3, 3, false, "Output bool"}, {"LD", 3, -1, 1, true, "Load return address"},
+		{"LD", 1, 0, 1, true, "Adjust fp"}, {"JMP", 7, 0, 3, true, "Return"}}},
+	{"outputc", 6, {{"ST", 3, -1, 1, true, "Store return address"}, {"LD", 3, -2, 1, true, "Load parameter"},
+		{"OUTC", 3, 3, 3, false, "Output char"}, {"LD", 3, -1, 1, true, "Load return address"},
+		{"LD", 1, 0, 1, true, "Adjust fp"}, {"JMP", 7, 0, 3, true, "Return"}}},
+	{"outnl", 5, {{"ST", 3, -1, 1, true, "Store return address"}, {"OUTNL", 3, 3, 3, false, "Output a newline"},
+		{"LD", 3, -1, 1, true, "Load return address"}, {"LD", 1, 0, 1, true, "Adjust fp"}, {"JMP", 7, 0, 3, true, "Return"}}}
+};
 
 // list of function names and their start addresses in instruction memory
 class FuncList
@@ -278,6 +329,12 @@ void generateCode(char* fileName)
 	inFunc = false;
 	globalList = NULL;
 	breakList = NULL;
+	imageCode.clear();
+	imageLits.clear();
+	imageLitCount = 0;
+	imageLitWords = 0;
+	imageComments.clear();
+	imageCommentOffsets.clear();
 
 	genHeader(fileName);
 
@@ -289,6 +346,11 @@ void generateCode(char* fileName)
 	genInitCode();
 
 	fclose(codeFile);
+
+	if (binaryImage)
+	{
+		writeImage(fileName);
+	}
 }
 
 // generates code and comments that go at the top of the output code file
@@ -302,72 +364,31 @@ void genHeader(char* fileName)
 	file.open(fileName, std::ios_base::app);
 
 	// output all of the built in functions to the file
-	file << divider << '\n';
-	file << "* FUNCTION input\n";
-	file << "  1:     ST  3,-1(1)	Store return address \n";
-	file << "  2:     IN  2,2,2	Grab int input \n";
-	file << "  3:     LD  3,-1(1)	Load return address \n";
-	file << "  4:     LD  1,0(1)	Adjust fp \n";
-	file << "  5:    JMP  7,0(3)	Return \n";
-	file << "* END FUNCTION input\n";
-	file << "* \n";
-	file << divider << '\n';
-	file << "* FUNCTION inputb\n";
-	file << "  6:     ST  3,-1(1)	Store return address \n";
-	file << "  7:    INB  2,2,2	Grab bool input \n";
-	file << "  8:     LD  3,-1(1)	Load return address \n";
-	file << "  9:     LD  1,0(1)	Adjust fp \n";
-	file << " 10:    JMP  7,0(3)	Return \n";
-	file << "* END FUNCTION inputb\n";
-	file << "* \n";
-	file << divider << '\n';
-	file << "* FUNCTION inputc\n";
-	file << " 11:     ST  3,-1(1)	Store return address \n";
-	file << " 12:    INC  2,2,2	Grab char input \n";
-	file << " 13:     LD  3,-1(1)	Load return address \n";
-	file << " 14:     LD  1,0(1)	Adjust fp \n";
-	file << " 15:    JMP  7,0(3)	Return \n";
-	file << "* END FUNCTION inputc\n";
-	file << "* \n";
-	file << divider << '\n';
-	file << "* FUNCTION output\n";
-	file << " 16:     ST  3,-1(1)	Store return address \n";
-	file << " 17:     LD  3,-2(1)	Load parameter \n";
-	file << " 18:    OUT  3,3,3	Output integer \n";
-	file << " 19:     LD  3,-1(1)	Load return address \n";
-	file << " 20:     LD  1,0(1)	Adjust fp \n";
-	file << " 21:    JMP  7,0(3)	Return \n";
-	file << "* END FUNCTION output\n";
-	file << "* \n";
-	file << divider << '\n';
-	file << "* FUNCTION outputb\n";
-	file << " 22:     ST  3,-1(1)	Store return address \n";
-	file << " 23:     LD  3,-2(1)	Load parameter \n";
-	file << " 24:   OUTB  3,3,3	Output bool \n";
-	file << " 25:     LD  3,-1(1)	Load return address \n";
-	file << " 26:     LD  1,0(1)	Adjust fp \n";
-	file << " 27:    JMP  7,0(3)	Return \n";
-	file << "* END FUNCTION outputb\n";
-	file << "* \n";
-	file << divider << '\n';
-	file << "* FUNCTION outputc\n";
-	file << " 28:     ST  3,-1(1)	Store return address \n";
-	file << " 29:     LD  3,-2(1)	Load parameter \n";
-	file << " 30:   OUTC  3,3,3	Output char \n";
-	file << " 31:     LD  3,-1(1)	Load return address \n";
-	file << " 32:     LD  1,0(1)	Adjust fp \n";
-	file << " 33:    JMP  7,0(3)	Return \n";
-	file << "* END FUNCTION outputc\n";
-	file << "* \n";
-	file << divider << '\n';
-	file << "* FUNCTION outnl\n";
-	file << " 34:     ST  3,-1(1)	Store return address \n";
-	file << " 35:  OUTNL  3,3,3	Output a newline \n";
-	file << " 36:     LD  3,-1(1)	Load return address \n";
-	file << " 37:     LD  1,0(1)	Adjust fp \n";
-	file << " 38:    JMP  7,0(3)	Return \n";
-	file << "* END FUNCTION outnl\n";
-	file << "* \n";
+	int addr = 1;
+	char line[128];
+	for (int i = 0; i < (int) (sizeof(headerFuncs) / sizeof(headerFuncs[0])); i++)
+	{
+		const HeaderFunc* func = &headerFuncs[i];
+		file << divider << '\n';
+		file << "* FUNCTION " << func->name << '\n';
+		for (int j = 0; j < func->size; j++)
+		{
+			const HeaderInstr* in = &func->code[j];
+			if (in->isRA)
+			{
+				sprintf(line, "%3d: %6s  %d,%d(%d)\t%s \n", addr, in->instr, in->a1, in->a2, in->a3, in->comment);
+			}
+			else
+			{
+				sprintf(line, "%3d: %6s  %d,%d,%d\t%s \n", addr, in->instr, in->a1, in->a2, in->a3, in->comment);
+			}
+			file << line;
+			recordInstruction(addr, in->instr, in->a1, in->a2, in->a3, std::string(in->comment) + " ");
+			addr++;
+		}
+		file << "* END FUNCTION " << func->name << '\n';
+		file << "* \n";
+	}
 	file << divider << '\n';
 
 	file.close();
@@ -1547,6 +1568,7 @@ void outputOpEndComment(TreeNode* node)
 int outputRTMInstruction(std::string instr, int r, int d, int s, std::string comment)
 {
 	fprintf(codeFile, "%d:\t%s %d,%d(%d)\t%s\n", iaddr, instr.c_str(), r, d, s, comment.c_str());
+	recordInstruction(iaddr, instr, r, d, s, comment);
 	iaddr++;
 	return iaddr - 1;
 }
@@ -1554,6 +1576,7 @@ int outputRTMInstruction(std::string instr, int r, int d, int s, std::string com
 int outputRTMInstruction(int addr, std::string instr, int r, int d, int s, std::string comment)
 {
 	fprintf(codeFile, "%d:\t%s %d,%d(%d)\t%s\n", addr, instr.c_str(), r, d, s, comment.c_str());
+	recordInstruction(addr, instr, r, d, s, comment);
 	return addr;
 }
 
@@ -1581,6 +1604,7 @@ int outputRTMInstruction(std::string instr, int r, char d, int s, std::string co
 			ch = d;
 	}
 	fprintf(codeFile, "%d:\t%s %d,'%s'(%d)\t%s\n", iaddr, instr.c_str(), r, ch.c_str(), s, comment.c_str());
+	recordInstruction(iaddr, instr, r, d, s, comment);
 	iaddr++;
 	return iaddr - 1;
 }
@@ -1588,6 +1612,7 @@ int outputRTMInstruction(std::string instr, int r, char d, int s, std::string co
 int outputInstruction(std::string instr, int r, int s, int t, std::string comment)
 {
 	fprintf(codeFile, "%d:\t%s %d,%d,%d\t%s\n", iaddr, instr.c_str(), r, s, t, comment.c_str());
+	recordInstruction(iaddr, instr, r, s, t, comment);
 	iaddr++;
 	return iaddr - 1;
 }
@@ -1595,9 +1620,142 @@ int outputInstruction(std::string instr, int r, int s, int t, std::string commen
 void outputLitInstruction(int addr, char* str, int size)
 {
 	fprintf(codeFile, "%d:\tLIT %s\n", abs(addr), str);
+	recordLit(abs(addr), str);
 	goffset -= size;
 	if (!inFunc)
 	{
 		foffset = goffset;
 	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//
+// Binary TM image (see tmImage.h)
+//
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// records an instruction for the binary image the way tm would load it from the text
+void recordInstruction(int addr, std::string instr, int a1, int a2, int a3, std::string comment)
+{
+	TMIMAGE_INSTR code;
+	int op;
+
+	if (!binaryImage)
+	{
+		return;
+	}
+
+	for (op = 0; op < TMIMAGE_NUM_OPS; op++)
+	{
+		if (instr == tmImageOpNames[op])
+		{
+			break;
+		}
+	}
+
+	// tm skips the blanks in front of a comment and for HALT and NOP everything before a '*'
+	size_t start = comment.find_first_not_of(" \t");
+	if (instr == "HALT" || instr == "NOP")
+	{
+		start = comment.find('*');
+	}
+	comment = (start == std::string::npos) ? "" : comment.substr(start);
+
+	code.op = op;
+	code.comment = TMIMAGE_NO_COMMENT;
+	if (comment.size() > 0)
+	{
+		std::map<std::string, int>::iterator found = imageCommentOffsets.find(comment);
+		if (found == imageCommentOffsets.end())
+		{
+			found = imageCommentOffsets.insert(std::make_pair(comment, (int) imageComments.size())).first;
+			imageComments += comment;
+			imageComments += '\0';
+		}
+		code.comment = found->second;
+	}
+	code.arg1 = a1;
+	code.arg2 = a2;
+	code.arg3 = a3;
+	code.pad = 0;
+
+	if (addr >= (int) imageCode.size())
+	{
+		TMIMAGE_INSTR unused;
+		unused.op = TMIMAGE_UNUSED;
+		unused.comment = TMIMAGE_NO_COMMENT;
+		unused.arg1 = unused.arg2 = unused.arg3 = unused.pad = 0;
+		imageCode.resize(addr + 1, unused);
+	}
+	imageCode[addr] = code;
+}
+
+// records a string LIT for the binary image.  The chars are read from the
+// quoted source text the way tm reads them: a \ or ^ is dropped and the
+// char after it is kept as is, and the string ends at the next '"' even
+// if it was escaped.
+void recordLit(int addr, char* str)
+{
+	TMIMAGE_LIT lit;
+	std::vector<int64_t> chars;
+
+	if (!binaryImage)
+	{
+		return;
+	}
+
+	for (int i = 1; str[i] != '\0'; i++)
+	{
+		if ((str[i] == '\\' || str[i] == '^') && str[i+1] != '\0')
+		{
+			i++;
+		}
+		if (str[i] == '"')
+		{
+			break;
+		}
+		chars.push_back(str[i]);
+	}
+
+	lit.loc = addr;
+	lit.length = chars.size();
+	imageLits.append((char*) &lit, sizeof(lit));
+	if (lit.length > 0)
+	{
+		imageLits.append((char*) &chars[0], chars.size() * sizeof(int64_t));
+	}
+	imageLitCount++;
+	imageLitWords += lit.length;
+}
+
+// writes the binary image next to the text code file (name.tm -> name.tmb)
+void writeImage(char* fileName)
+{
+	std::string imageName = fileName;
+	imageName += "b";
+
+	FILE* imageFile = fopen(imageName.c_str(), "wb");
+	if (imageFile == NULL)
+	{
+		printf("ERROR(IMAGE): could not write \"%s\".\n", imageName.c_str());
+		return;
+	}
+
+	TMIMAGE_HEADER header;
+	memcpy(header.magic, TMIMAGE_MAGIC, 4);
+	header.version = TMIMAGE_VERSION;
+	header.entry = 0;
+	header.instrCount = imageCode.size();
+	header.litCount = imageLitCount;
+	header.litWords = imageLitWords;
+	header.commentBytes = imageComments.size();
+	header.flags = 0;
+
+	fwrite(&header, sizeof(header), 1, imageFile);
+	fwrite(imageCode.data(), sizeof(TMIMAGE_INSTR), imageCode.size(), imageFile);
+	fwrite(imageLits.data(), 1, imageLits.size(), imageFile);
+	fwrite(imageComments.data(), 1, imageComments.size(), imageFile);
+	fclose(imageFile);
 }
\ No newline at end of file
@@ -4,6 +4,9 @@
 #include <fstream>
 #include "ast.h"
 
+// whether or not generateCode also writes a binary TM image (.tmb)
+extern bool binaryImage;
+
 // main function for generating code for the tiny machine vm
 void generateCode(char* fileName);
 // generates code and comments that go at the top of the output code file
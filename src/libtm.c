@@ -0,0 +1,5099 @@
+// // // // // // // // // // // // // // // // // // // // // // // //
+//
+// File: libtm.c
+// The TM ("Tiny Machine") virtual machine as a library (see libtm.h)
+//
+// Everything a machine has is in its TMMachine, so machines can be
+// made, loaded and run independently, on as many threads as wanted.
+// The only state shared between machines is read only: the opcode
+// names and the loader's opcode lookup, which is built once, and the
+// SIGSEGV handler of unchecked mode, installed once.  Nothing
+// here prints or exits.  Faults are returned as a STEPRESULT with the
+// details left for tmMessage(), and program I/O goes through the TMIO
+// callbacks.
+//
+// TO COMPILE: gcc -c libtm.c     (link with -pthread)
+//
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE             /* for mremap() */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <time.h>
+#include "tmImage.h"
+#include "tmMachine.h"
+
+/* indexed by OPCODE */
+const char *opCodeTab[] = {
+    "HALT", "NOP", "IN", "INB", "INC", "OUT", "OUTB", "OUTC", "OUTNL",
+    "ADD", "SUB", "MUL", "DIV", "MOD", "AND", "OR", "XOR", "NOT", "NEG", "SWP", "RND",
+    "TLT", "SLT", "TLE", "TGT", "SGT", "TGE", "TEQ", "TNE",
+    "MOV", "SET", "CO", "COA", "RRLim",
+    "LD", "ST", "LDA", "LDC", "JZR", "JNZ", "JMP", "RALim",
+    "LIT",
+    "END OF OPCODES"
+};
+
+/* needs to do a better job of producing error messages */
+const char *stepResultTab[] = {
+    "OK",
+    "Halted",
+    "ERROR: Instruction Memory Fault",
+    "ERROR: Set Data Memory Range Fault",
+    "ERROR: Set of Readonly Data Memory",
+    "ERROR: Read Data Memory Range Fault",
+    "ERROR: Division by 0",
+    "ERROR: Output Instruction Limit Exceeded",
+    "ERROR: Input Error"
+};
+
+char *emptyString = (char *)"";
+
+/* opcode lookup for the loader keyed by the first 4 chars of the name,
+   matching strncmp(opCodeTab[op], word, 4) with the first op winning.
+   It is built once by the first tmNew(), with the opcode numbering the
+   binary trace uses. */
+#define OPHASH_SIZE 128
+#define OPHASH(key) ((unsigned int)((key)*2654435761u) >> 25)
+static unsigned int opHashKey[OPHASH_SIZE];
+static int opHashOp[OPHASH_SIZE];        // OPCODE + 1, 0 means empty
+static unsigned char imageOp[opEND];     // OPCODE to its tmImageOpNames index
+static pthread_once_t opHashOnce = PTHREAD_ONCE_INIT;
+
+static unsigned int opKey(const char *name)
+{
+    unsigned int key;
+    int i;
+
+    key = 0;
+    for (i = 0; i<4 && name[i]; i++) key |= (unsigned int)(unsigned char)name[i] << (8*i);
+    return key;
+}
+
+static void initOpHash(void)
+{
+    int op, i;
+    unsigned int key, h;
+
+    for (op = 0; op<(int)opEND; op++) {
+        key = opKey(opCodeTab[op]);
+        for (h = OPHASH(key); opHashOp[h] && opHashKey[h] != key; h = (h+1) & (OPHASH_SIZE-1));
+        if (opHashOp[h] == 0) {
+            opHashKey[h] = key;
+            opHashOp[h] = op + 1;
+        }
+        for (i = 0; i<TMIMAGE_NUM_OPS && strcmp(opCodeTab[op], tmImageOpNames[i]) != 0; i++);
+        imageOp[op] = i;
+    }
+}
+
+int lookupOp(const char *name)
+{
+    unsigned int key, h;
+
+    key = opKey(name);
+    for (h = OPHASH(key); opHashOp[h]; h = (h+1) & (OPHASH_SIZE-1)) {
+        if (opHashKey[h] == key) return opHashOp[h] - 1;
+    }
+    return -1;
+}
+
+
+/********************************************/
+int opClass(int c)
+{
+    if (c <= (int)opRRLim) return opclRR;
+    else if (c <= (int)opRALim) return opclRA;
+    else return opclLIT;
+}
+
+
+/********************************************/
+/* messages */
+
+const char *tmMessage(TMMachine *m)
+{
+    return m->message;
+}
+
+void tmSetMessage(TMMachine *m, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(m->message, MESSAGE_SIZE, format, args);
+    va_end(args);
+}
+
+const char *tmResultText(STEPRESULT result)
+{
+    if ((int)result<0 || result>srINPUT_ERR) return "ERROR: Unknown Result";
+    return stepResultTab[result];
+}
+
+
+
+/********************************************/
+/* the ad hoc scanner */
+
+/* get the next character
+*/
+int getCh(TMSCAN *sc)
+{
+//    printf("LINE: \'%s\'  LINELEN: %d INCOL: %d\n", sc->in_Line, sc->lineLen, sc->inCol);
+    if (++sc->inCol<sc->lineLen) {
+	sc->ch = sc->in_Line[sc->inCol];
+        return 1;
+    }
+    else {
+	sc->ch = ' ';
+        return 0;
+    }
+}
+
+
+
+/********************************************/
+/* span a bunch of whitespace
+*/
+int nonBlank(TMSCAN *sc)
+{
+    while ((sc->inCol<sc->lineLen) &&
+	   ((sc->in_Line[sc->inCol] == ' ') || (sc->in_Line[sc->inCol] == '\t'))) sc->inCol++;
+    if (sc->inCol<sc->lineLen) {
+	sc->ch = sc->in_Line[sc->inCol];
+	return TRUE;
+    }
+    else {
+	sc->ch = ' ';
+	return FALSE;
+    }
+}
+
+/********************************************/
+/* span a bunch of whitespace
+*/
+int uptoComment(TMSCAN *sc)
+{
+    while ((sc->inCol<sc->lineLen) && (sc->in_Line[sc->inCol] != '*')) sc->inCol++;
+    if (sc->inCol<sc->lineLen) {
+	sc->ch = sc->in_Line[sc->inCol];
+	return TRUE;
+    }
+    else {
+	sc->ch = ' ';
+	return FALSE;
+    }
+}
+
+
+//  returns the numerical equivalent of a character in num.
+//  returns success or failure in function value
+//
+void getCleanChar(TMSCAN *sc)
+{
+        getCh(sc);
+        if (sc->ch == '\\') {
+            getCh(sc);
+            if (sc->ch == '0') sc->num = '\0';
+            else if (sc->ch == 't') sc->num = '\t';
+            else if (sc->ch == 'n') sc->num = '\n';
+            else if (sc->ch == '\\') sc->num = '\\';
+            else if (sc->ch == '\'') sc->num = '\'';
+            else sc->num = sc->ch;
+        }
+        else if (sc->ch == '^') {
+            getCh(sc);
+            sc->num = sc->ch;
+            sc->num ^= 0x40;
+        }
+        else {
+            sc->num = sc->ch;
+        }
+}
+
+
+// return a string in word[]
+int getString(TMSCAN *sc)
+{
+    int i;
+    int ok = FALSE;
+    if (sc->ch == '"') {
+        i = 0;
+        do {
+            getCleanChar(sc);
+            sc->word[i++] = sc->ch;
+        } while (sc->ch != '"');
+        sc->word[i-1] = '\0';
+        ok = TRUE;
+    }
+
+    return ok;
+}
+
+int getChar(TMSCAN *sc)
+{
+    int ok = FALSE;
+
+    sc->num = 0;
+    if (sc->ch == '\'') {
+        getCleanChar(sc);
+        getCh(sc);
+        if (sc->ch == '\'') {
+            ok = TRUE;
+            getCh(sc);
+        }
+    }
+
+    return ok;
+}
+
+//  returns the number in num.
+// returns success or failure in function value
+//
+int getNum(TMSCAN *sc)
+{
+    int sign;
+    long long int term;
+    int ok = FALSE;
+
+    sc->num = 0;
+    nonBlank(sc);
+    do {
+	sign = 1;
+	while ((sc->ch == '+') || (sc->ch == '-')) {
+	    ok = FALSE;
+	    if (sc->ch == '-')
+		sign = -sign;
+	    getCh(sc);
+	}
+	term = 0;
+	while (isdigit(sc->ch)) {
+	    ok = TRUE;
+	    term = term*10 + (sc->ch - '0');
+	    getCh(sc);
+	}
+	sc->num = sc->num + (term*sign);
+    }
+    while ((sc->ch == '+') || (sc->ch == '-'));
+
+//    printf("NUM: %d\n", sc->num);
+    return ok;
+}				/* getNum */
+
+
+
+
+
+/********************************************/
+int getNumOrChar(TMSCAN *sc)
+{
+    nonBlank(sc);
+    if ((sc->ch == '+') || (sc->ch == '-') || isdigit(sc->ch)) return getNum(sc);
+    else return getChar(sc);
+}
+
+
+/********************************************/
+int getWord(TMSCAN *sc)
+{
+    int temp = FALSE;
+    int length = 0;
+    if (nonBlank(sc)) {
+	while (isalnum(sc->ch) || sc->ch=='=' || sc->ch=='?') {
+	    if (length<WORDSIZE - 1)
+		sc->word[length++] = sc->ch;
+	    getCh(sc);
+	}
+	sc->word[length] = '\0';
+	temp = (length != 0);
+    }
+    return temp;
+}				/* getWord */
+
+
+/********************************************/
+int getBool(TMSCAN *sc)
+{
+    nonBlank(sc);
+
+    sc->num = 1;
+    if ((sc->ch=='F') || (sc->ch=='f') || (sc->ch=='0')) sc->num = 0;
+    getWord(sc);
+
+    return TRUE;
+}
+
+
+/********************************************/
+int skipCh(TMSCAN *sc, char c)
+{
+    int temp = FALSE;
+    if (nonBlank(sc) && (sc->ch == c)) {
+	getCh(sc);
+	temp = TRUE;
+    }
+    return temp;
+}				/* skipCh */
+
+
+
+/********************************************/
+/* note this returns a duplicate string and not true or false */
+char *getRemaining(TMSCAN *sc)
+{
+    skipCh(sc, ')');
+    if (nonBlank(sc)) return strdup(&sc->in_Line[sc->inCol]);
+    return emptyString;
+}
+
+
+
+/********************************************/
+int atEOL(TMSCAN *sc)
+{
+    return (!nonBlank(sc));
+}				/* atEOL */
+
+
+
+/********************************************/
+static int error(TMMachine *m, const char *msg, int lineNo, int instNo)
+{
+    if (instNo >= 0) tmSetMessage(m, "ERROR: Line %d (Address: %d)   %s", lineNo, instNo, msg);
+    else tmSetMessage(m, "ERROR: Line %d   %s", lineNo, msg);
+    return FALSE;
+}				/* error */
+
+
+
+/********************************************/
+/* the machine */
+
+/* map count zero filled elements of memory.  Pages are only
+   committed when they are first touched.  NULL if it can't be done.
+*/
+static void *newMemory(size_t count, size_t size)
+{
+    void *mem;
+    int flags;
+
+    flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+    mem = mmap(NULL, count*size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    return (mem == MAP_FAILED ? NULL : mem);
+}
+
+
+/* return memory from newMemory() to all zeros, releasing its pages */
+static void zeroMemory(void *mem, size_t count, size_t size)
+{
+    if (madvise(mem, count*size, MADV_DONTNEED) != 0) memset(mem, 0, count*size);
+}
+
+
+/* zero elements from..to-1 of memory from newMemory().  A few pages
+   are zeroed by hand, which keeps them.  The whole pages of more are
+   given back instead, to be faulted in again as zeros when touched. */
+static void zeroRange(void *mem, size_t from, size_t to, size_t size)
+{
+    char *lo, *hi, *pageLo, *pageHi;
+    uintptr_t page;
+
+    if (from>=to) return;
+    lo = (char *)mem + from*size;
+    hi = (char *)mem + to*size;
+    page = sysconf(_SC_PAGESIZE);
+    pageLo = (char *)(((uintptr_t)lo + page - 1) & ~(page - 1));
+    pageHi = (char *)((uintptr_t)hi & ~(page - 1));
+    if (hi - lo<=ZERO_BY_HAND || pageHi<=pageLo || madvise(pageLo, pageHi - pageLo, MADV_DONTNEED) != 0) {
+        memset(lo, 0, hi - lo);
+        return;
+    }
+    memset(lo, 0, pageLo - lo);
+    memset(pageHi, 0, hi - pageHi);
+}
+
+
+static void freeMemory(void *mem, size_t count, size_t size)
+{
+    if (mem) munmap(mem, count*size);
+}
+
+
+/* dMem from lo to hi has been written */
+static void dirtyDMem(TMMachine *m, int lo, int hi)
+{
+    if (lo>hi) return;
+    if (lo<m->dirtyLow) m->dirtyLow = lo;
+    if (hi>m->dirtyHigh) m->dirtyHigh = hi;
+}
+
+
+/* the part of dMem that need not be zero: lo..hi (none if lo>hi) */
+static void usedDMem(TMMachine *m, int *lo, int *hi)
+{
+    TMMachine *p;
+
+    p = (m->program ? m->program : m);
+    *lo = m->dirtyLow;
+    *hi = m->dirtyHigh;
+    if (m->litIn && p->litFrom<m->dMemSize) {
+        if (p->litFrom<*lo) *lo = p->litFrom;
+        *hi = m->dMemSize - 1;
+    }
+}
+
+
+/* put dMem and dMemTag back as they were after the load, with
+   the LIT data of the program if withLit is set and zeros if not.  Only
+   what was written since the last time is done. */
+static void resetDMem(TMMachine *m, int withLit)
+{
+    TMMachine *p;
+    int lit, lo, hi, from;
+
+    p = (m->program ? m->program : m);
+    lit = (withLit ? p->litFrom : m->dMemSize);
+    lo = m->dirtyLow;
+    hi = m->dirtyHigh;
+    if (m->litIn != withLit && p->litFrom<m->dMemSize) {
+        if (p->litFrom<lo) lo = p->litFrom;
+        hi = m->dMemSize - 1;
+    }
+
+    if (lo<=hi) {
+        from = (hi<lit ? hi + 1 : lit);
+        zeroRange(m->dMem, lo, from, sizeof(long long int));
+        zeroRange(m->dMemTag, lo, from, sizeof(int));
+        if (from<lo) from = lo;
+        if (from<=hi) {
+            memcpy(&m->dMem[from], &p->litDMem[from - lit], (hi - from + 1)*sizeof(long long int));
+            memcpy(&m->dMemTag[from], &p->litTag[from - lit], (hi - from + 1)*sizeof(int));
+        }
+    }
+    m->dirtyLow = m->dMemSize;
+    m->dirtyHigh = -1;
+    m->litIn = withLit;
+    m->readOnlyLow = lit;
+}
+
+
+/* forget the LIT data kept by keepLit() */
+static void dropLit(TMMachine *m)
+{
+    if (m->program == NULL) {
+        free(m->litDMem);
+        free(m->litTag);
+    }
+    m->litDMem = NULL;
+    m->litTag = NULL;
+    m->litFrom = m->dMemSize;
+    m->litIn = FALSE;
+}
+
+
+/* the LIT data just loaded is kept for resetDMem() */
+static void keepLit(TMMachine *m)
+{
+    int n;
+
+    n = m->dMemSize - m->readOnlyLow;
+    if (n == 0) return;
+    m->litDMem = (long long int *)malloc(n*sizeof(long long int));
+    m->litTag = (int *)malloc(n*sizeof(int));
+    if (m->litDMem == NULL || m->litTag == NULL) {
+        dropLit(m);
+        return;
+    }
+    memcpy(m->litDMem, &m->dMem[m->readOnlyLow], n*sizeof(long long int));
+    memcpy(m->litTag, &m->dMemTag[m->readOnlyLow], n*sizeof(int));
+    m->litFrom = m->readOnlyLow;
+    m->litIn = TRUE;
+    m->dirtyLow = m->dMemSize;
+    m->dirtyHigh = -1;
+}
+
+
+/* forget the sampled call stacks */
+static void clearSamples(TMMachine *m)
+{
+    FLAMESTACK *fs, *next;
+    int i;
+
+    m->flameLeft = m->flameInterval;
+    if (m->flameStacks == 0) return;
+    for (i = 0; i<FLAME_HASH; i++) {
+        for (fs = m->flameTab[i]; fs; fs = next) {
+            next = fs->next;
+            free(fs->frames);
+            free(fs);
+        }
+        m->flameTab[i] = NULL;
+    }
+    m->flameStacks = 0;
+}
+
+
+/* clear registers and data memory, leaving the LIT data of the program
+   in place if withLit is set.  Only what the runs since the last clear
+   touched is zeroed, so a clear costs what they did. */
+static void clearMachine(TMMachine *m, int withLit)
+{
+    int regNo, loc;
+
+    for (regNo = 0; regNo<NO_REGS; regNo++) m->reg[regNo] = 0;
+    m->reg[0] = m->dMemSize - 1;   // v 4.6
+    m->reg[PC_REG] = m->entryPc;
+    m->breakSkip = -1;
+
+// NO LONGER starting v4.6   dMem[0] = DADDR_SIZE - 1;
+    resetDMem(m, withLit);
+    m->leanRan = FALSE;
+
+    m->instrCount = m->outputInstrCount = 0;
+    memset(&m->stats, 0, sizeof(RUNSTATS));
+    for (loc = 0; loc<fxEND; loc++) m->fuseRuns[loc] = 0;
+    zeroRange(m->iMemCount, 0, m->profileTop, sizeof(long long int));
+    m->profileTop = 0;
+    clearSamples(m);
+
+    /* a new execution sees the input file from the start again */
+    if (m->inputFile && m->inputFile!=stdin) rewind(m->inputFile);
+}
+
+void tmClear(TMMachine *m)
+{
+    clearMachine(m, m->program != NULL);
+}
+
+void tmRerun(TMMachine *m)
+{
+    clearMachine(m, TRUE);
+}
+
+
+/* nothing points into the loaded program text or binary image any more */
+static void dropProgram(TMMachine *m)
+{
+    if (m->imageMap) {
+        if (m->imageMapped) munmap(m->imageMap, m->imageMapSize);
+        else free(m->imageMap);
+    }
+    m->imageMap = NULL;
+    free(m->loadBuffer);
+    m->loadBuffer = NULL;
+}
+
+
+/* clear registers, data and instruction memory */
+static void fullClearMachine(TMMachine *m)
+{
+    int i, top;
+
+    /* clear registers and data memory */
+    m->entryPc = 0;
+    m->loads++;
+    clearMachine(m, FALSE);
+    dropLit(m);
+
+    /* zero out instruction memory (all HALT 0,0,0 and UNUSED) up to the
+       last address loaded, or patched for a breakpoint */
+    top = m->iMemTop + 1;
+    if (m->breakCount>0 && m->breaks[m->breakCount-1].addr + 2>top) top = m->breaks[m->breakCount-1].addr + 2;
+    if (top>m->iMemSize) top = m->iMemSize;
+    m->breakCount = 0;
+    zeroRange(m->iMem, 0, top, sizeof(INSTRUCTION));
+    zeroRange(m->iMemTag, 0, top, sizeof(int));
+    zeroRange(m->fastCode, 0, top + 1, sizeof(DECODED));
+    zeroRange(m->iMemCmt, 0, top, sizeof(char *));
+    zeroRange(m->iMemLine, 0, top, sizeof(int));
+    zeroRange(m->iMemFunc, 0, top, sizeof(int));
+    m->iMemTop = 0;
+    m->fastCodeStale = TRUE;
+    if (m->coverMap) zeroMemory(m->coverMap, m->iMemSize, sizeof(char));
+
+    /* forget the source map */
+    for (i = 1; i<m->funcCount; i++) free(m->funcName[i]);
+    m->funcCount = 1;
+    m->srcLine = m->srcFunc = 0;
+
+    dropProgram(m);
+}
+
+
+/* map the memories that hold the program */
+static int newProgramMemory(TMMachine *m)
+{
+    m->iMem = (INSTRUCTION *)newMemory(m->iMemSize, sizeof(INSTRUCTION));
+    m->iMemTag = (int *)newMemory(m->iMemSize, sizeof(int));
+    m->iMemCmt = (char **)newMemory(m->iMemSize, sizeof(char *));
+    m->iMemLine = (int *)newMemory(m->iMemSize, sizeof(int));
+    m->iMemFunc = (int *)newMemory(m->iMemSize, sizeof(int));
+    m->funcName = NULL;
+    m->funcCount = 1;
+    return m->iMem && m->iMemTag && m->iMemCmt && m->iMemLine && m->iMemFunc;
+}
+
+
+/* a machine of the given sizes with its own memories for a run but
+   none yet for the program */
+static TMMachine *newMachine(int iMemSize, int dMemSize)
+{
+    TMMachine *m;
+
+    pthread_once(&opHashOnce, initOpHash);
+
+    m = (TMMachine *)calloc(1, sizeof(TMMachine));
+    if (m == NULL) return NULL;
+
+    /* map the memories */
+    m->iMemSize = iMemSize;
+    m->dMemSize = dMemSize;
+    m->iMemCount = (long long int *)newMemory(iMemSize, sizeof(long long int));
+    m->fastCode = (DECODED *)newMemory(iMemSize+1, sizeof(DECODED));
+    m->blockStart = (char *)newMemory(iMemSize+1, sizeof(char));
+    m->blockAt = (int *)newMemory(iMemSize, sizeof(int));
+    m->dMem = (long long int *)newMemory(dMemSize, sizeof(long long int));
+    m->dMemTag = (int *)newMemory(dMemSize, sizeof(int));
+    if (!m->iMemCount || !m->fastCode || !m->blockStart || !m->blockAt || !m->dMem || !m->dMemTag) {
+        tmFree(m);
+        return NULL;
+    }
+
+    /* the defaults */
+    m->tagflag = TRUE;
+    m->outputLimit = DEFAULT_OUTPUT_LIMIT;
+    m->outputMode = omBLOCK;
+    m->outputFile = stdout;
+    m->funcCount = 1;
+    m->flameInterval = FLAME_INTERVAL;
+    m->dirtyLow = m->litFrom = dMemSize;
+    m->dirtyHigh = -1;
+    tmSetSeed(m, 1);
+    return m;
+}
+
+
+TMMachine *tmNew(int iMemSize, int dMemSize)
+{
+    TMMachine *m;
+
+    if (iMemSize == 0) iMemSize = IADDR_SIZE;
+    if (dMemSize == 0) dMemSize = DADDR_SIZE;
+    if (iMemSize<1 || iMemSize>MAX_ADDR_SIZE || dMemSize<1 || dMemSize>MAX_ADDR_SIZE) return NULL;
+    m = newMachine(iMemSize, dMemSize);
+    if (m == NULL) return NULL;
+    if (! newProgramMemory(m)) {
+        tmFree(m);
+        return NULL;
+    }
+
+    fullClearMachine(m);
+    return m;
+}
+
+
+TMMachine *tmNewShared(TMMachine *program)
+{
+    TMMachine *m;
+
+    m = newMachine(program->iMemSize, program->dMemSize);
+    if (m == NULL) return NULL;
+
+    m->program = program;
+    m->iMem = program->iMem;
+    m->iMemTag = program->iMemTag;
+    m->iMemCmt = program->iMemCmt;
+    m->iMemLine = program->iMemLine;
+    m->iMemFunc = program->iMemFunc;
+    m->funcName = program->funcName;
+    m->funcCount = program->funcCount;
+    m->iMemTop = program->iMemTop;
+    m->entryPc = program->entryPc;
+    memcpy(m->pgmName, program->pgmName, WORDSIZE);
+    m->fastCodeStale = TRUE;
+
+    clearMachine(m, TRUE);
+    return m;
+}
+
+
+/* a machine sharing a program is about to load one: give it its own */
+static int ownProgram(TMMachine *m)
+{
+    if (m->program == NULL) return TRUE;
+    resetDMem(m, FALSE);
+    m->program = NULL;
+    if (newProgramMemory(m)) return TRUE;
+    tmSetMessage(m, "ERROR: unable to map memory for the program");
+    return FALSE;
+}
+
+
+void tmFree(TMMachine *m)
+{
+    int i;
+
+    if (m == NULL) return;
+    tmTraceFile(m, NULL, 0);
+    clearSamples(m);
+    dropProgram(m);
+    if (m->inputFile && m->inputFile!=stdin) fclose(m->inputFile);
+    free(m->inputName);
+    free(m->blockCode);
+    free(m->breaks);
+    dropLit(m);
+    if (m->program == NULL) {
+        if (m->funcName) for (i = 1; i<m->funcCount; i++) free(m->funcName[i]);
+        free(m->funcName);
+        freeMemory(m->iMem, m->iMemSize, sizeof(INSTRUCTION));
+        freeMemory(m->iMemTag, m->iMemSize, sizeof(int));
+        freeMemory(m->iMemCmt, m->iMemSize, sizeof(char *));
+        freeMemory(m->iMemLine, m->iMemSize, sizeof(int));
+        freeMemory(m->iMemFunc, m->iMemSize, sizeof(int));
+    }
+    freeMemory(m->iMemCount, m->iMemSize, sizeof(long long int));
+    freeMemory(m->coverMap, m->iMemSize, sizeof(char));
+    freeMemory(m->fastCode, m->iMemSize+1, sizeof(DECODED));
+    freeMemory(m->blockStart, m->iMemSize+1, sizeof(char));
+    freeMemory(m->blockAt, m->iMemSize, sizeof(int));
+    if (m->jitCode) {
+        munmap(m->jitCode, JIT_CODE_SIZE);
+        freeMemory(m->jitAt, m->iMemSize, sizeof(int));
+    }
+    if (m->dMemGuard) munmap(m->dMemGuard, m->dMemGuardSize);
+    else freeMemory(m->dMem, m->dMemSize, sizeof(long long int));
+    if (m->dMemTagGuard) munmap(m->dMemTagGuard, m->dMemTagGuardSize);
+    else freeMemory(m->dMemTag, m->dMemSize, sizeof(int));
+    free(m);
+}
+
+
+
+/********************************************/
+/* settings and state */
+
+void tmSetIO(TMMachine *m, const TMIO *io)
+{
+    if (io) m->io = *io;
+    else memset(&m->io, 0, sizeof(TMIO));
+}
+
+int tmSetInputFile(TMMachine *m, const char *name)
+{
+    FILE *in;
+
+    if (name == NULL) in = NULL;
+    else if (strcmp(name, "-") == 0) in = stdin;
+    else in = fopen(name, "r");
+    if (in == NULL && name) {
+        tmSetMessage(m, "ERROR: unable to open input file: %s", name);
+        return FALSE;
+    }
+    if (m->inputFile && m->inputFile!=stdin) fclose(m->inputFile);
+    free(m->inputName);
+    m->inputFile = in;
+    m->inputName = (name ? strdup(name) : NULL);
+    if (in) setvbuf(in, NULL, _IOFBF, INPUT_BUFFER_SIZE);
+    return TRUE;
+}
+
+void tmSetOutputFile(TMMachine *m, FILE *out)
+{
+    m->outputFile = out;
+}
+
+void tmSetOutputMode(TMMachine *m, OUTPUTMODE mode)
+{
+    m->outputMode = mode;
+}
+
+void tmSetOutputLimit(TMMachine *m, int limit)
+{
+    m->outputLimit = limit;
+}
+
+/* RND uses the same generator as random() so a seed gives the numbers
+   srandom() would */
+void tmSetSeed(TMMachine *m, unsigned int seed)
+{
+#ifdef __GLIBC__
+    memset(&m->randomData, 0, sizeof(m->randomData));
+    initstate_r(seed, m->randomState, sizeof(m->randomState), &m->randomData);
+#else
+    m->randomNext = seed;
+#endif
+}
+
+static long long int nextRandom(TMMachine *m)
+{
+#ifdef __GLIBC__
+    int32_t value;
+
+    random_r(&m->randomData, &value);
+    return value;
+#else
+    m->randomNext = m->randomNext*6364136223846793005ULL + 1442695040888963407ULL;
+    return (long long int)(m->randomNext >> 33);
+#endif
+}
+
+void tmSetLean(TMMachine *m, int lean)
+{
+    m->leanflag = (lean != 0);
+    m->fastCodeStale = TRUE;
+}
+
+long long int tmGetReg(TMMachine *m, int r)
+{
+    return (r>=0 && r<NO_REGS ? m->reg[r] : 0);
+}
+
+void tmSetReg(TMMachine *m, int r, long long int value)
+{
+    if (r<0 || r>=NO_REGS) return;
+    m->reg[r] = value;
+    dropBlocks(m);
+}
+
+int tmGetDMem(TMMachine *m, int addr, long long int *value)
+{
+    if (addr<0 || addr>=m->dMemSize) return FALSE;
+    *value = m->dMem[addr];
+    return TRUE;
+}
+
+int tmSetDMem(TMMachine *m, int addr, long long int value)
+{
+    if (addr<0 || addr>=m->dMemSize) return FALSE;
+    m->dMem[addr] = value;
+    dirtyDMem(m, addr, addr);
+    dropBlocks(m);
+    return TRUE;
+}
+
+int tmIMemSize(TMMachine *m)
+{
+    return m->iMemSize;
+}
+
+int tmDMemSize(TMMachine *m)
+{
+    return m->dMemSize;
+}
+
+int tmPc(TMMachine *m)
+{
+    return m->pc;
+}
+
+long long int tmInstructions(TMMachine *m)
+{
+    return m->instrCount;
+}
+
+int tmOutputs(TMMachine *m)
+{
+    return m->outputInstrCount;
+}
+
+void tmGetStats(TMMachine *m, TMSTATS *stats)
+{
+    RUNSTATS *st = &m->stats;
+    long long int a;
+
+    memset(stats, 0, sizeof(TMSTATS));
+    stats->instructions = m->instrCount;
+    stats->outputs = m->outputInstrCount;
+    stats->wallSeconds = st->wallSeconds;
+    stats->cpuSeconds = st->cpuSeconds;
+    if (st->wallSeconds>0) stats->instructionsPerSecond = m->instrCount/st->wallSeconds;
+    stats->frames = st->frames;
+    if (st->frames) {
+        stats->stackWords = st->fpFirst - st->fpLow;
+        stats->lowestFp = st->fpLow;
+        stats->callDepth = st->callPeak;
+
+        /* the globals are above the first frame and the LIT words at
+           the top, so the lowest one set or LIT is where they end */
+        a = st->fpFirst + 1;
+        if (a<0) a = 0;
+        while (a<m->dMemSize && m->dMemTag[a] == UNUSED && !(m->leanRan && m->dMem[a] != 0)) a++;
+        stats->globalWords = (a<m->dMemSize ? m->dMemSize - a : 0);
+    }
+    stats->movWords = st->movWords;
+    stats->setWords = st->setWords;
+    stats->coWords = st->coWords;
+}
+
+
+
+/********************************************/
+/* breakpoints.  m->breaks is kept sorted by address so the trap at an
+   address finds its breakpoint by binary search. */
+
+/* the index of the breakpoint at addr or, if there is none, minus one
+   more than the index where it would go */
+static int findBreak(TMMachine *m, int addr)
+{
+    int lo, hi, mid;
+
+    lo = 0;
+    hi = m->breakCount - 1;
+    while (lo<=hi) {
+        mid = (lo + hi)/2;
+        if (m->breaks[mid].addr<addr) lo = mid + 1;
+        else if (m->breaks[mid].addr>addr) hi = mid - 1;
+        else return mid;
+    }
+    return -lo - 1;
+}
+
+
+/* does the breakpoint at loc (there must be one) stop the run? */
+static int breakHit(TMMachine *m, int loc)
+{
+    TMBREAKPOINT *bp;
+    long long int v, a;
+
+    bp = &m->breaks[findBreak(m, loc)];
+    if (bp->compare == tmALWAYS) return TRUE;
+    if (bp->reg >= 0) v = m->reg[bp->reg];
+    else {
+        a = bp->offset + (bp->base >= 0 ? m->reg[bp->base] : 0);
+        if (a<0 || a>=m->dMemSize) return FALSE;
+        v = m->dMem[a];
+    }
+    switch (bp->compare) {
+    case tmEQ: return v == bp->value;
+    case tmNE: return v != bp->value;
+    case tmLT: return v<bp->value;
+    case tmLE: return v<=bp->value;
+    case tmGT: return v>bp->value;
+    case tmGE: return v>=bp->value;
+    default: return TRUE;
+    }
+}
+
+
+/* swap a trap in for the instruction at addr in fastCode.  It is made
+   a block of its own so that nothing before it is fused with it or run
+   past it without a check.  Translated blocks must be dropped after. */
+static void patchTrap(TMMachine *m, int addr)
+{
+    m->fastCode[addr].op = fxTRAP;
+    m->blockStart[addr] = TRUE;
+    m->blockStart[addr+1] = TRUE;
+    if (addr+2>m->blockStartTop) m->blockStartTop = addr+2;
+}
+
+/* decoding again finishes the job (past iMemTop there is nothing to
+   decode so this is all of it) */
+static void unpatchTrap(TMMachine *m, int addr)
+{
+    m->fastCode[addr].op = m->fastCode[addr].plain;
+}
+
+static void patchTraps(TMMachine *m)
+{
+    int i;
+
+    for (i = 0; i<m->breakCount; i++) patchTrap(m, m->breaks[i].addr);
+}
+
+
+int tmAddBreakpoint(TMMachine *m, const TMBREAKPOINT *bp)
+{
+    TMBREAKPOINT *breaks;
+    int i, size;
+
+    if (bp->addr<0 || bp->addr>=m->iMemSize) {
+        tmSetMessage(m, "ERROR: breakpoint at %d is outside of instruction memory", bp->addr);
+        return FALSE;
+    }
+    if (bp->compare<tmALWAYS || bp->compare>tmGE ||
+        (bp->compare != tmALWAYS && (bp->reg<-1 || bp->reg>=NO_REGS || bp->base<-1 || bp->base>=NO_REGS))) {
+        tmSetMessage(m, "ERROR: breakpoint at %d has a bad condition", bp->addr);
+        return FALSE;
+    }
+
+    i = findBreak(m, bp->addr);
+    if (i<0) {
+        if (m->breakCount == m->breakSize) {
+            size = 2*m->breakSize + 16;
+            breaks = (TMBREAKPOINT *)realloc(m->breaks, size*sizeof(TMBREAKPOINT));
+            if (breaks == NULL) {
+                tmSetMessage(m, "ERROR: no memory for another breakpoint");
+                return FALSE;
+            }
+            m->breaks = breaks;
+            m->breakSize = size;
+        }
+        i = -i - 1;
+        memmove(&m->breaks[i+1], &m->breaks[i], (m->breakCount - i)*sizeof(TMBREAKPOINT));
+        m->breakCount++;
+    }
+    m->breaks[i] = *bp;
+
+    if (!m->fastCodeStale) {
+        patchTrap(m, bp->addr);
+        dropBlocks(m);
+    }
+    return TRUE;
+}
+
+/* the code is decoded again, which puts back any superinstruction a
+   trap broke up */
+int tmRemoveBreakpoint(TMMachine *m, int addr)
+{
+    int i;
+
+    if (addr == -1) {
+        if (m->breakCount == 0) return FALSE;
+        for (i = 0; i<m->breakCount; i++) unpatchTrap(m, m->breaks[i].addr);
+        m->breakCount = 0;
+    }
+    else {
+        i = findBreak(m, addr);
+        if (i<0) return FALSE;
+        unpatchTrap(m, addr);
+        memmove(&m->breaks[i], &m->breaks[i+1], (m->breakCount - i - 1)*sizeof(TMBREAKPOINT));
+        m->breakCount--;
+    }
+    m->fastCodeStale = TRUE;
+    return TRUE;
+}
+
+int tmBreakpoints(TMMachine *m)
+{
+    return m->breakCount;
+}
+
+const TMBREAKPOINT *tmBreakpoint(TMMachine *m, int i)
+{
+    return (i >= 0 && i<m->breakCount ? &m->breaks[i] : NULL);
+}
+
+const TMBREAKPOINT *tmBreakpointAt(TMMachine *m, int addr)
+{
+    int i;
+
+    i = findBreak(m, addr);
+    return (i >= 0 ? &m->breaks[i] : NULL);
+}
+
+void tmSetBreakpoint(TMMachine *m, int addr)
+{
+    TMBREAKPOINT bp;
+
+    if (addr<0) {
+        tmRemoveBreakpoint(m, -1);
+        return;
+    }
+    memset(&bp, 0, sizeof(bp));
+    bp.addr = addr;
+    bp.compare = tmALWAYS;
+    tmAddBreakpoint(m, &bp);
+}
+
+int tmMainEntry(TMMachine *m)
+{
+    INSTRUCTION *in;
+    int loc;
+
+    for (loc = 0; loc<m->iMemTop; loc++) {
+        in = &m->iMem[loc];
+        if (in->iop == opJMP && in->iarg1 == PC_REG && in->iarg3 == PC_REG &&
+            m->iMemCmt[loc] && strncmp(m->iMemCmt[loc], "Jump to main", 12) == 0) {
+            return loc + 1 + in->iarg2;
+        }
+    }
+    return -1;
+}
+
+
+
+/********************************************/
+/* data memory as the instructions see it.  A fault is described in the
+   message and returned. */
+
+static STEPRESULT setDMem(TMMachine *m, int a, long long int value)
+{
+    if (a<0 ||  a>=m->dMemSize) {
+        tmSetMessage(m, "ERROR(setDMem): instruction at addr %d attempting to set out of bounds data memory at loc: %d", m->pc, a);
+        return srDMEM_SET_ERR;
+    }
+    if (m->dMemTag[a]==READONLY) {
+        tmSetMessage(m, "ERROR(setDMem): instruction at addr %d attempting to set data memory marked as read only at loc: %d", m->pc, a);
+        return srDMEM_RONLY_ERR;
+    }
+
+    m->dMem[a] = value;
+    dirtyDMem(m, a, a);
+    if (m->tagflag) m->dMemTag[a] = m->pc + 1;
+    return srOKAY;
+}
+
+
+
+static STEPRESULT getDMem(TMMachine *m, int a, long long int *value)
+{
+    if (a<0 ||  a>=m->dMemSize) {
+        tmSetMessage(m, "ERROR(getDMem): instruction at addr %d attempting to get out of bounds data memory at loc: %d", m->pc, a);
+        return srDMEM_READ_ERR;
+    }
+    *value = m->dMem[a];
+    return srOKAY;
+}
+
+
+
+/********************************************/
+/* loading */
+
+static void decodeInstructions(TMMachine *m);
+
+/* load a binary image written by c- -B (see tmImage.h).  The comments
+   are used where they lie in the image, so there is no parsing and no
+   copying beyond filling iMem and the LIT data.  The result is the same
+   as loading the matching .tm text.  The machine owns map from here on:
+   it is unmapped (mapped true) or freed when done with. */
+static int readImage(TMMachine *m, const char *fileName, char *map, size_t size, int mapped)
+{
+    char *p, *end;
+    TMIMAGE_HEADER *header;
+    TMIMAGE_INSTR *code;
+    TMIMAGE_LIT *lit;
+    int64_t *words;
+    int opMap[TMIMAGE_NUM_OPS];
+    int loc, i, k, op, dloc;
+
+#define DROPIMAGE() { if (mapped) munmap(map, size); else free(map); }
+    if (size<sizeof(TMIMAGE_HEADER)) {
+        tmSetMessage(m, "ERROR(readImage): file '%s' is not a TM image", fileName);
+        DROPIMAGE();
+        return FALSE;
+    }
+    end = map + size;
+    header = (TMIMAGE_HEADER *)map;
+    code = (TMIMAGE_INSTR *)(header + 1);
+    if (header->version != TMIMAGE_VERSION ||
+        header->instrCount<0 || header->litCount<0 || header->litWords<0 || header->commentBytes<0 ||
+        size != sizeof(TMIMAGE_HEADER) + header->instrCount*sizeof(TMIMAGE_INSTR)
+        + header->litCount*sizeof(TMIMAGE_LIT) + header->litWords*sizeof(int64_t) + header->commentBytes ||
+        (header->commentBytes>0 && end[-1] != '\0')) {
+        tmSetMessage(m, "ERROR(readImage): file '%s' is not a TM image of version %d or is damaged", fileName, TMIMAGE_VERSION);
+        DROPIMAGE();
+        return FALSE;
+    }
+    if (header->instrCount>m->iMemSize || header->entry<0 || header->entry>=m->iMemSize) {
+        tmSetMessage(m, "ERROR(readImage): file '%s' needs %d instruction locations but iMem has %d (see -I)",
+                     fileName, (header->instrCount>header->entry ? header->instrCount : header->entry+1), m->iMemSize);
+        DROPIMAGE();
+        return FALSE;
+    }
+#undef DROPIMAGE
+
+    /* opcodes are stored by name index */
+    for (i = 0; i<TMIMAGE_NUM_OPS; i++) {
+        for (op = 0; op<(int)opEND; op++) if (strcmp(opCodeTab[op], tmImageOpNames[i]) == 0) break;
+        opMap[i] = op;
+    }
+
+    /* clear the way for the new program */
+    fullClearMachine(m);
+    m->imageMap = map;
+    m->imageMapSize = size;
+    m->imageMapped = mapped;
+    m->entryPc = m->reg[PC_REG] = header->entry;
+
+    p = (char *)(code + header->instrCount);
+    for (loc = 0; loc<header->instrCount; loc++) {
+        if (code[loc].op == TMIMAGE_UNUSED) continue;
+        op = (code[loc].op>=0 && code[loc].op<TMIMAGE_NUM_OPS ? opMap[code[loc].op] : opEND);
+        if (op>=(int)opEND ||
+            code[loc].arg1<0 || code[loc].arg1>=NO_REGS ||
+            (opClass(op)==opclRR && (code[loc].arg2<0 || code[loc].arg2>=NO_REGS)) ||
+            code[loc].arg3<0 || code[loc].arg3>=NO_REGS ||
+            code[loc].comment<TMIMAGE_NO_COMMENT || code[loc].comment>=header->commentBytes) {
+            tmSetMessage(m, "ERROR(readImage): bad instruction at address %d in '%s'", loc, fileName);
+            fullClearMachine(m);
+            return FALSE;
+        }
+        m->iMem[loc].iop = op;
+        if (op!=opHALT && op!=opNOP) {
+            m->iMem[loc].iarg1 = code[loc].arg1;
+            m->iMem[loc].iarg2 = code[loc].arg2;
+            m->iMem[loc].iarg3 = code[loc].arg3;
+        }
+        m->iMemCmt[loc] = (code[loc].comment == TMIMAGE_NO_COMMENT ? emptyString
+                           : end - header->commentBytes + code[loc].comment);
+        m->iMemTag[loc] = USED;
+        m->iMemTop = loc + 1;
+    }
+
+    /* LIT data in program order just as the text loader sets it */
+    for (i = 0; i<header->litCount; i++) {
+        lit = (TMIMAGE_LIT *)p;
+        words = (int64_t *)(lit + 1);
+        k = (lit->length == TMIMAGE_LIT_NUMBER ? 1 : lit->length);
+        if (k<0 || (char *)(words + k) > end - header->commentBytes) {
+            tmSetMessage(m, "ERROR(readImage): bad LIT record %d in '%s'", i, fileName);
+            fullClearMachine(m);
+            return FALSE;
+        }
+        dloc = m->dMemSize - 1 - lit->loc;
+        if (lit->length != TMIMAGE_LIT_NUMBER) {
+            for (k=0; k<lit->length; k++) {
+                if (setDMem(m, dloc-k, (char)words[k]) != srOKAY) break;
+                m->dMemTag[dloc-k] = READONLY;
+            }
+            if (k<lit->length || setDMem(m, dloc+1, lit->length) != srOKAY) {
+                fullClearMachine(m);
+                return FALSE;
+            }
+            m->dMemTag[dloc+1] = READONLY;
+            dloc -= lit->length - 1;
+            k = lit->length;
+        }
+        else {
+            if (setDMem(m, dloc, words[0]) != srOKAY) {
+                fullClearMachine(m);
+                return FALSE;
+            }
+            m->dMemTag[dloc] = READONLY;
+        }
+        if (dloc<m->readOnlyLow) m->readOnlyLow = dloc;
+        p = (char *)(words + k);
+    }
+
+    keepLit(m);
+    decodeInstructions(m);
+    return TRUE;
+}
+
+/* scan an ordinary instruction line such as "12:  LD  3,-1(1)  comment"
+   or "7: ADD 3,4,3" without the scanner helpers.  Anything else (no
+   address, LIT, HALT, NOP, sums, char escapes, bad registers or other
+   errors) returns FALSE and the line is scanned again by the general
+   code, so the result is always what the general code would give.
+*/
+#define SKIPBLANKS(p) while (*(p)==' ' || *(p)=='\t') (p)++
+
+static int scanLineFast(TMMachine *m, char *p, int *loc, OPCODE *op, long long int *args, char **comment)
+{
+    long long int value;
+    unsigned int key;
+    int i, sign, opcnt;
+
+    SKIPBLANKS(p);
+    if (!isdigit(*p)) return FALSE;
+    for (value = 0; isdigit(*p); p++) value = value*10 + (*p - '0');
+    if (value<0 || value>=m->iMemSize) return FALSE;
+    *loc = value;
+    SKIPBLANKS(p);
+    if (*p++ != ':') return FALSE;
+
+    /* op code: the word is [A-Za-z0-9=?]* and is looked up by its first 4 chars */
+    SKIPBLANKS(p);
+    key = 0;
+    for (i = 0; isalnum(*p) || *p=='=' || *p=='?'; i++, p++) {
+        if (i<4) key |= (unsigned int)(unsigned char)*p << (8*i);
+    }
+    opcnt = -1;
+    {
+        unsigned int h;
+
+        for (h = OPHASH(key); opHashOp[h]; h = (h+1) & (OPHASH_SIZE-1)) {
+            if (opHashKey[h] == key) {
+                opcnt = opHashOp[h] - 1;
+                break;
+            }
+        }
+    }
+    if (opcnt<0 || opcnt==opHALT || opcnt==opNOP || opClass(opcnt)==opclLIT) return FALSE;
+    *op = (OPCODE)opcnt;
+
+    /* three args: r,s,t or r,d(s) where d may be a plain 'c' */
+    for (i = 0; i<3; i++) {
+        SKIPBLANKS(p);
+        if (i==1 && opClass(opcnt)==opclRA && *p=='\'') {
+            if (p[1]=='\0' || p[1]=='\\' || p[1]=='^' || p[2]!='\'') return FALSE;
+            args[i] = p[1];
+            p += 3;
+        }
+        else {
+            sign = 1;
+            if (*p=='-') {
+                sign = -1;
+                p++;
+            }
+            if (!isdigit(*p)) return FALSE;
+            for (value = 0; isdigit(*p); p++) value = value*10 + (*p - '0');
+            if (*p=='+' || *p=='-') return FALSE;
+            args[i] = sign*value;
+            if ((i!=1 || opClass(opcnt)==opclRR) && (args[i]<0 || args[i]>=NO_REGS)) return FALSE;
+        }
+        if (i<2) {
+            SKIPBLANKS(p);
+            if (i==1 && opClass(opcnt)==opclRA) {
+                if (*p!='(' && *p!=',') return FALSE;
+            }
+            else if (*p!=',') return FALSE;
+            p++;
+        }
+    }
+
+    /* the rest of the line after an optional ) is the comment */
+    SKIPBLANKS(p);
+    if (*p==')') p++;
+    SKIPBLANKS(p);
+    *comment = (*p ? p : emptyString);
+    return TRUE;
+}
+
+
+/* follow the "* Line n:" and "* FUNCTION name" comments that c- writes
+   so the profile can charge each instruction to a source line and
+   function.  p is the text after the '*'. */
+static void sourceComment(TMMachine *m, char *p)
+{
+    char *end;
+
+    SKIPBLANKS(p);
+    if (strncmp(p, "Line ", 5) == 0 && isdigit(p[5])) {
+        m->srcLine = atoi(p + 5);
+        while (*p && *p != ':') p++;
+        if (*p) p++;
+        SKIPBLANKS(p);
+    }
+    if (strncmp(p, "FUNCTION ", 9) == 0) {
+        p += 9;
+        SKIPBLANKS(p);
+        for (end = p + strlen(p); end>p && isspace(end[-1]); end--);
+        if ((m->funcCount & (m->funcCount - 1)) == 0) {
+            m->funcName = (char **)realloc(m->funcName, 2*m->funcCount*sizeof(char *));
+        }
+        m->funcName[m->funcCount] = (char *)malloc(end - p + 1);
+        memcpy(m->funcName[m->funcCount], p, end - p);
+        m->funcName[m->funcCount][end - p] = '\0';
+        m->srcFunc = m->funcCount++;
+    }
+    else if (strncmp(p, "END FUNCTION", 12) == 0) {
+        m->srcFunc = m->srcLine = 0;
+    }
+}
+
+
+#undef SKIPBLANKS
+
+
+/* load .tm text.  buffer holds size chars of it and one more for a
+   terminator and is kept as loadBuffer.  Each line is scanned where it
+   lies, split just as fgets(in_Line, LINESIZE - 2, pgm) would split it,
+   so line numbers, error messages and the handling of overlong lines
+   are the same as reading it a line at a time.  Comments are left in
+   loadBuffer and iMem points at them.
+*/
+static int readText(TMMachine *m, char *buffer, long size)
+{
+    TMSCAN scan, *sc;
+    OPCODE op;
+    long long int arg1, arg2, arg3;
+    int loc, lineNo;
+    char errorString[WORDSIZE + 32];
+    char *next, *end, *eol, *comment;
+    long len;
+    int inPlace;
+    long long int fastArgs[3];
+
+    /* clear the way for the new program */
+    fullClearMachine(m);
+    m->loadBuffer = buffer;
+    sc = &scan;
+    sc->wordset = FALSE;
+
+    /* load program */
+    lineNo = 0;
+    loc = -1;   /* fist location to load is 0 */
+    next = buffer;
+    end = buffer + size;
+    *end = '\0';
+    while (next<end) {
+        /* get line: at most LINESIZE - 3 chars up to and including a
+           newline.  A last line with no newline was never processed. */
+        len = end - next;
+        if (len>LINESIZE - 3) len = LINESIZE - 3;
+        eol = (char *)memchr(next, '\n', len);
+        if (eol) len = eol - next + 1;
+        else if (next + len == end && len<LINESIZE - 3) break;
+
+        if (eol) {
+            /* scan the line in place */
+            *eol = '\0';
+            sc->in_Line = next;
+            inPlace = TRUE;
+        }
+        else {
+            /* a piece of an overlong line */
+            memcpy(m->loadLine, next, len);
+            m->loadLine[len] = '\0';
+            sc->in_Line = m->loadLine;
+            inPlace = FALSE;
+        }
+        next += len;
+
+        /* process line */
+	sc->inCol = 0;
+	lineNo++;
+
+        if (inPlace && scanLineFast(m, sc->in_Line, &loc, &op, fastArgs, &comment)) {
+            m->iMem[loc].iop = op;
+            m->iMem[loc].iarg1 = fastArgs[0];
+            m->iMem[loc].iarg2 = fastArgs[1];
+            m->iMem[loc].iarg3 = fastArgs[2];
+            m->iMemCmt[loc] = comment;
+            m->iMemTag[loc] = USED;
+            m->iMemLine[loc] = m->srcLine;
+            m->iMemFunc[loc] = m->srcFunc;
+            if (loc >= m->iMemTop) m->iMemTop = loc + 1;
+            continue;
+        }
+	sc->lineLen = strlen(sc->in_Line);
+
+        /* process an instruction */
+	if ((nonBlank(sc)) && (sc->in_Line[sc->inCol] != '*')) {
+            /* get address */
+	    if (getNum(sc)) {
+                loc = sc->num;
+
+                /* colon after address */
+                if (!skipCh(sc, ':')) {
+                    return error(m, "Missing colon", lineNo, loc);
+                }
+            }
+            else {   /* if no address given then just increment counter */
+                loc++;
+            }
+	    if (loc<0 || loc>=m->iMemSize) {
+                tmSetMessage(m, "ERROR(readInstructions): at line %d attempting to set out of bounds instruction memory at loc: %d", lineNo, loc);
+                return FALSE;
+            }
+
+            /* get op code */
+	    if (!getWord(sc))
+		return error(m, "Missing opcode", lineNo, loc);
+
+            { int opcnt;
+
+                opcnt = lookupOp(sc->word);
+                if (opcnt<0) {
+                    sprintf(errorString, "Illegal opcode: %s", sc->word);
+                    return error(m, errorString, lineNo, loc);
+                }
+		op = (OPCODE)opcnt;
+            }
+
+            /* process args to op code */
+            arg1 = arg2 = arg3 = 0;
+            if (op==opHALT || op==opNOP) {
+                uptoComment(sc);
+            }
+            else {
+                switch (opClass(op)) {
+                case opclRR:
+                    /***********************************/
+                    /* arg 1 */
+                    if ((!getNum(sc)) || (sc->num<0) || (sc->num >= NO_REGS))
+                        return error(m, "Bad first register", lineNo, loc);
+                    arg1 = sc->num;
+                    if (!skipCh(sc, ','))
+                        return error(m, "Missing comma", lineNo, loc);
+
+                    /* arg 2 */
+                    if ((!getNum(sc)) || (sc->num<0) || (sc->num >= NO_REGS))
+                        return error(m, "Bad second register", lineNo, loc);
+                    arg2 = sc->num;
+                    if (!skipCh(sc, ','))
+                        return error(m, "Missing comma", lineNo, loc);
+
+                    /* arg 3 */
+                    if ((!getNum(sc)) || (sc->num<0) || (sc->num >= NO_REGS))
+                        return error(m, "Bad third register", lineNo, loc);
+                    arg3 = sc->num;
+                    break;
+
+                case opclRA:
+                    /***********************************/
+                    /* arg 1 */
+                    if (!getNum(sc) || ((sc->num<0) || (sc->num >= NO_REGS)))
+                        return error(m, "Bad first register", lineNo, loc);
+                    arg1 = sc->num;
+                    if (!skipCh(sc, ','))
+                        return error(m, "Missing comma", lineNo, loc);
+
+                    /* arg 2 */
+                    if (!getNumOrChar(sc))
+                        return error(m, "Bad displacement", lineNo, loc);
+                    arg2 = sc->num;
+                    if (!skipCh(sc, '(') && !skipCh(sc, ',')) {
+                        if (op==opLDC) {
+                            break;
+                        }
+                        return error(m, "Missing left paren", lineNo, loc);
+                    }
+
+                    /* arg 3 */
+                    if ((!getNum(sc)) || (sc->num<0) || (sc->num >= NO_REGS))
+                        return error(m, "Bad second register", lineNo, loc);
+                    arg3 = sc->num;
+                    break;
+                case opclLIT:
+                    nonBlank(sc);
+                    (sc->wordset = getString(sc)) || getNum(sc) || getChar(sc);
+                    break;
+                }
+
+            }
+
+            // set data memory with LIT instruction.
+            // location is at loc offset from *top* of memory!
+            if (op==opLIT) {
+                int dloc;
+
+                dloc = m->dMemSize - 1 - loc;
+                if (sc->wordset) {
+                    int len, k;
+
+                    len = strlen(sc->word);
+                    for (k=0; k<len; k++) {
+                        if (setDMem(m, dloc-k, sc->word[k]) != srOKAY) return FALSE;
+                        m->dMemTag[dloc-k] = READONLY;
+                    }
+                    if (setDMem(m, dloc+1, len) != srOKAY) return FALSE;
+                    m->dMemTag[dloc+1] = READONLY;
+                    dloc -= len - 1;
+                }
+                else {
+                    if (setDMem(m, dloc, sc->num) != srOKAY) return FALSE;
+                    m->dMemTag[dloc] = READONLY;
+                }
+                if (dloc<m->readOnlyLow) m->readOnlyLow = dloc;
+            }
+            // set instruction memory
+            else {
+                m->iMem[loc].iop = op;
+                m->iMem[loc].iarg1 = arg1;
+                m->iMem[loc].iarg2 = arg2;
+                m->iMem[loc].iarg3 = arg3;
+                skipCh(sc, ')');
+                if (!nonBlank(sc)) m->iMemCmt[loc] = emptyString;
+                else if (inPlace) m->iMemCmt[loc] = &sc->in_Line[sc->inCol];
+                else m->iMemCmt[loc] = strdup(&sc->in_Line[sc->inCol]);
+                m->iMemTag[loc] = USED;     /* correctly counts assignments to same loc  */
+                m->iMemLine[loc] = m->srcLine;
+                m->iMemFunc[loc] = m->srcFunc;
+                if (loc >= m->iMemTop) m->iMemTop = loc + 1;
+                m->fastCodeStale = TRUE;
+            }
+	}
+        else if (sc->in_Line[sc->inCol] == '*') sourceComment(m, &sc->in_Line[sc->inCol+1]);
+    }
+
+    /* keep the LIT data for a rerun, decode for the fast engine and fuse
+       superinstructions */
+    keepLit(m);
+    decodeInstructions(m);
+
+    return TRUE;
+}				/* readText */
+
+
+/* load a .tm file or a .tmb image.  The whole file is read at once and
+   an image is mapped rather than read. */
+int tmLoadFile(TMMachine *m, const char *fileName)
+{
+    FILE *pgm;
+    char *buffer, *map;
+    char magic[4];
+    long size;
+    int fd, image;
+
+    if (! ownProgram(m)) return FALSE;
+    snprintf(m->pgmName, WORDSIZE, "%s", fileName);
+    pgm = fopen(fileName, "r");
+    if (pgm == NULL) {
+	tmSetMessage(m, "ERROR(readInstructions): file '%s' not found", fileName);
+	return FALSE;
+    }
+    image = (fread(magic, 1, 4, pgm) == 4 && memcmp(magic, TMIMAGE_MAGIC, 4) == 0);
+    size = -1;
+    if (fseek(pgm, 0, SEEK_END) == 0) size = ftell(pgm);
+
+    /* a binary image from c- -B is mapped, not read */
+    if (image) {
+        fclose(pgm);
+        fd = open(fileName, O_RDONLY);
+        map = (fd<0 || size<0 ? (char *)MAP_FAILED : (char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0));
+        if (fd >= 0) close(fd);
+        if (map == MAP_FAILED) {
+            tmSetMessage(m, "ERROR(readImage): unable to map file '%s'", fileName);
+            return FALSE;
+        }
+        return readImage(m, fileName, map, size, TRUE);
+    }
+
+    /* read the whole text */
+    buffer = NULL;
+    if (size >= 0) {
+        rewind(pgm);
+        buffer = (char *)malloc(size + 1);
+        if (buffer && (long)fread(buffer, 1, size, pgm) != size) size = -1;
+    }
+    fclose(pgm);
+    if (buffer == NULL || size<0) {
+        tmSetMessage(m, "ERROR(readInstructions): unable to read file '%s'", fileName);
+        free(buffer);
+        return FALSE;
+    }
+    return readText(m, buffer, size);
+}
+
+
+/* load .tm text or a .tmb image held in memory.  It is copied. */
+int tmLoadBuffer(TMMachine *m, const char *name, const char *data, long size)
+{
+    char *buffer;
+
+    if (! ownProgram(m)) return FALSE;
+    snprintf(m->pgmName, WORDSIZE, "%s", (name ? name : ""));
+    buffer = (char *)malloc(size + 1);
+    if (buffer == NULL) {
+        tmSetMessage(m, "ERROR(readInstructions): no memory for '%s'", m->pgmName);
+        return FALSE;
+    }
+    memcpy(buffer, data, size);
+    if (size >= 4 && memcmp(buffer, TMIMAGE_MAGIC, 4) == 0) return readImage(m, m->pgmName, buffer, size, FALSE);
+    return readText(m, buffer, size);
+}
+
+
+
+
+
+/********************************************/
+/* program output.  It goes to the write callback or the output file.
+   The flush callback (or fflush) is only called where the output mode
+   asks for it, before input and at HALT. */
+
+static void writeText(TMMachine *m, const char *text, int length)
+{
+    if (m->io.write) m->io.write(m, m->io.context, text, length);
+    else if (length == 1) putc(*text, m->outputFile);
+    else fwrite(text, 1, length, m->outputFile);
+}
+
+static void flushOutput(TMMachine *m)
+{
+    if (m->io.flush) m->io.flush(m, m->io.context);
+    else fflush(m->outputFile);
+}
+
+static int outputLimitFail(TMMachine *m)
+{
+    m->outputInstrCount++;
+    if (m->outputInstrCount>m->outputLimit && m->outputLimit!=0) return 1;
+    return 0;
+}
+
+
+/* called after each output instruction */
+static void outputDone(TMMachine *m, int newline)
+{
+    if (m->outputMode==omUNBUFFERED || (m->outputMode==omLINE && newline)) flushOutput(m);
+}
+
+
+/* streaming input, the default input callback.  The input instructions
+   read straight from the buffered input file.  Values are separated by
+   white space and a line may hold several.  A # right after a value
+   halts TM as it does for typed input, and the end of line after an IN
+   or INB value is eaten so a following INC starts on the next line just
+   as it does with typed input.
+*/
+#define INGETC() getc_unlocked(in)
+
+static TMINPUTSTATUS inputFail(TMMachine *m, const char *msg)
+{
+    FILE *in;
+    char text[40];
+    int c, i;
+
+    in = m->inputFile;
+    flushOutput(m);
+    i = 0;
+    while (i<(int)sizeof(text)-1 && (c = INGETC())!=EOF && c!='\n') text[i++] = c;
+    text[i] = '\0';
+    if (i==0 && c==EOF) tmSetMessage(m, "ERROR(%s): instruction at addr %d found end of input in %s",
+                                     opCodeTab[m->iMem[m->pc].iop], m->pc, m->inputName);
+    else tmSetMessage(m, "%s in %s: \"%s\"", msg, m->inputName, text);
+    return tmINPUT_ERROR;
+}
+
+/* after an IN or INB value: skip blanks, look for #, eat the end of line */
+static int inputValueEnd(FILE *in)
+{
+    int c, halt;
+
+    while ((c = INGETC())==' ' || c=='\t');
+    halt = (c=='#');
+    if (halt) while ((c = INGETC())==' ' || c=='\t');
+    if (c=='\r') c = INGETC();
+    if (c!='\n' && c!=EOF) ungetc(c, in);
+    return halt;
+}
+
+static TMINPUTSTATUS streamInput(TMMachine *m, void *context, TMINPUTKIND kind, long long int *result)
+{
+    FILE *in;
+    int c, sign, ok, n;
+    long long int term, value;
+    char text[40];
+
+    (void)context;
+    in = m->inputFile;
+    if (in == NULL) {
+        tmSetMessage(m, "ERROR(%s): instruction at addr %d has no input", opCodeTab[m->iMem[m->pc].iop], m->pc);
+        return tmINPUT_ERROR;
+    }
+    if (kind == tmINPUT_CHAR) {
+        if ((c = INGETC())==EOF) return inputFail(m, "");
+        *result = (char)c;
+        return tmINPUT_OK;
+    }
+
+    while (isspace(c = INGETC()));
+    if (c==EOF) return inputFail(m, "");
+
+    value = 0;
+    if (kind == tmINPUT_BOOL) {
+        value = !(c=='F' || c=='f' || c=='0');
+        while (isalnum(c) || c=='=' || c=='?') c = INGETC();
+    }
+    else {
+        /* the same sums of signed terms as getNum() */
+        ok = FALSE;
+        do {
+            sign = 1;
+            while ((c == '+') || (c == '-')) {
+                ok = FALSE;
+                if (c == '-') sign = -sign;
+                c = INGETC();
+            }
+            term = 0;
+            while (isdigit(c)) {
+                ok = TRUE;
+                term = term*10 + (c - '0');
+                c = INGETC();
+            }
+            value = value + (term*sign);
+        }
+        while ((c == '+') || (c == '-'));
+        if (!ok) {
+            if (c!=EOF) ungetc(c, in);
+            return inputFail(m, "Illegal value in input");
+        }
+    }
+    if (c!=EOF) ungetc(c, in);
+
+    *result = value;
+    if (m->inputEcho) {
+        if (kind == tmINPUT_BOOL) n = snprintf(text, sizeof(text), "entered: %c\n", (value ? 'T' : 'F'));
+        else n = snprintf(text, sizeof(text), "entered: %lld\n", value);
+        writeText(m, text, n);
+    }
+    return (inputValueEnd(in) ? tmINPUT_HALT : tmINPUT_OK);
+}
+
+#undef INGETC
+
+
+/* an input instruction: reg[r] gets the next value */
+static STEPRESULT readInput(TMMachine *m, TMINPUTKIND kind, int r)
+{
+    TMINPUTSTATUS status;
+    long long int value;
+
+    if (m->io.input) status = m->io.input(m, m->io.context, kind, &value);
+    else status = streamInput(m, NULL, kind, &value);
+    if (status == tmINPUT_ERROR) return srINPUT_ERR;
+    m->reg[r] = value;
+    if (status == tmINPUT_HALT) {
+        flushOutput(m);
+        return srHALT;
+    }
+    return srOKAY;
+}
+
+
+/* block kernels for MOV, SET, CO and COA.  These instructions walk
+   n words downward from the given top address.  When the whole block
+   is in bounds (and for writes contains no read only location) it is
+   done with one check and straight array code, otherwise the caller
+   falls back to the word at a time loop so the error raised is the
+   same one at the same location.
+*/
+#define COMPARE_CHUNK 64
+
+/* is dMem[hi-n+1 .. hi] in bounds? (n>0) */
+static int dRangeOk(TMMachine *m, int hi, long long int n)
+{
+    return n>0 && hi<m->dMemSize && hi-n+1>=0;
+}
+
+/* is dMem[hi-n+1 .. hi] in bounds and free of read only locations? */
+static int dRangeWritable(TMMachine *m, int hi, long long int n)
+{
+    int a;
+
+    if (! dRangeOk(m, hi, n)) return FALSE;
+    if (hi<m->readOnlyLow) return TRUE;
+    for (a = hi-n+1; a<=hi; a++) if (m->dMemTag[a]==READONLY) return FALSE;
+    return TRUE;
+}
+
+/* record the current instruction as the setter of dMem[lo .. lo+n-1] */
+static void tagDRange(TMMachine *m, int lo, int n)
+{
+    int a;
+
+    if (! m->tagflag) return;
+    for (a = lo; a<lo+n; a++) m->dMemTag[a] = m->pc + 1;
+}
+
+/* copy n words down from dMem[saddr] to dMem[raddr] exactly as the word
+   at a time loop does.  If the destination is below the source and they
+   overlap, the loop rereads words it has already written and so repeats
+   the top raddr-saddr words; that is kept as a simple downward loop. */
+static void moveDBlock(TMMachine *m, int raddr, int saddr, int n)
+{
+    long long int *dMem = m->dMem;
+    int i;
+
+    if (raddr>=saddr || saddr-raddr>=n) {
+        memmove(&dMem[raddr-n+1], &dMem[saddr-n+1], (size_t)n*sizeof(long long int));
+    }
+    else {
+        for (i = 0; i<n; i++) dMem[raddr-i] = dMem[saddr-i];
+    }
+}
+
+/* how many words from the top down are equal in dMem[raddr ...] and
+   dMem[saddr ...].  Returns n if all n are equal. */
+static int equalDBlock(TMMachine *m, int raddr, int saddr, int n)
+{
+    long long int *dMem = m->dMem;
+    int i, len;
+
+    i = 0;
+    while (i<n) {
+        len = (n-i<COMPARE_CHUNK ? n-i : COMPARE_CHUNK);
+        if (memcmp(&dMem[raddr-i-len+1], &dMem[saddr-i-len+1], (size_t)len*sizeof(long long int)) != 0) break;
+        i += len;
+    }
+    while (i<n && dMem[raddr-i]==dMem[saddr-i]) i++;
+    return i;
+}
+
+
+/* reg[FP_REG] has changed from fp.  Lowering it pushes a frame and
+   raising it pops one, except that the first value it gets is the
+   bottom frame. */
+static void frameMoved(TMMachine *m, long long int fp)
+{
+    RUNSTATS *st = &m->stats;
+    long long int now = m->reg[FP_REG];
+
+    if (! st->frames) {
+        st->frames = TRUE;
+        st->fpFirst = st->fpLow = now;
+        st->callDepth = st->callPeak = 1;
+    }
+    else if (now<fp) {
+        if (++st->callDepth>st->callPeak) st->callPeak = st->callDepth;
+        if (now<st->fpLow) st->fpLow = now;
+    }
+    else if (st->callDepth>1) st->callDepth--;
+}
+
+
+/* execute a single instruction.  pc, lastpc and reg[PC_REG] must
+   already be set up for the instruction as stepTM() does.
+*/
+static STEPRESULT doInstruction(TMMachine *m, INSTRUCTION *currentinstruction)
+{
+    long long int *reg = m->reg;
+    long long int r, s, t, d, addr, value, value2;
+    STEPRESULT result;
+    char text[32];
+
+    /* get the args to the instruction */
+    if (opClass(currentinstruction->iop) == opclRR) {
+        r = currentinstruction->iarg1;
+        s = currentinstruction->iarg2;
+        t = currentinstruction->iarg3;
+    }
+    else {  /* note s changes its position */
+	r = currentinstruction->iarg1;
+        d = currentinstruction->iarg2;
+	s = currentinstruction->iarg3;
+	addr = currentinstruction->iarg2 + reg[s];
+    }
+
+    switch (currentinstruction->iop) {
+	/* RR instructions */
+    case opHALT:
+        /***********************************/
+        flushOutput(m);
+	return srHALT;
+	/* break; */
+
+    case opNOP:
+        break;
+
+    case opIN:
+        /***********************************/
+        return readInput(m, tmINPUT_INT, r);
+
+    case opINB:
+        /***********************************/
+        return readInput(m, tmINPUT_BOOL, r);
+
+    case opINC:
+        /***********************************/
+        return readInput(m, tmINPUT_CHAR, r);
+
+    case opOUT:
+        if (outputLimitFail(m)) return srOUTPUTLIMIT_ERR;
+	writeText(m, text, snprintf(text, sizeof(text), "%lld ", reg[r]));
+        outputDone(m, FALSE);
+	break;
+
+    case opOUTB:
+        if (outputLimitFail(m)) return srOUTPUTLIMIT_ERR;
+	writeText(m, (reg[r] ? "T " : "F "), 2);
+        outputDone(m, FALSE);
+	break;
+
+    case opOUTC:
+        if (outputLimitFail(m)) return srOUTPUTLIMIT_ERR;
+        text[0] = (char)reg[r];
+	writeText(m, text, 1);
+        outputDone(m, text[0]=='\n');
+	break;
+
+    case opOUTNL:
+        if (outputLimitFail(m)) return srOUTPUTLIMIT_ERR;
+	writeText(m, "\n", 1);
+        outputDone(m, TRUE);
+	break;
+
+    case opADD:
+	reg[r] = reg[s] + reg[t];
+	break;
+
+    case opSUB:
+	reg[r] = reg[s] - reg[t];
+	break;
+
+    case opMUL:
+	reg[r] = reg[s]*reg[t];
+	break;
+
+    case opDIV:
+	if (reg[t] != 0)
+	    reg[r] = reg[s]/reg[t];
+	else
+	    return srZERODIVIDE;
+	break;
+
+    case opMOD:
+	if (reg[t] != 0) {
+            long long int tmp;  // r may equal t
+
+	    tmp = reg[s]%reg[t];
+            if (tmp<0) tmp += llabs(reg[t]);  // always return a nonnegative answer
+	    reg[r] = tmp;
+        }
+	else
+	    return srZERODIVIDE;
+	break;
+
+    case opAND:
+	reg[r] = reg[s]&reg[t];
+	break;
+
+    case opOR:
+	reg[r] = reg[s]|reg[t];
+	break;
+
+    case opXOR:
+	reg[r] = reg[s]^reg[t];
+	break;
+
+    case opNOT:
+	reg[r] = ~reg[s];
+	break;
+
+    case opNEG:
+	reg[r] = -reg[s];
+	break;
+
+    case opSWP:
+        if (reg[r]>reg[s]) {
+            long long int tmp;
+            tmp = reg[r];
+            reg[r] = reg[s];
+            reg[s] = tmp;
+        }
+	break;
+
+    case opRND:
+	if (reg[s] != 0)
+            reg[r] = nextRandom(m)%llabs(reg[s]);
+	else
+	    return srZERODIVIDE;
+	break;
+
+    case opMOV: {
+        int raddr, saddr;
+        int i;
+
+        raddr = reg[r];
+        saddr = reg[s];
+        if (dRangeOk(m, saddr, reg[t]) && dRangeWritable(m, raddr, reg[t])) {
+            moveDBlock(m, raddr, saddr, reg[t]);
+            dirtyDMem(m, raddr-reg[t]+1, raddr);
+            tagDRange(m, raddr-reg[t]+1, reg[t]);
+            m->stats.movWords += reg[t];
+            break;
+        }
+        for (i=0; i<reg[t]; i++) {
+            if ((result = getDMem(m, saddr, &value)) != srOKAY) return result;
+            if ((result = setDMem(m, raddr, value)) != srOKAY) return result;
+            m->stats.movWords++;
+            raddr--;
+            saddr--;
+        }
+    }
+        break;
+
+    case opSET: {
+        int raddr, svalue;
+        int i;
+
+        raddr = reg[r];
+        svalue = reg[s];
+        if (dRangeWritable(m, raddr, reg[t])) {
+            for (i=raddr-reg[t]+1; i<=raddr; i++) m->dMem[i] = svalue;
+            dirtyDMem(m, raddr-reg[t]+1, raddr);
+            tagDRange(m, raddr-reg[t]+1, reg[t]);
+            m->stats.setWords += reg[t];
+            break;
+        }
+        for (i=0; i<reg[t]; i++) {
+            if ((result = setDMem(m, raddr, svalue)) != srOKAY) return result;
+            m->stats.setWords++;
+            raddr--;
+        }
+    }
+        break;
+
+
+    // find the first place that is different put the differing mem
+    // values in r and s.   Memory is checked from high address
+    // to low!  If the length of the comparison (stored in reg[t]) is
+    // zero then r and s will be set to 0.
+    case opCO: {
+        int raddr, saddr;
+	int i;
+
+        raddr = reg[r];
+        saddr = reg[s];
+        if (reg[t]==0) {
+            reg[r] = reg[s] = 0;
+        }
+        else if (r!=s && t!=r && t!=s && dRangeOk(m, raddr, reg[t]) && dRangeOk(m, saddr, reg[t])) {
+            i = equalDBlock(m, raddr, saddr, reg[t]);
+            if (i==reg[t]) i--;
+            reg[r] = m->dMem[raddr-i];
+            reg[s] = m->dMem[saddr-i];
+            m->stats.coWords += i + 1;
+        }
+        else {
+            for (i=0; i<reg[t]; i++) {
+                if ((result = getDMem(m, raddr, &reg[r])) != srOKAY) return result;
+                if ((result = getDMem(m, saddr, &reg[s])) != srOKAY) return result;
+                m->stats.coWords++;
+                if (reg[r] != reg[s]) break;
+                raddr--;
+                saddr--;
+            }
+        }
+    }
+    break;
+
+    // find the addresses of the first place that is different put the addresses of
+    // the differing mem values in r5 and r6
+    case opCOA: {
+        int raddr, saddr;
+	int i;
+
+        raddr = reg[r];
+        saddr = reg[s];
+        if (r!=s && t!=r && t!=s && dRangeOk(m, raddr, reg[t]) && dRangeOk(m, saddr, reg[t])) {
+            i = equalDBlock(m, raddr, saddr, reg[t]);
+            if (i==reg[t]) i--;
+            reg[r] = raddr-i;
+            reg[s] = saddr-i;
+            m->stats.coWords += i + 1;
+            break;
+        }
+        for (i=0; i<reg[t]; i++) {
+            reg[r] = raddr;
+            reg[s] = saddr;
+            if ((result = getDMem(m, raddr, &value)) != srOKAY) return result;
+            if ((result = getDMem(m, saddr, &value2)) != srOKAY) return result;
+            m->stats.coWords++;
+            if (value != value2) break;
+            raddr--;
+            saddr--;
+        }
+    }
+        break;
+
+        /*************** RA instructions ********************/
+    case opLD:
+	return getDMem(m, addr, &reg[r]);
+    case opST:
+        return setDMem(m, addr, reg[r]);
+    case opLDA:
+	reg[r] = addr;
+	break;
+    case opLDC:
+	reg[r] = d;
+	break;
+    case opTLT:
+        reg[r] = (reg[s]<reg[t] ? 1 : 0);
+	break;
+    case opSLT:
+        if (reg[r]>=0) reg[r] = (reg[s]<reg[t] ? 1 : 0);
+        else reg[r] = (reg[t]<reg[s] ? 1 : 0);
+	break;
+    case opTGT:
+        reg[r] = (reg[s]>reg[t] ? 1 : 0);
+	break;
+    case opSGT:
+        if (reg[r]>=0) reg[r] = (reg[s]>reg[t] ? 1 : 0);
+        else reg[r] = (reg[t]>reg[s] ? 1 : 0);
+	break;
+    case opTLE:
+        reg[r] = (reg[s]<=reg[t] ? 1 : 0);
+	break;
+    case opTGE:
+        reg[r] = (reg[s]>=reg[t] ? 1 : 0);
+	break;
+    case opTEQ:
+        reg[r] = (reg[s]==reg[t] ? 1 : 0);
+	break;
+    case opTNE:
+        reg[r] = (reg[s]!=reg[t] ? 1 : 0);
+	break;
+    case opJZR:
+	if (reg[r] == 0)
+	    reg[PC_REG] = addr;
+	break;
+    case opJNZ:
+	if (reg[r] != 0)
+	    reg[PC_REG] = addr;
+	break;
+    case opJMP:
+        reg[PC_REG] = addr;
+	break;
+
+	/* end of legal instructions */
+    }				/* case */
+    return srOKAY;
+}				/* doInstruction */
+
+
+/* doInstruction() watching the frame pointer */
+static STEPRESULT executeInstruction(TMMachine *m, INSTRUCTION *currentinstruction)
+{
+    long long int fp;
+    STEPRESULT result;
+
+    fp = m->reg[FP_REG];
+    result = doInstruction(m, currentinstruction);
+    if (m->reg[FP_REG] != fp) frameMoved(m, fp);
+    return result;
+}
+
+
+
+
+/********************************************/
+/* the binary trace (see tmTrace.h) */
+
+/* map the trace file with room for slots records */
+static int mapTrace(TMMachine *m, long long int slots)
+{
+    size_t size;
+    void *map;
+
+    size = sizeof(TMTRACE_HEADER) + slots*sizeof(TMTRACE_RECORD);
+    if (ftruncate(m->traceFd, size) != 0) return FALSE;
+    if (m->trace) map = mremap(m->trace, m->traceMapSize, size, MREMAP_MAYMOVE);
+    else map = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, m->traceFd, 0);
+    if (map == MAP_FAILED) return FALSE;
+    m->trace = (TMTRACE_HEADER *)map;
+    m->traceRecords = (TMTRACE_RECORD *)(m->trace + 1);
+    m->traceMapSize = size;
+    m->traceSlots = slots;
+    return TRUE;
+}
+
+
+/* the slot for the next record.  A full ring drops its oldest record
+   into the registers of the header.  NULL if a growing file could not
+   grow: the trace is ended there. */
+static TMTRACE_RECORD *traceRecord(TMMachine *m)
+{
+    TMTRACE_RECORD *rec;
+
+    if (m->traceNext == m->traceSlots) {
+        if (m->trace->ring) {
+            m->traceNext = 0;
+            m->traceWrapped = TRUE;
+        }
+        else if (! mapTrace(m, m->traceSlots + TMTRACE_GROW)) {
+            tmTraceFile(m, NULL, 0);
+            tmSetMessage(m, "ERROR: the trace file could not grow: tracing stopped");
+            return NULL;
+        }
+    }
+    rec = &m->traceRecords[m->traceNext++];
+    if (m->traceWrapped) tmTraceApply(m->trace->regs, rec);
+    m->trace->records++;
+    return rec;
+}
+
+
+/* registers changed since the last record other than by an instruction
+   (tmSetReg(), a clear or a restore) go in TMTRACE_SYNC records */
+static void traceSync(TMMachine *m)
+{
+    TMTRACE_RECORD *rec;
+    long long int diff;
+    int r;
+
+    /* almost always none: check them all at once */
+    diff = 0;
+    for (r = 0; r<PC_REG; r++) diff |= m->reg[r] ^ m->traceRegs[r];
+    if (diff == 0) return;
+
+    rec = NULL;
+    for (r = 0; r<PC_REG; r++) {
+        if (m->reg[r] == m->traceRegs[r]) continue;
+        if (rec && rec->reg2 == TMTRACE_NOREG) {
+            rec->reg2 = r;
+            rec->other = m->reg[r];
+        }
+        else {
+            if ((rec = traceRecord(m)) == NULL) return;
+            rec->pc = TMTRACE_SYNC;
+            rec->next = m->reg[PC_REG];
+            rec->addr = TMTRACE_NOADDR;
+            rec->op = rec->result = 0;
+            rec->reg = r;
+            rec->value = m->reg[r];
+            rec->reg2 = TMTRACE_NOREG;
+            rec->other = 0;
+        }
+        m->traceRegs[r] = m->reg[r];
+    }
+}
+
+
+/* the record of the instruction at pc, which ran with result.  The
+   registers it changed are the ones its op code writes, not found by
+   comparing them all.  It is made in t and copied out whole: stores
+   through rec could alias anything. */
+static void traceStep(TMMachine *m, int pc, STEPRESULT result)
+{
+    INSTRUCTION *in;
+    TMTRACE_RECORD t, *rec;
+    long long int addr;
+    int r, s;
+
+    in = &m->iMem[pc];
+    r = s = TMTRACE_NOREG;
+    switch (in->iop) {
+    case opHALT: case opNOP: case opOUT: case opOUTB: case opOUTC: case opOUTNL:
+    case opMOV: case opSET: case opST: case opJZR: case opJNZ: case opJMP:
+        break;
+    case opSWP: case opCO: case opCOA:
+        s = in->iarg2;
+        r = in->iarg1;
+        break;
+    default:
+        r = in->iarg1;
+        break;
+    }
+    if (r == PC_REG) r = TMTRACE_NOREG;
+    if (s == PC_REG || s == r) s = TMTRACE_NOREG;
+
+    t.pc = pc;
+    t.next = m->reg[PC_REG];
+    t.addr = TMTRACE_NOADDR;
+    t.op = imageOp[in->iop];
+    t.reg = r;
+    t.reg2 = s;
+    t.result = result;
+    t.value = t.other = 0;
+    if (r != TMTRACE_NOREG) t.value = m->traceRegs[r] = m->reg[r];
+    if (s != TMTRACE_NOREG) t.other = m->traceRegs[s] = m->reg[s];
+    if (in->iop>opRRLim) {
+        addr = in->iarg2 + m->reg[in->iarg3];
+        if (addr>=0 && addr<m->dMemSize) {
+            t.addr = addr;
+            t.other = m->dMem[addr];
+        }
+    }
+
+    if ((rec = traceRecord(m)) != NULL) *rec = t;
+}
+
+
+int tmTraceFile(TMMachine *m, const char *fileName, long long int ring)
+{
+    size_t size, length;
+    int cut;
+
+    /* end the trace there is.  A growing file is cut to the records
+       written; if it can't be the header still says how many. */
+    cut = TRUE;
+    if (m->trace) {
+        size = sizeof(TMTRACE_HEADER) + m->trace->records*sizeof(TMTRACE_RECORD);
+        if (! m->trace->ring) cut = (ftruncate(m->traceFd, size) == 0);
+        munmap(m->trace, m->traceMapSize);
+        close(m->traceFd);
+        m->trace = NULL;
+        if (! cut) tmSetMessage(m, "ERROR: unable to cut the trace file to its records");
+    }
+    if (fileName == NULL) return cut;
+
+    if (ring<0) {
+        tmSetMessage(m, "ERROR: a trace ring must be 0 or more records");
+        return FALSE;
+    }
+    m->traceFd = open(fileName, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (m->traceFd<0) {
+        tmSetMessage(m, "ERROR: unable to write trace file: %s", fileName);
+        return FALSE;
+    }
+    if (! mapTrace(m, (ring ? ring : TMTRACE_GROW))) {
+        close(m->traceFd);
+        tmSetMessage(m, "ERROR: unable to map %lld trace records in %s",
+                     (ring ? ring : TMTRACE_GROW), fileName);
+        return FALSE;
+    }
+    memcpy(m->trace->magic, TMTRACE_MAGIC, 4);
+    m->trace->version = TMTRACE_VERSION;
+    m->trace->recordSize = sizeof(TMTRACE_RECORD);
+    m->trace->dMemSize = m->dMemSize;
+    m->trace->ring = ring;
+    m->trace->records = 0;
+    m->traceNext = 0;
+    m->traceWrapped = FALSE;
+    memcpy(m->trace->regs, m->reg, sizeof(m->trace->regs));
+    length = strlen(m->pgmName);
+    memcpy(m->trace->program, m->pgmName, (length<TMTRACE_NAME ? length : TMTRACE_NAME - 1));
+    memcpy(m->traceRegs, m->reg, sizeof(m->traceRegs));
+    return TRUE;
+}
+
+
+long long int tmTraceRecords(TMMachine *m)
+{
+    return (m->trace ? m->trace->records : 0);
+}
+
+
+
+/********************************************/
+/* coverage.  stepTM() and the paths of runTM() that go one instruction
+   at a time mark each address as it runs.  The blocks of runTM() are
+   translated with an fxBLOCKC header while coverage is on, which marks
+   the whole block the first time it is entered and turns itself into
+   the plain header, so a block costs nothing after that.  Its first
+   run can stop early (a fault, a trap or an input that halts), so the
+   addresses it marks that were not marked before are COVER_FRESH until
+   the run is over or another new block is entered, and coverStop()
+   takes back those after the stop.
+*/
+
+/* the new block fresh has been run to its end: its marks stand */
+static void coverSettle(TMMachine *m)
+{
+    MICROOP *blk;
+    int loc;
+
+    blk = &m->blockCode[m->coverFresh];
+    for (loc = blk->loc; loc<blk->loc + blk->d; loc++) {
+        if (m->coverMap[loc] == COVER_FRESH) m->coverMap[loc] = COVERED;
+    }
+    m->coverFresh = -1;
+}
+
+
+static int blockHeader(TMMachine *m, int jit);
+
+/* the block with header blk is entered for the first time */
+static void coverBlock(TMMachine *m, MICROOP *blk)
+{
+    int loc;
+
+    if (m->coverFresh >= 0) coverSettle(m);
+    for (loc = blk->loc; loc<blk->loc + blk->d; loc++) {
+        if (m->coverMap[loc] == 0) m->coverMap[loc] = COVER_FRESH;
+    }
+    m->coverFresh = blk - m->blockCode;
+    blk->op = blockHeader(m, TRUE);
+}
+
+
+/* the run stopped in the block with header blk before loc.  If it was
+   the block's first run the addresses from loc on did not run. */
+static void coverStop(TMMachine *m, MICROOP *blk, int loc)
+{
+    if (m->coverFresh != blk - m->blockCode) return;
+    for (; loc<blk->loc + blk->d; loc++) {
+        if (m->coverMap[loc] == COVER_FRESH) m->coverMap[loc] = 0;
+    }
+    coverSettle(m);
+}
+
+
+int tmSetCoverage(TMMachine *m, int on)
+{
+    if (on && m->coverMap == NULL) {
+        m->coverMap = (char *)newMemory(m->iMemSize, sizeof(char));
+        if (m->coverMap == NULL) {
+            tmSetMessage(m, "ERROR: unable to map memory for coverage");
+            return FALSE;
+        }
+    }
+    else if (! on && m->coverMap) {
+        freeMemory(m->coverMap, m->iMemSize, sizeof(char));
+        m->coverMap = NULL;
+    }
+    else return TRUE;
+    m->coverFresh = -1;
+    dropBlocks(m);
+    return TRUE;
+}
+
+
+int tmAddCoverage(TMMachine *m, TMMachine *from)
+{
+    int loc;
+
+    if (m->iMem != from->iMem || m->coverMap == NULL) return FALSE;
+    if (from->coverMap == NULL) return TRUE;
+    for (loc = 0; loc<m->iMemTop; loc++) {
+        if (from->coverMap[loc]) m->coverMap[loc] = COVERED;
+    }
+    return TRUE;
+}
+
+
+/* the source lines and functions of the loaded code: for each one -1
+   if no instruction is charged to it, otherwise 1 if one of them has
+   run and 0 if none has.  lineHit has maxLine + 1 entries, funcHit and
+   funcLine (the first line of each function) funcCount.  The caller
+   frees them. */
+static void coverSource(TMMachine *m, int *maxLine, signed char **lineHit,
+                        signed char **funcHit, int **funcLine)
+{
+    int loc, line, f, hit;
+
+    *maxLine = 0;
+    for (loc = 0; loc<m->iMemTop; loc++) {
+        if (m->iMemLine[loc]>*maxLine) *maxLine = m->iMemLine[loc];
+    }
+    *lineHit = (signed char *)malloc(*maxLine + 1);
+    *funcHit = (signed char *)malloc(m->funcCount);
+    *funcLine = (int *)calloc(m->funcCount, sizeof(int));
+    memset(*lineHit, -1, *maxLine + 1);
+    memset(*funcHit, -1, m->funcCount);
+    for (loc = 0; loc<m->iMemTop; loc++) {
+        line = m->iMemLine[loc];
+        f = m->iMemFunc[loc];
+        if (m->iMemTag[loc] != USED || line == 0) continue;
+        hit = (m->coverMap[loc] != 0);
+        if ((*lineHit)[line]<hit) (*lineHit)[line] = hit;
+        if (f>0) {
+            if ((*funcHit)[f]<hit) (*funcHit)[f] = hit;
+            if ((*funcLine)[f] == 0 || line<(*funcLine)[f]) (*funcLine)[f] = line;
+        }
+    }
+}
+
+
+void tmGetCoverage(TMMachine *m, TMCOVERAGE *coverage)
+{
+    signed char *lineHit, *funcHit;
+    int *funcLine, maxLine, i;
+
+    memset(coverage, 0, sizeof(TMCOVERAGE));
+    if (m->coverMap == NULL) return;
+    for (i = 0; i<m->iMemTop; i++) {
+        if (m->iMemTag[i] != USED) continue;
+        coverage->instructions++;
+        if (m->coverMap[i]) coverage->instructionsHit++;
+    }
+    coverSource(m, &maxLine, &lineHit, &funcHit, &funcLine);
+    for (i = 1; i<=maxLine; i++) {
+        if (lineHit[i]<0) continue;
+        coverage->lines++;
+        coverage->linesHit += lineHit[i];
+    }
+    for (i = 1; i<m->funcCount; i++) {
+        if (funcHit[i]<0) continue;
+        coverage->functions++;
+        coverage->functionsHit += funcHit[i];
+    }
+    free(lineHit);
+    free(funcHit);
+    free(funcLine);
+}
+
+
+void tmWriteCoverage(TMMachine *m, FILE *out, const char *testName)
+{
+    TMCOVERAGE coverage;
+    signed char *lineHit, *funcHit;
+    int *funcLine, maxLine, length, i;
+
+    if (m->coverMap == NULL) return;
+    tmGetCoverage(m, &coverage);
+    coverSource(m, &maxLine, &lineHit, &funcHit, &funcLine);
+
+    /* prog.tm and prog.tmb were compiled from prog.c- */
+    length = strlen(m->pgmName);
+    if (length>3 && strcmp(&m->pgmName[length-3], ".tm") == 0) length -= 3;
+    else if (length>4 && strcmp(&m->pgmName[length-4], ".tmb") == 0) length -= 4;
+    fprintf(out, "TN:%s\nSF:%.*s.c-\n", (testName ? testName : ""), length, m->pgmName);
+
+    for (i = 1; i<m->funcCount; i++) {
+        if (funcHit[i] >= 0) fprintf(out, "FN:%d,%s\n", funcLine[i], m->funcName[i]);
+    }
+    for (i = 1; i<m->funcCount; i++) {
+        if (funcHit[i] >= 0) fprintf(out, "FNDA:%d,%s\n", funcHit[i], m->funcName[i]);
+    }
+    fprintf(out, "FNF:%d\nFNH:%d\n", coverage.functions, coverage.functionsHit);
+    for (i = 1; i<=maxLine; i++) {
+        if (lineHit[i] >= 0) fprintf(out, "DA:%d,%d\n", i, lineHit[i]);
+    }
+    fprintf(out, "LF:%d\nLH:%d\nend_of_record\n", coverage.lines, coverage.linesHit);
+
+    free(lineHit);
+    free(funcHit);
+    free(funcLine);
+}
+
+
+
+STEPRESULT stepTM(TMMachine *m)
+{
+    STEPRESULT result;
+    int pc;
+
+    pc = m->pc = m->reg[PC_REG];
+    if ((pc<0) || (pc>=m->iMemSize))
+	return srIMEM_ERR;
+
+    if (m->breakCount && pc != m->breakSkip && tmBreakpointAt(m, pc) && breakHit(m, pc)) {
+        m->breakSkip = pc;
+        return srHALT;
+    }
+    m->breakSkip = -1;
+
+    m->lastpc = pc;
+    m->reg[PC_REG] = pc + 1;
+    m->instrCount++;
+    if (m->profileflag) {
+        m->iMemCount[pc]++;
+        if (pc>=m->profileTop) m->profileTop = pc + 1;
+    }
+    if (m->coverMap) m->coverMap[pc] = COVERED;
+
+    if (m->trace) {
+        traceSync(m);
+        result = executeInstruction(m, &m->iMem[pc]);
+        if (m->trace) traceStep(m, pc, result);
+    }
+    else result = executeInstruction(m, &m->iMem[pc]);
+    if (m->flameflag && --m->flameLeft<=0) {
+        sampleStack(m);
+        m->flameLeft = m->flameInterval;
+    }
+    return result;
+}				/* stepTM */
+
+
+
+
+/********************************************/
+/* the verifier.  Every instruction up to iMemTop must have a TM opcode
+   and registers 0..7, and every jump whose target is known without
+   running (d(7) or an LDC to the pc) must land in iMem.  If say is set
+   the first one that does not is described in the message.
+*/
+static int verifyProgram(TMMachine *m, int say)
+{
+    int loc;
+    long long int target;
+    INSTRUCTION *in;
+
+    for (loc = 0; loc<m->iMemTop; loc++) {
+        in = &m->iMem[loc];
+        if (in->iop<0 || in->iop>=opRALim || in->iop == opRRLim) {
+            if (say) tmSetMessage(m, "ERROR(verify): instruction at addr %d has no TM opcode (%d)", loc, in->iop);
+            return FALSE;
+        }
+        if (in->iarg1<0 || in->iarg1>=NO_REGS || in->iarg3<0 || in->iarg3>=NO_REGS ||
+            (opClass(in->iop) == opclRR && (in->iarg2<0 || in->iarg2>=NO_REGS))) {
+            if (say) tmSetMessage(m, "ERROR(verify): instruction at addr %d has a register out of range", loc);
+            return FALSE;
+        }
+        if (opClass(in->iop) == opclRR) continue;
+
+        target = -1;
+        switch (in->iop) {
+        case opLDA:
+            if (in->iarg1 == PC_REG && in->iarg3 == PC_REG) target = in->iarg2 + loc + 1;
+            break;
+        case opLDC:
+            if (in->iarg1 == PC_REG) target = in->iarg2;
+            break;
+        case opJZR:
+        case opJNZ:
+        case opJMP:
+            if (in->iarg3 == PC_REG) target = in->iarg2 + loc + 1;
+            break;
+        default:
+            continue;
+        }
+        if (target != -1 && (target<0 || target>=m->iMemSize)) {
+            if (say) tmSetMessage(m, "ERROR(verify): instruction at addr %d jumps outside of instruction memory to %lld", loc, target);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}				/* verifyProgram */
+
+
+int tmVerify(TMMachine *m)
+{
+    return verifyProgram(m, TRUE);
+}
+
+
+
+/********************************************/
+/* replace the common code generator idioms in fastCode with
+   superinstructions.  Only the first instruction of a run is changed
+   so a jump into the middle of one still finds the plain instructions.
+*/
+static void fuseInstructions(TMMachine *m)
+{
+    int loc;
+    DECODED *dc;
+
+    for (loc = 0; loc<fxEND; loc++) m->fuseSites[loc] = 0;
+
+    for (loc = 0; loc+1<m->iMemTop; loc++) {
+        dc = &m->fastCode[loc];
+
+        // LD 4,y(1); LD 3,x(1); ADD 3,3,4 ... and the function return
+        if (dc[0].plain == fxLD && (dc[1].plain == fxLD || dc[1].plain == fxLDFP) && loc+2<m->iMemTop) {
+            if (dc[1].plain == fxLD && dc[2].plain >= fxADD && dc[2].plain <= fxTNE) dc->op = fxLDLDOP;
+            else if (dc[2].plain == fxJMP) dc->op = fxLDLDJMP;
+        }
+
+        // ST 3,off(1); LD 4,off(1) spill and reload
+        else if ((dc[0].plain == fxST || dc[0].plain == fxSTV) && dc[1].plain == fxLD &&
+                 dc[0].s == dc[1].s && dc[0].d == dc[1].d) dc->op = (dc[0].plain == fxST ? fxSTLD : fxSTLDV);
+
+        // LDA 3,1(7); JMP 7,f(7) call
+        else if (dc[0].plain == fxLDC && dc[1].plain == fxJMPK) dc->op = fxCALL;
+
+        if (dc->op != dc->plain) m->fuseSites[dc->op]++;
+    }
+}				/* fuseInstructions */
+
+
+
+static void markBlockStarts(TMMachine *m);
+
+/********************************************/
+/* decode iMem into fastCode for runTM().  Any instruction that reads
+   or writes the pc other than as a simple jump is left to the slow
+   path so that it sees reg[PC_REG] exactly as stepTM() sets it.  The
+   code is verified as it is decoded: only verified code runs unchecked.
+*/
+static void decodeInstructions(TMMachine *m)
+{
+    int loc;
+    long long int target;
+    INSTRUCTION *in;
+    DECODED *dc;
+
+    for (loc = 0; loc<m->iMemTop; loc++) {
+        in = &m->iMem[loc];
+        dc = &m->fastCode[loc];
+        dc->op = fxSLOW;
+        dc->r = in->iarg1;
+
+        if (opClass(in->iop) == opclRR) {
+            dc->s = in->iarg2;
+            dc->t = in->iarg3;
+            dc->d = 0;
+            if (in->iop == opHALT) dc->op = fxHALT;
+            else if (in->iop == opNOP) dc->op = fxNOP;
+            else if (dc->r != PC_REG && dc->s != PC_REG && dc->t != PC_REG) {
+                switch (in->iop) {
+                case opADD: dc->op = fxADD; break;
+                case opSUB: dc->op = fxSUB; break;
+                case opMUL: dc->op = fxMUL; break;
+                case opDIV: dc->op = fxDIV; break;
+                case opMOD: dc->op = fxMOD; break;
+                case opAND: dc->op = fxAND; break;
+                case opOR: dc->op = fxOR; break;
+                case opXOR: dc->op = fxXOR; break;
+                case opNOT: dc->op = fxNOT; break;
+                case opNEG: dc->op = fxNEG; break;
+                case opSWP: dc->op = fxSWP; break;
+                case opTLT: dc->op = fxTLT; break;
+                case opSLT: dc->op = fxSLT; break;
+                case opTLE: dc->op = fxTLE; break;
+                case opTGT: dc->op = fxTGT; break;
+                case opSGT: dc->op = fxSGT; break;
+                case opTGE: dc->op = fxTGE; break;
+                case opTEQ: dc->op = fxTEQ; break;
+                case opTNE: dc->op = fxTNE; break;
+                default: break;   // I/O, RND and the block instructions
+                }
+            }
+        }
+        else {
+            dc->s = in->iarg3;
+            dc->t = 0;
+            dc->d = in->iarg2;
+            target = in->iarg2 + loc + 1;   // d(7) as seen by the instruction
+
+            /* a d that does not fit in DECODED is left to the slow path */
+            switch (dc->d == in->iarg2 && target == (int)target ? in->iop : opRALim) {
+            case opLD:
+                if (dc->r != PC_REG && dc->s != PC_REG) dc->op = fxLD;
+                break;
+            case opST:
+                if (dc->r != PC_REG && dc->s != PC_REG) dc->op = (m->leanflag ? fxSTV : fxST);
+                break;
+            case opLDA:
+                if (dc->r != PC_REG) {
+                    if (dc->s != PC_REG) dc->op = fxLDA;
+                    else {
+                        dc->op = fxLDC;
+                        dc->d = target;
+                    }
+                }
+                else if (dc->s != PC_REG) dc->op = fxJMP;
+                else if (target >= 0 && target<m->iMemSize) {
+                    dc->op = fxJMPK;
+                    dc->d = target;
+                }
+                break;
+            case opLDC:
+                if (dc->r != PC_REG) dc->op = fxLDC;
+                else if (dc->d >= 0 && dc->d<m->iMemSize) dc->op = fxJMPK;
+                break;
+            case opJZR:
+            case opJNZ:
+                if (dc->r == PC_REG) break;
+                if (dc->s != PC_REG) dc->op = (in->iop == opJZR ? fxJZR : fxJNZ);
+                else if (target >= 0 && target<m->iMemSize) {
+                    dc->op = (in->iop == opJZR ? fxJZRK : fxJNZK);
+                    dc->d = target;
+                }
+                break;
+            case opJMP:
+                if (dc->s != PC_REG) dc->op = fxJMP;
+                else if (target >= 0 && target<m->iMemSize) {
+                    dc->op = fxJMPK;
+                    dc->d = target;
+                }
+                break;
+            default:
+                break;
+            }
+        }
+
+        /* the instructions that move the frame pointer keep the stack
+           statistics.  Only LDA and LD do in c- code. */
+        if (dc->op == fxLDA && dc->r == FP_REG) dc->op = fxLDAFP;
+        else if (dc->op == fxLD && dc->r == FP_REG) dc->op = fxLDFP;
+        else if ((dc->op == fxLDC || (dc->op >= fxADD && dc->op <= fxTNE)) &&
+                 (dc->r == FP_REG || (dc->op == fxSWP && dc->s == FP_REG))) dc->op = fxSLOW;
+        dc->plain = dc->op;
+    }
+    m->fastCode[m->iMemSize].op = m->fastCode[m->iMemSize].plain = fxIMEM;
+    m->verified = verifyProgram(m, FALSE);
+    fuseInstructions(m);
+    markBlockStarts(m);
+    patchTraps(m);
+    dropBlocks(m);
+    m->fastCodeStale = FALSE;
+}				/* decodeInstructions */
+
+
+
+/********************************************/
+/* the block cache.  decodeInstructions() marks where basic blocks
+   start: the targets of the jumps whose target is known, the return
+   addresses made by LDA r,d(7) and whatever follows an instruction
+   that can change the pc.  A block runs from where it is entered up to
+   the first instruction that can change the pc or the next block start.
+   It is copied out of fastCode once, the first time it is entered, into
+   blockCode as a header holding its length, a micro-op for each
+   instruction and, if it falls through, a micro-op that enters the next
+   block.  Entering a jump into the middle of a block makes another
+   block starting there.
+*/
+
+/* can this instruction change the pc (or leave runTM())? */
+static int endsBlock(int op)
+{
+    return op == fxSLOW || op == fxHALT || (op >= fxJZR && op <= fxJMPK) || op == fxIMEM;
+}
+
+
+/* the block starts of the code in fastCode.  Only instructions that
+   end blocks or jump to known places make them. */
+static void markBlockStarts(TMMachine *m)
+{
+    int loc;
+    long long int target;
+    DECODED *dc;
+
+    zeroRange(m->blockStart, 0, m->blockStartTop, sizeof(char));
+    m->blockStartTop = m->iMemTop + 1;
+    for (loc = 0; loc<m->iMemTop; loc++) {
+        dc = &m->fastCode[loc];
+        target = -1;
+        if (dc->plain >= fxJZRK && dc->plain <= fxJMPK) target = dc->d;
+        else if (dc->plain == fxLDC && m->iMem[loc].iop == opLDA) target = dc->d;   // LDA r,d(7)
+        if (target >= 0 && target<m->iMemSize) {
+            m->blockStart[target] = TRUE;
+            if (target>=m->blockStartTop) m->blockStartTop = target + 1;
+        }
+        if (endsBlock(dc->plain)) m->blockStart[loc+1] = TRUE;
+    }
+}
+
+
+/* the number of addresses that start a block */
+int blockStarts(TMMachine *m)
+{
+    int loc, n;
+
+    n = 0;
+    for (loc = 0; loc<=m->iMemTop; loc++) if (m->blockStart[loc]) n++;
+    return n;
+}
+
+
+/* forget every translated block and the code the JIT made for them.
+   They are made again as they are entered.  Done when iMem is decoded
+   again and after registers or dMem are set from outside. */
+void dropBlocks(TMMachine *m)
+{
+    if (m->jitCode) {
+        zeroRange(m->jitAt, 0, m->blockTop, sizeof(int));
+        m->jitUsed = m->jitFirst;
+        m->jitBlocks = 0;
+    }
+    zeroRange(m->blockAt, 0, m->blockTop, sizeof(int));
+    m->blockTop = 0;
+    m->blockCodeUsed = 0;
+    m->blocksMade = 0;
+}
+
+
+/* how many instructions a superinstruction runs before it dispatches
+   the next micro-op of its block */
+static int fusedSpan(int op)
+{
+    switch (op) {
+    case fxLDLDOP:
+    case fxSTLD:
+    case fxSTLDV:
+    case fxCALL:
+        return 2;
+    case fxLDLDJMP:
+        return 3;
+    default:
+        return 1;
+    }
+}
+
+
+/* the form of a micro-op that runs in unchecked mode */
+static int uncheckedOp(int op)
+{
+    switch (op) {
+    case fxLD: return fxLDU;
+    case fxST: return fxSTU;
+    case fxSTV: return fxSTVU;
+    case fxLDLDOP: return fxLDLDOPU;
+    case fxSTLD: return fxSTLDU;
+    case fxSTLDV: return fxSTLDVU;
+    case fxLDLDJMP: return fxLDLDJMPU;
+    case fxBLOCK: return fxBLOCKU;
+    default: return op;
+    }
+}
+
+
+/* does the instruction decoded as dc write register r? */
+static int writesReg(DECODED *dc, int r)
+{
+    switch (dc->plain) {
+    case fxNOP:
+    case fxST:
+    case fxSTV:
+        return FALSE;
+    case fxSWP:
+        return dc->r == r || dc->s == r;
+    default:
+        return dc->r == r;
+    }
+}
+
+
+static int isLoadStore(DECODED *dc)
+{
+    return dc->plain == fxLD || dc->plain == fxLDFP || dc->plain == fxST || dc->plain == fxSTV;
+}
+
+
+/* in unchecked mode no LD or ST follows, in the same block, an
+   instruction that writes a register that an LD or ST of the block up
+   to that instruction takes its address from.  Then whichever LD or ST
+   faults, the addresses of it and those before it can be worked out
+   again from the registers, which is how guardFault() finds it.  Must
+   the block from loc to end stop before end+1? */
+static int endsUncheckedBlock(TMMachine *m, int loc, int end)
+{
+    int w, i;
+
+    if (!isLoadStore(&m->fastCode[end+1])) return FALSE;
+    for (w = loc; w<=end; w++) {
+        for (i = loc; i<=w; i++) {
+            if (isLoadStore(&m->fastCode[i]) && writesReg(&m->fastCode[w], m->fastCode[i].s)) return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+
+/* the header of a block that coverage has no more need of.  If jit is
+   set it is the one that counts the entries for the JIT while it is on. */
+static int blockHeader(TMMachine *m, int jit)
+{
+    if (jit && m->jitflag) return fxBLOCKJ;
+    return (m->uncheckedflag && m->verified ? fxBLOCKU : fxBLOCK);
+}
+
+
+/* translate the block that starts at loc and return 1 + the index of
+   its header in blockCode, or 0 if there is no memory for it.
+   blockCode may move. */
+static int translateBlock(TMMachine *m, int loc)
+{
+    int end, at, i, size, unchecked;
+    DECODED *dc;
+    MICROOP *uop, *code;
+
+    unchecked = m->uncheckedflag && m->verified;
+    end = loc;
+    while (!endsBlock(m->fastCode[end].plain) && end+1<m->iMemSize && !m->blockStart[end+1] &&
+           !(unchecked && endsUncheckedBlock(m, loc, end))) end++;
+
+    if (m->blockCodeUsed + (end-loc+1) + 2>m->blockCodeSize) {
+        size = 2*m->blockCodeSize + (end-loc+1) + 2 + 1024;
+        code = (MICROOP *)realloc(m->blockCode, size*sizeof(MICROOP));
+        if (code == NULL) return 0;
+        m->blockCode = code;
+        m->blockCodeSize = size;
+    }
+    at = m->blockCodeUsed;
+    uop = &m->blockCode[at];
+    uop->op = (m->coverMap ? fxBLOCKC : blockHeader(m, TRUE));
+    uop->loc = loc;
+    uop->next = 0;
+    uop->d = end-loc+1;
+    uop++;
+
+    for (i = loc; i<=end; i++, uop++) {
+        dc = &m->fastCode[i];
+        uop->op = (i+fusedSpan(dc->op)-1<=end ? dc->op : dc->plain);
+        if (unchecked) uop->op = uncheckedOp(uop->op);
+        uop->loc = i;
+        uop->r = dc->r;
+        uop->s = dc->s;
+        uop->t = dc->t;
+        uop->next = 0;
+        uop->d = dc->d;
+    }
+
+    if (!endsBlock(m->fastCode[end].plain)) {
+        uop->op = fxNEXT;
+        uop->loc = end;
+        uop->next = 0;
+        uop->d = end+1;
+        uop++;
+    }
+
+    m->blockCodeUsed = uop - m->blockCode;
+    m->blockAt[loc] = at + 1;
+    if (loc>=m->blockTop) m->blockTop = loc + 1;
+    m->blocksMade++;
+
+    return at + 1;
+}
+
+
+
+/********************************************/
+/* the JIT.  While it is on, the header of a translated block counts
+   the entries of the block (fxBLOCKJ) and at the JIT_HOT'th jitBlock()
+   compiles the block into x86-64 code in jitCode.  The header becomes
+   fxJIT, which calls that code.  The code of a block does what its
+   micro-ops do with the registers and dMem where they are in the
+   machine, then goes on to the next block itself: a jump to a known
+   address is linked straight to the code of the block there once that
+   has been compiled (see jitLink()) and a computed one looks the code up
+   in jitAt.  Everything else goes back to runTM() (see JITEXIT), which
+   carries on as the micro-ops would have:
+
+   - a block with fewer steps left than it is long, to be stepped
+   - the slow path and HALT, which end their blocks: I/O, RND, the
+     block instructions and whatever reads or writes the pc oddly
+   - a bad dMem address, a store to LIT or a division by 0, found
+     before the instruction changes anything, to stop at with the
+     result and message of the engine
+   - a jump to a block with no code yet
+
+   Each block takes its length off the steps left as it is entered, as
+   fxBLOCK does, so the counts are the engine's too.  The code keeps m
+   in rbp, the JITSTATE in rbx, dMem and dMemTag in r12 and r13, the
+   steps left in r14 and jitCode in r15, and calls frameMoved() for the
+   instructions that move the frame pointer.  Only on x86-64 Linux (see
+   tmSetJit()).
+*/
+#if defined(__x86_64__) && defined(__linux__)
+#define TM_JIT
+#endif
+
+#define JIT_INSTR_BYTES 192     /* most code an instruction (and its exits) makes */
+
+// what runTM() and the code of the JIT hand each other
+typedef struct
+{
+    long long int left;         // steps left
+    long long int target;       // jitJUMP: where to go
+    int last;                   // address of the last instruction run
+    int block;                  // blockCode index of the header of the block left
+    int at;                     // jitRESUME, jitFAULT: and of its micro-op to carry on at
+    int site;                   // jitJUMP: offset of the jump to link to target (-1 none)
+    int dirtyLow, dirtyHigh;    // as kept by runTM()
+} JITSTATE;
+
+// why the code went back to runTM()
+typedef enum
+{
+    jitSHORT,                   // fewer steps left than block is long
+    jitJUMP,                    // to target, which has no code
+    jitRESUME,                  // the micro-op at is for the engine
+    jitFAULT                    // the micro-op at stops the run
+} JITEXIT;
+
+typedef int (*JITENTRY)(TMMachine *m, JITSTATE *js, unsigned char *code);
+
+// a jump to an exit written after the code of the block
+typedef struct
+{
+    unsigned char *at;          // its rel32
+    int kind;                   // a JITEXIT or jitLINK
+    int arg;                    // the micro-op or the target
+} JITFIX;
+
+#define jitLINK (-1)            // JITFIX kind: a jump to a known target
+
+// a block being compiled
+typedef struct
+{
+    TMMachine *m;
+    unsigned char *p;           // where the next byte goes
+    int block;                  // blockCode index of the header
+    JITFIX *fix;
+    int fixes;
+} JITASM;
+
+// the x86-64 registers and condition codes used
+enum { xAX, xCX, xDX, xBX, xSP, xBP, xSI, xDI, x12 = 12, x13, x14, x15 };
+enum { ccB = 2, ccAE, ccE, ccNE, ccS = 8, ccNS, ccL = 12, ccGE, ccLE, ccG };
+
+#define JREG(i) ((int)offsetof(TMMachine, reg) + 8*(i))   // reg[i] off rbp
+#define JMACH(f) ((int)offsetof(TMMachine, f))           // a field of m off rbp
+#define JSTATE(f) ((int)offsetof(JITSTATE, f))           // a field off rbx
+
+
+static void emitByte(JITASM *j, int b)
+{
+    *j->p++ = (unsigned char)b;
+}
+
+
+static void emitInt(JITASM *j, int v)
+{
+    memcpy(j->p, &v, sizeof(v));
+    j->p += sizeof(v);
+}
+
+
+static void emitPtr(JITASM *j, const void *v)
+{
+    memcpy(j->p, &v, sizeof(v));
+    j->p += sizeof(v);
+}
+
+
+/* the REX prefix (if any) and the one or two bytes of op */
+static void emitOpcode(JITASM *j, int w, int op, int reg, int index, int base)
+{
+    int rex;
+
+    rex = 0x40 | (w ? 8 : 0) | (reg & 8 ? 4 : 0) | (index & 8 ? 2 : 0) | (base & 8 ? 1 : 0);
+    if (rex != 0x40) emitByte(j, rex);
+    if (op>0xff) emitByte(j, op>>8);
+    emitByte(j, op & 0xff);
+}
+
+
+/* op with register (or opcode extension) reg and the memory operand
+   [base + index*scale + disp] (index -1: [base + disp]).  w makes it 64 bit. */
+static void emitMem(JITASM *j, int w, int op, int reg, int base, int index, int scale, int disp)
+{
+    int mod;
+
+    emitOpcode(j, w, op, reg, (index<0 ? 0 : index), base);
+    mod = (disp == 0 && (base & 7) != xBP ? 0 : (disp >= -128 && disp <= 127 ? 1 : 2));
+    if (index >= 0 || (base & 7) == xSP) {
+        emitByte(j, (mod<<6) | ((reg & 7)<<3) | 4);
+        emitByte(j, ((scale == 8 ? 3 : (scale == 4 ? 2 : 0))<<6) | (((index<0 ? xSP : index) & 7)<<3) | (base & 7));
+    }
+    else emitByte(j, (mod<<6) | ((reg & 7)<<3) | (base & 7));
+    if (mod == 1) emitByte(j, disp);
+    else if (mod == 2) emitInt(j, disp);
+}
+
+
+/* op with register (or opcode extension) reg and register rm */
+static void emitReg(JITASM *j, int w, int op, int reg, int rm)
+{
+    emitOpcode(j, w, op, reg, 0, rm);
+    emitByte(j, 0xc0 | ((reg & 7)<<3) | (rm & 7));
+}
+
+
+/* x = reg[r] and reg[r] = x */
+static void loadReg(JITASM *j, int x, int r)
+{
+    emitMem(j, TRUE, 0x8b, x, xBP, -1, 0, JREG(r));
+}
+
+
+static void storeReg(JITASM *j, int r, int x)
+{
+    emitMem(j, TRUE, 0x89, x, xBP, -1, 0, JREG(r));
+}
+
+
+/* a jmp (cc -1) or jcc whose rel32 is filled in later.  Returns it. */
+static unsigned char *emitJump(JITASM *j, int cc)
+{
+    if (cc<0) emitByte(j, 0xe9);
+    else {
+        emitByte(j, 0x0f);
+        emitByte(j, 0x80 + cc);
+    }
+    emitInt(j, 0);
+    return j->p - 4;
+}
+
+
+/* a short jcc forward within an instruction, landed by shortHere() */
+static unsigned char *emitShort(JITASM *j, int cc)
+{
+    emitByte(j, 0x70 + cc);
+    emitByte(j, 0);
+    return j->p - 1;
+}
+
+
+static void shortHere(JITASM *j, unsigned char *at)
+{
+    *at = (unsigned char)(j->p - (at + 1));
+}
+
+
+/* point the rel32 at at to */
+static void jitPatch(unsigned char *at, unsigned char *to)
+{
+    int rel;
+
+    rel = (int)(to - (at + 4));
+    memcpy(at, &rel, sizeof(rel));
+}
+
+
+/* a jump or jcc to the exit kind with arg, written after the block */
+static void emitExitJump(JITASM *j, int cc, int kind, int arg)
+{
+    j->fix[j->fixes].at = emitJump(j, cc);
+    j->fix[j->fixes].kind = kind;
+    j->fix[j->fixes].arg = arg;
+    j->fixes++;
+}
+
+
+static void setState(JITASM *j, int field, int value)
+{
+    emitMem(j, FALSE, 0xc7, 0, xBX, -1, 0, field);
+    emitInt(j, value);
+}
+
+
+/* back to runTM() with why in eax */
+static void emitExit(JITASM *j, int why)
+{
+    emitByte(j, 0xb8);
+    emitInt(j, why);
+    jitPatch(emitJump(j, -1), j->m->jitCode + j->m->jitExit);
+}
+
+
+/* go on to the block at the known address target if cc holds (-1 always) */
+static void emitGoto(JITASM *j, int cc, int target)
+{
+    emitExitJump(j, cc, jitLINK, target);
+}
+
+
+/* go on to the block at the address in rax.  Its code, if it has any,
+   is found in jitAt. */
+static void emitGotoRax(JITASM *j)
+{
+    emitReg(j, TRUE, 0x81, 7, xAX);                     // cmp rax, iMemSize
+    emitInt(j, j->m->iMemSize);
+    emitExitJump(j, ccAE, jitJUMP, 0);
+    emitMem(j, TRUE, 0x8b, xCX, xBP, -1, 0, JMACH(jitAt));   // mov rcx, jitAt
+    emitMem(j, FALSE, 0x8b, xCX, xCX, xAX, 4, 0);       // mov ecx, [rcx + 4*rax]
+    emitReg(j, FALSE, 0x85, xCX, xCX);
+    emitExitJump(j, ccE, jitJUMP, 0);
+    emitReg(j, TRUE, 0x03, xCX, x15);                   // add rcx, jitCode
+    emitReg(j, FALSE, 0xff, 4, xCX);                    // jmp rcx
+}
+
+
+/* the old frame pointer is in rsi and the new in x: call frameMoved()
+   if it moved */
+static void emitFrameMoved(JITASM *j, int x)
+{
+    unsigned char *same;
+
+    emitReg(j, TRUE, 0x3b, x, xSI);
+    same = emitShort(j, ccE);
+    emitReg(j, TRUE, 0x8b, xDI, xBP);                   // mov rdi, m
+    emitByte(j, 0x48);                                  // mov rax, frameMoved
+    emitByte(j, 0xb8);
+    emitPtr(j, (const void *)(size_t)frameMoved);
+    emitReg(j, FALSE, 0xff, 2, xAX);                    // call rax
+    shortHere(j, same);
+}
+
+
+/* eax = the dMem address of the LD or ST uop (an int, as in FASTLD()),
+   or out to its fault if that is outside dMem */
+static void emitAddress(JITASM *j, MICROOP *uop)
+{
+    loadReg(j, xAX, uop->s);
+    emitReg(j, FALSE, 0x81, 0, xAX);                    // add eax, d
+    emitInt(j, uop->d);
+    emitReg(j, FALSE, 0x81, 7, xAX);                    // cmp eax, dMemSize
+    emitInt(j, j->m->dMemSize);
+    emitExitJump(j, ccAE, jitFAULT, uop - j->m->blockCode);
+}
+
+
+/* the code for the instruction of uop as it is on its own (its plain
+   FASTOP).  FALSE if it is one the JIT does not do. */
+static int emitInstruction(JITASM *j, MICROOP *uop)
+{
+    TMMachine *m = j->m;
+    unsigned char *skip;
+    int k, op, cc;
+
+    k = uop - m->blockCode;
+    op = m->fastCode[uop->loc].plain;
+    switch (op) {
+    case fxNOP:
+        break;
+
+    case fxADD:
+    case fxSUB:
+    case fxMUL:
+    case fxAND:
+    case fxOR:
+    case fxXOR:
+        loadReg(j, xAX, uop->s);
+        emitMem(j, TRUE, (op == fxADD ? 0x03 : op == fxSUB ? 0x2b : op == fxMUL ? 0x0faf :
+                          op == fxAND ? 0x23 : op == fxOR ? 0x0b : 0x33), xAX, xBP, -1, 0, JREG(uop->t));
+        storeReg(j, uop->r, xAX);
+        break;
+
+    case fxDIV:
+    case fxMOD:
+        loadReg(j, xCX, uop->t);
+        emitReg(j, TRUE, 0x85, xCX, xCX);
+        emitExitJump(j, ccE, jitFAULT, k);
+        loadReg(j, xAX, uop->s);
+        emitByte(j, 0x48);                              // cqo
+        emitByte(j, 0x99);
+        emitReg(j, TRUE, 0xf7, 7, xCX);                 // idiv rcx
+        if (op == fxDIV) {
+            storeReg(j, uop->r, xAX);
+            break;
+        }
+        emitReg(j, TRUE, 0x85, xDX, xDX);               // a negative remainder
+        skip = emitShort(j, ccNS);
+        emitReg(j, TRUE, 0x8b, xAX, xCX);               // gets llabs(reg[t]) added
+        emitReg(j, TRUE, 0xf7, 3, xAX);
+        emitReg(j, TRUE, 0x0f48, xAX, xCX);             // cmovs rax, rcx
+        emitReg(j, TRUE, 0x03, xDX, xAX);
+        shortHere(j, skip);
+        storeReg(j, uop->r, xDX);
+        break;
+
+    case fxNOT:
+    case fxNEG:
+        loadReg(j, xAX, uop->s);
+        emitReg(j, TRUE, 0xf7, (op == fxNOT ? 2 : 3), xAX);
+        storeReg(j, uop->r, xAX);
+        break;
+
+    case fxSWP:
+        loadReg(j, xAX, uop->r);
+        loadReg(j, xCX, uop->s);
+        emitReg(j, TRUE, 0x3b, xAX, xCX);
+        skip = emitShort(j, ccLE);
+        storeReg(j, uop->r, xCX);
+        storeReg(j, uop->s, xAX);
+        shortHere(j, skip);
+        break;
+
+    case fxTLT:
+    case fxTLE:
+    case fxTGT:
+    case fxTGE:
+    case fxTEQ:
+    case fxTNE:
+        cc = (op == fxTLT ? ccL : op == fxTLE ? ccLE : op == fxTGT ? ccG :
+              op == fxTGE ? ccGE : op == fxTEQ ? ccE : ccNE);
+        loadReg(j, xCX, uop->s);
+        emitReg(j, FALSE, 0x33, xAX, xAX);
+        emitMem(j, TRUE, 0x3b, xCX, xBP, -1, 0, JREG(uop->t));
+        emitReg(j, FALSE, 0x0f90 + cc, 0, xAX);         // setcc al
+        storeReg(j, uop->r, xAX);
+        break;
+
+    case fxSLT:
+    case fxSGT:
+        cc = (op == fxSLT ? ccL : ccG);
+        loadReg(j, xCX, uop->s);
+        loadReg(j, xDX, uop->t);
+        emitReg(j, FALSE, 0x33, xAX, xAX);
+        emitReg(j, TRUE, 0x3b, xCX, xDX);               // cmp rcx, rdx
+        emitReg(j, FALSE, 0x0f90 + cc, 0, xAX);
+        emitMem(j, TRUE, 0x83, 7, xBP, -1, 0, JREG(uop->r));   // cmp reg[r], 0
+        emitByte(j, 0);
+        skip = emitShort(j, ccGE);
+        emitReg(j, FALSE, 0x33, xAX, xAX);              // a negative reg[r] compares
+        emitReg(j, TRUE, 0x3b, xDX, xCX);               // the other way: cmp rdx, rcx
+        emitReg(j, FALSE, 0x0f90 + cc, 0, xAX);
+        shortHere(j, skip);
+        storeReg(j, uop->r, xAX);
+        break;
+
+    case fxLD:
+    case fxLDFP:
+        if (op == fxLDFP) loadReg(j, xSI, FP_REG);
+        emitAddress(j, uop);
+        emitMem(j, TRUE, 0x8b, xCX, x12, xAX, 8, 0);
+        storeReg(j, uop->r, xCX);
+        if (op == fxLDFP) emitFrameMoved(j, xCX);
+        break;
+
+    case fxST:
+    case fxSTV:
+        emitAddress(j, uop);
+        skip = NULL;
+        if (op == fxSTV) {
+            emitMem(j, FALSE, 0x3b, xAX, xBP, -1, 0, JMACH(readOnlyLow));
+            skip = emitShort(j, ccL);
+        }
+        emitMem(j, FALSE, 0x83, 7, x13, xAX, 4, 0);     // cmp dMemTag[a], READONLY
+        emitByte(j, READONLY);
+        emitExitJump(j, ccE, jitFAULT, k);
+        if (skip) shortHere(j, skip);
+        loadReg(j, xCX, uop->r);
+        emitMem(j, TRUE, 0x89, xCX, x12, xAX, 8, 0);
+        emitMem(j, FALSE, 0x3b, xAX, xBX, -1, 0, JSTATE(dirtyLow));
+        skip = emitShort(j, ccGE);
+        emitMem(j, FALSE, 0x89, xAX, xBX, -1, 0, JSTATE(dirtyLow));
+        shortHere(j, skip);
+        emitMem(j, FALSE, 0x3b, xAX, xBX, -1, 0, JSTATE(dirtyHigh));
+        skip = emitShort(j, ccLE);
+        emitMem(j, FALSE, 0x89, xAX, xBX, -1, 0, JSTATE(dirtyHigh));
+        shortHere(j, skip);
+        if (op == fxST) {
+            emitMem(j, FALSE, 0xc7, 0, x13, xAX, 4, 0);
+            emitInt(j, uop->loc + 1);
+        }
+        break;
+
+    case fxLDA:
+    case fxLDAFP:
+        if (op == fxLDAFP) loadReg(j, xSI, FP_REG);
+        loadReg(j, xAX, uop->s);
+        emitReg(j, TRUE, 0x81, 0, xAX);
+        emitInt(j, uop->d);
+        storeReg(j, uop->r, xAX);
+        if (op == fxLDAFP) emitFrameMoved(j, xAX);
+        break;
+
+    case fxLDC:
+        emitMem(j, TRUE, 0xc7, 0, xBP, -1, 0, JREG(uop->r));
+        emitInt(j, uop->d);
+        break;
+
+    case fxJZR:
+    case fxJNZ:
+    case fxJMP:
+        setState(j, JSTATE(last), uop->loc);
+        if (op != fxJMP) {
+            emitMem(j, TRUE, 0x83, 7, xBP, -1, 0, JREG(uop->r));
+            emitByte(j, 0);
+            emitGoto(j, (op == fxJZR ? ccNE : ccE), uop->loc + 1);
+        }
+        loadReg(j, xAX, uop->s);
+        emitReg(j, TRUE, 0x81, 0, xAX);
+        emitInt(j, uop->d);
+        emitGotoRax(j);
+        break;
+
+    case fxJZRK:
+    case fxJNZK:
+    case fxJMPK:
+        setState(j, JSTATE(last), uop->loc);
+        if (op != fxJMPK) {
+            emitMem(j, TRUE, 0x83, 7, xBP, -1, 0, JREG(uop->r));
+            emitByte(j, 0);
+            emitGoto(j, (op == fxJZRK ? ccNE : ccE), uop->loc + 1);
+        }
+        emitGoto(j, -1, uop->d);
+        break;
+
+    case fxSLOW:
+    case fxHALT:
+        setState(j, JSTATE(at), k);
+        setState(j, JSTATE(block), j->block);
+        emitExit(j, jitRESUME);
+        break;
+
+    default:
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+/* the superinstruction the engine runs for uop, fxNOP if none */
+static int fusedRun(int op)
+{
+    switch (op) {
+    case fxLDLDOP:
+    case fxLDLDOPU:
+        return fxLDLDOP;
+    case fxSTLD:
+    case fxSTLDU:
+        return fxSTLD;
+    case fxSTLDV:
+    case fxSTLDVU:
+        return fxSTLDV;
+    case fxCALL:
+        return fxCALL;
+    case fxLDLDJMP:
+    case fxLDLDJMPU:
+        return fxLDLDJMP;
+    default:
+        return fxNOP;
+    }
+}
+
+
+/* the exits of the block, the jumps to them and its links */
+static void emitExits(JITASM *j)
+{
+    TMMachine *m = j->m;
+    unsigned char *stub;
+    JITFIX *f;
+    int i;
+
+    stub = NULL;
+    for (i = 0; i<j->fixes; i++) {
+        f = &j->fix[i];
+        if (f->kind == jitLINK) {
+            if (m->jitAt[f->arg]) jitPatch(f->at, m->jitCode + m->jitAt[f->arg]);   // (or itself)
+            else {
+                jitPatch(f->at, j->p);
+                emitMem(j, TRUE, 0xc7, 0, xBX, -1, 0, JSTATE(target));
+                emitInt(j, f->arg);
+                setState(j, JSTATE(site), f->at - m->jitCode);
+                emitExit(j, jitJUMP);
+            }
+            continue;
+        }
+        if (i>0 && f->kind == f[-1].kind && f->arg == f[-1].arg) {
+            jitPatch(f->at, stub);
+            continue;
+        }
+        stub = j->p;
+        jitPatch(f->at, stub);
+        switch (f->kind) {
+        case jitJUMP:
+            emitMem(j, TRUE, 0x89, xAX, xBX, -1, 0, JSTATE(target));
+            setState(j, JSTATE(site), -1);
+            break;
+        case jitFAULT:
+            setState(j, JSTATE(at), f->arg);
+            setState(j, JSTATE(block), j->block);
+            break;
+        default:
+            setState(j, JSTATE(block), j->block);
+            break;
+        }
+        emitExit(j, f->kind);
+    }
+}
+
+
+/* compile the block with header blk.  FALSE if it has an instruction
+   the JIT does not do or there is no room for it. */
+static int jitBlock(TMMachine *m, MICROOP *blk)
+{
+    JITASM j;
+    MICROOP *uop;
+    int n, k, i, span, run, ok;
+
+    n = blk->d;
+    if (m->jitUsed + (long long int)(n + 2)*JIT_INSTR_BYTES>JIT_CODE_SIZE) return FALSE;
+    for (k = 1; k<=n; k++) {
+        if (blk[k].op == fxTRAP || blk[k].op == fxIMEM) return FALSE;
+    }
+    j.m = m;
+    j.p = m->jitCode + m->jitUsed;
+    j.block = blk - m->blockCode;
+    j.fixes = 0;
+    j.fix = (JITFIX *)malloc((3*n + 4)*sizeof(JITFIX));
+    if (j.fix == NULL) return FALSE;
+
+    /* take the block's steps off those left, or step it */
+    emitReg(&j, TRUE, 0x81, 7, x14);
+    emitInt(&j, n);
+    emitExitJump(&j, ccB, jitSHORT, 0);
+    emitReg(&j, TRUE, 0x81, 5, x14);
+    emitInt(&j, n);
+
+    ok = TRUE;
+    for (k = 1; k<=n && ok; k += span) {
+        uop = &blk[k];
+        run = fusedRun(uop->op);
+        span = (run == fxNOP ? 1 : fusedSpan(run));
+        if (run != fxNOP) emitMem(&j, TRUE, 0xff, 0, xBP, -1, 0, JMACH(fuseRuns) + 8*run);   // inc
+        for (i = 0; i<span && ok; i++) ok = emitInstruction(&j, uop + i);
+    }
+    if (ok && !endsBlock(m->fastCode[blk->loc + n - 1].plain)) {   // the fxNEXT
+        setState(&j, JSTATE(last), blk[n+1].loc);
+        emitGoto(&j, -1, blk[n+1].d);
+    }
+    if (ok) {
+        m->jitAt[blk->loc] = m->jitUsed;
+        emitExits(&j);
+        m->jitUsed = j.p - m->jitCode;
+        m->jitBlocks++;
+    }
+    free(j.fix);
+    return ok;
+}
+
+
+/* the jump at site goes straight to the code of the block at target */
+static void jitLink(TMMachine *m, int site, int target)
+{
+    jitPatch(m->jitCode + site, m->jitCode + m->jitAt[target]);
+}
+
+
+/* the code every block shares: the entry, called as a JITENTRY, and the
+   exit back to runTM() */
+static void jitStart(TMMachine *m)
+{
+    JITASM j;
+    int x;
+
+    j.m = m;
+    j.p = m->jitCode;
+    emitByte(&j, 0x55);                                 // push rbp
+    emitByte(&j, 0x53);                                 // push rbx
+    for (x = x12; x<=x15; x++) {
+        emitByte(&j, 0x41);
+        emitByte(&j, 0x50 + (x & 7));
+    }
+    emitReg(&j, TRUE, 0x83, 5, xSP);                    // sub rsp, 8: rsp is 16 byte aligned
+    emitByte(&j, 8);
+    emitReg(&j, TRUE, 0x8b, xBP, xDI);
+    emitReg(&j, TRUE, 0x8b, xBX, xSI);
+    emitMem(&j, TRUE, 0x8b, x12, xDI, -1, 0, JMACH(dMem));
+    emitMem(&j, TRUE, 0x8b, x13, xDI, -1, 0, JMACH(dMemTag));
+    emitMem(&j, TRUE, 0x8b, x14, xSI, -1, 0, JSTATE(left));
+    emitByte(&j, 0x49);                                 // mov r15, jitCode
+    emitByte(&j, 0xbf);
+    emitPtr(&j, m->jitCode);
+    emitReg(&j, FALSE, 0xff, 4, xDX);                   // jmp to the block
+
+    m->jitExit = j.p - m->jitCode;
+    emitMem(&j, TRUE, 0x89, x14, xBX, -1, 0, JSTATE(left));
+    emitReg(&j, TRUE, 0x83, 0, xSP);
+    emitByte(&j, 8);
+    for (x = x15; x>=x12; x--) {
+        emitByte(&j, 0x41);
+        emitByte(&j, 0x58 + (x & 7));
+    }
+    emitByte(&j, 0x5b);                                 // pop rbx
+    emitByte(&j, 0x5d);                                 // pop rbp
+    emitByte(&j, 0xc3);
+    m->jitFirst = m->jitUsed = (j.p - m->jitCode + 15) & ~15;
+}
+
+
+int tmSetJit(TMMachine *m, int jit)
+{
+#ifdef TM_JIT
+    void *code;
+
+    if (jit && m->jitCode == NULL) {
+        code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (code == MAP_FAILED) {
+            tmSetMessage(m, "ERROR: unable to map executable memory for the JIT");
+            return FALSE;
+        }
+        m->jitAt = (int *)newMemory(m->iMemSize, sizeof(int));
+        if (m->jitAt == NULL) {
+            munmap(code, JIT_CODE_SIZE);
+            tmSetMessage(m, "ERROR: unable to map memory for the JIT");
+            return FALSE;
+        }
+        m->jitCode = (unsigned char *)code;
+        jitStart(m);
+    }
+#else
+    if (jit) {
+        tmSetMessage(m, "ERROR: the JIT only runs on x86-64 Linux");
+        return FALSE;
+    }
+#endif
+    dropBlocks(m);
+    m->jitflag = (jit != 0);
+    return TRUE;
+}
+
+
+
+/********************************************/
+/* execute up to limit instructions (limit of 0 means no limit)
+   exactly as that many calls to stepTM() would, returning the result
+   of the last step and the number of steps taken in *count.  Not used
+   while there is a profile to keep.  Breakpoints are traps decoded
+   into the code (see patchTrap()), so only the instructions at them
+   check for one.
+
+   The code runs a block at a time from the block cache.  Entering a
+   block checks the pc and takes all of its instructions off the steps
+   left at once, so the micro-ops inside only do their work and go on to
+   the next one.  A block that stops early (a fault, HALT or an error
+   from the slow path) gives back the steps it did not take.  When
+   fewer steps are left than the block is long the rest are done one at
+   a time by executeInstruction().  Jumps whose target is known remember
+   the block they went to.
+
+   The memories and registers are kept in locals for the loop.  Only
+   blockCode can move (when a block is translated).  With the JIT on,
+   hot blocks run as x86-64 code instead (see jitBlock()).
+
+   Threaded with computed gotos under gcc/clang, a switch otherwise (or
+   if TM_SWITCH_DISPATCH is defined).
+*/
+#if defined(__GNUC__) && !defined(TM_SWITCH_DISPATCH)
+#define TM_THREADED
+#endif
+
+#ifdef TM_THREADED
+#define HANDLER(x) L_##x:
+#define REDISPATCH() goto *dispatchTab[dc->op]
+#else
+#define HANDLER(x) case x:
+#define REDISPATCH() continue
+#endif
+
+// the next micro-op of the block
+#define NEXT() { dc++; REDISPATCH(); }
+
+// leave the block at loc with the pc set to after
+#define STOPAT(result_, loc, after) { last = (loc); result = (result_); next = (after); goto stopped; }
+
+// go to the block at a computed address
+#define JUMPTO(addr) { target = (addr); goto enter; }
+
+// go to the block at the known address dc->d, remembering it in dc->next
+#define CHAIN() { \
+        if (dc->next) { \
+            if (left == 0) { target = dc->d; goto outOfSteps; } \
+            dc = &m->blockCode[dc->next - 1]; \
+            REDISPATCH(); \
+        } \
+        chain = dc - m->blockCode; \
+        target = dc->d; \
+        goto enter; \
+    }
+
+// the range of dMem the stores of a run wrote, for clearMachine()
+#define DIRTY(a) { \
+        if ((a)<dirtyLow) dirtyLow = (a); \
+        if ((a)>dirtyHigh) dirtyHigh = (a); \
+    }
+
+// the LD and ST instructions of dc, leaving the address in a.  A fault
+// stops the block at the instruction with the message set by getDMem()
+// or setDMem().
+#define FASTLD(dc) { \
+        a = (dc)->d + reg[(dc)->s]; \
+        if (a<0 || a>=dMemSize) { \
+            m->pc = (dc)->loc; \
+            STOPAT(getDMem(m, a, &reg[(dc)->r]), (dc)->loc, (dc)->loc + 1); \
+        } \
+        reg[(dc)->r] = dMem[a]; \
+    }
+#define FASTST(dc) { \
+        a = (dc)->d + reg[(dc)->s]; \
+        if (a<0 || a>=dMemSize || dMemTag[a]==READONLY) { \
+            m->pc = (dc)->loc; \
+            STOPAT(setDMem(m, a, reg[(dc)->r]), (dc)->loc, (dc)->loc + 1); \
+        } \
+        dMem[a] = reg[(dc)->r]; \
+        DIRTY(a); \
+        dMemTag[a] = (dc)->loc + 1; \
+    }
+#define FASTSTV(dc) { \
+        a = (dc)->d + reg[(dc)->s]; \
+        if (a<0 || a>=dMemSize || (a>=readOnlyLow && dMemTag[a]==READONLY)) { \
+            m->pc = (dc)->loc; \
+            STOPAT(setDMem(m, a, reg[(dc)->r]), (dc)->loc, (dc)->loc + 1); \
+        } \
+        dMem[a] = reg[(dc)->r]; \
+        DIRTY(a); \
+    }
+
+// the same in unchecked mode.  An address out of bounds faults in the
+// guard regions (see runGuarded()).  dMemTag is read before dMem is
+// written so a ST out of bounds changes nothing.
+#define FASTLDU(dc) { \
+        a = (dc)->d + reg[(dc)->s]; \
+        reg[(dc)->r] = dMem[a]; \
+    }
+#define FASTSTU(dc) { \
+        a = (dc)->d + reg[(dc)->s]; \
+        if (dMemTag[a]==READONLY) { \
+            m->pc = (dc)->loc; \
+            STOPAT(setDMem(m, a, reg[(dc)->r]), (dc)->loc, (dc)->loc + 1); \
+        } \
+        dMem[a] = reg[(dc)->r]; \
+        DIRTY(a); \
+        dMemTag[a] = (dc)->loc + 1; \
+    }
+#define FASTSTVU(dc) { \
+        a = (dc)->d + reg[(dc)->s]; \
+        if (a>=readOnlyLow && dMemTag[a]==READONLY) { \
+            m->pc = (dc)->loc; \
+            STOPAT(setDMem(m, a, reg[(dc)->r]), (dc)->loc, (dc)->loc + 1); \
+        } \
+        dMem[a] = reg[(dc)->r]; \
+        DIRTY(a); \
+    }
+
+static STEPRESULT runTM(TMMachine *m, long long int limit, long long int *count)
+{
+    long long int *reg = m->reg;
+    long long int *dMem = m->dMem;
+    int *dMemTag = m->dMemTag;
+    INSTRUCTION *iMem = m->iMem;
+    DECODED *fastCode;
+    int dMemSize = m->dMemSize;
+    int iMemSize = m->iMemSize;
+    int readOnlyLow = m->readOnlyLow;
+    int dirtyLow = m->dMemSize, dirtyHigh = -1;
+    long long int *fuseRuns = m->fuseRuns;
+    char *coverMap = m->coverMap;
+    long long int left;         // steps left before the limit
+    long long int total;        // steps allowed
+    long long int target;       // pc of the block to enter next
+    long long int next;         // pc to leave in reg[PC_REG]
+    long long int v;
+    int last, a, b, chain, trapped, jitSite;
+    STEPRESULT result;
+    MICROOP *dc, *blk;
+    JITSTATE js;
+#ifdef TM_THREADED
+    static void *dispatchTab[fxEND] = {
+        &&L_fxSLOW, &&L_fxHALT, &&L_fxNOP,
+        &&L_fxADD, &&L_fxSUB, &&L_fxMUL, &&L_fxDIV, &&L_fxMOD,
+        &&L_fxAND, &&L_fxOR, &&L_fxXOR, &&L_fxNOT, &&L_fxNEG, &&L_fxSWP,
+        &&L_fxTLT, &&L_fxSLT, &&L_fxTLE, &&L_fxTGT, &&L_fxSGT, &&L_fxTGE, &&L_fxTEQ, &&L_fxTNE,
+        &&L_fxLD, &&L_fxST, &&L_fxSTV, &&L_fxLDA, &&L_fxLDC, &&L_fxLDAFP, &&L_fxLDFP,
+        &&L_fxJZR, &&L_fxJNZ, &&L_fxJMP, &&L_fxJZRK, &&L_fxJNZK, &&L_fxJMPK,
+        &&L_fxLDLDOP, &&L_fxSTLD, &&L_fxSTLDV, &&L_fxCALL, &&L_fxLDLDJMP,
+        &&L_fxIMEM, &&L_fxBLOCK, &&L_fxNEXT, &&L_fxTRAP,
+        &&L_fxLDU, &&L_fxSTU, &&L_fxSTVU,
+        &&L_fxLDLDOPU, &&L_fxSTLDU, &&L_fxSTLDVU, &&L_fxLDLDJMPU, &&L_fxBLOCKU,
+        &&L_fxBLOCKC, &&L_fxBLOCKJ, &&L_fxJIT
+    };
+#endif
+
+    if (m->fastCodeStale) decodeInstructions(m);
+    fastCode = m->fastCode;
+
+    /* in lean mode only the values in dMem are kept up to date */
+    m->tagflag = !m->leanflag;
+    if (m->leanflag) m->leanRan = TRUE;
+
+    total = left = (limit>0 ? limit : 0x7fffffffffffffffLL);
+    last = m->lastpc;
+    chain = jitSite = -1;
+    blk = NULL;
+    dc = NULL;
+    trapped = FALSE;
+    target = reg[PC_REG];
+
+    /* going on from the breakpoint the last run stopped at */
+    if (m->breakSkip >= 0 && m->breakSkip == target) {
+        m->breakSkip = -1;
+        goto stepOne;
+    }
+    m->breakSkip = -1;
+
+#ifdef TM_THREADED
+    goto enter;
+#else
+    goto enter;
+    for (;;) {
+        switch (dc->op) {
+#endif
+
+    HANDLER(fxBLOCK)
+        if (left<dc->d) goto oneAtATime;
+        left -= dc->d;
+        blk = dc;
+        NEXT();
+
+    HANDLER(fxNEXT)
+        last = dc->loc;
+        CHAIN();
+
+    HANDLER(fxSLOW)
+        m->pc = m->lastpc = last = dc->loc;
+        reg[PC_REG] = last + 1;
+        result = executeInstruction(m, &iMem[last]);
+        if (result != srOKAY) {
+            next = reg[PC_REG];
+            goto stopped;
+        }
+        JUMPTO(reg[PC_REG]);
+
+    HANDLER(fxHALT)
+        flushOutput(m);
+        STOPAT(srHALT, dc->loc, dc->loc + 1);
+
+    HANDLER(fxNOP)
+        NEXT();
+
+    HANDLER(fxADD)
+        reg[dc->r] = reg[dc->s] + reg[dc->t];
+        NEXT();
+
+    HANDLER(fxSUB)
+        reg[dc->r] = reg[dc->s] - reg[dc->t];
+        NEXT();
+
+    HANDLER(fxMUL)
+        reg[dc->r] = reg[dc->s]*reg[dc->t];
+        NEXT();
+
+    HANDLER(fxDIV)
+        if (reg[dc->t] == 0) STOPAT(srZERODIVIDE, dc->loc, dc->loc + 1);
+        reg[dc->r] = reg[dc->s]/reg[dc->t];
+        NEXT();
+
+    HANDLER(fxMOD)
+        if (reg[dc->t] == 0) STOPAT(srZERODIVIDE, dc->loc, dc->loc + 1);
+        v = reg[dc->s]%reg[dc->t];
+        if (v<0) v += llabs(reg[dc->t]);  // always return a nonnegative answer
+        reg[dc->r] = v;
+        NEXT();
+
+    HANDLER(fxAND)
+        reg[dc->r] = reg[dc->s]&reg[dc->t];
+        NEXT();
+
+    HANDLER(fxOR)
+        reg[dc->r] = reg[dc->s]|reg[dc->t];
+        NEXT();
+
+    HANDLER(fxXOR)
+        reg[dc->r] = reg[dc->s]^reg[dc->t];
+        NEXT();
+
+    HANDLER(fxNOT)
+        reg[dc->r] = ~reg[dc->s];
+        NEXT();
+
+    HANDLER(fxNEG)
+        reg[dc->r] = -reg[dc->s];
+        NEXT();
+
+    HANDLER(fxSWP)
+        if (reg[dc->r]>reg[dc->s]) {
+            v = reg[dc->r];
+            reg[dc->r] = reg[dc->s];
+            reg[dc->s] = v;
+        }
+        NEXT();
+
+    HANDLER(fxTLT)
+        reg[dc->r] = (reg[dc->s]<reg[dc->t] ? 1 : 0);
+        NEXT();
+
+    HANDLER(fxSLT)
+        if (reg[dc->r]>=0) reg[dc->r] = (reg[dc->s]<reg[dc->t] ? 1 : 0);
+        else reg[dc->r] = (reg[dc->t]<reg[dc->s] ? 1 : 0);
+        NEXT();
+
+    HANDLER(fxTLE)
+        reg[dc->r] = (reg[dc->s]<=reg[dc->t] ? 1 : 0);
+        NEXT();
+
+    HANDLER(fxTGT)
+        reg[dc->r] = (reg[dc->s]>reg[dc->t] ? 1 : 0);
+        NEXT();
+
+    HANDLER(fxSGT)
+        if (reg[dc->r]>=0) reg[dc->r] = (reg[dc->s]>reg[dc->t] ? 1 : 0);
+        else reg[dc->r] = (reg[dc->t]>reg[dc->s] ? 1 : 0);
+        NEXT();
+
+    HANDLER(fxTGE)
+        reg[dc->r] = (reg[dc->s]>=reg[dc->t] ? 1 : 0);
+        NEXT();
+
+    HANDLER(fxTEQ)
+        reg[dc->r] = (reg[dc->s]==reg[dc->t] ? 1 : 0);
+        NEXT();
+
+    HANDLER(fxTNE)
+        reg[dc->r] = (reg[dc->s]!=reg[dc->t] ? 1 : 0);
+        NEXT();
+
+    HANDLER(fxLD)
+        FASTLD(dc);
+        NEXT();
+
+    HANDLER(fxST)
+        FASTST(dc);
+        NEXT();
+
+    HANDLER(fxSTV)
+        FASTSTV(dc);
+        NEXT();
+
+    HANDLER(fxLDA)
+        reg[dc->r] = dc->d + reg[dc->s];
+        NEXT();
+
+    HANDLER(fxLDC)
+        reg[dc->r] = dc->d;
+        NEXT();
+
+    HANDLER(fxLDAFP)
+        v = reg[FP_REG];
+        reg[FP_REG] = dc->d + reg[dc->s];
+        if (reg[FP_REG] != v) frameMoved(m, v);
+        NEXT();
+
+    HANDLER(fxLDFP)
+        v = reg[FP_REG];
+        FASTLD(dc);
+        if (reg[FP_REG] != v) frameMoved(m, v);
+        NEXT();
+
+    HANDLER(fxJZR)
+        last = dc->loc;
+        if (reg[dc->r] == 0) JUMPTO(dc->d + reg[dc->s]);
+        JUMPTO(last + 1);
+
+    HANDLER(fxJNZ)
+        last = dc->loc;
+        if (reg[dc->r] != 0) JUMPTO(dc->d + reg[dc->s]);
+        JUMPTO(last + 1);
+
+    HANDLER(fxJMP)
+        last = dc->loc;
+        JUMPTO(dc->d + reg[dc->s]);
+
+    HANDLER(fxJZRK)
+        last = dc->loc;
+        if (reg[dc->r] == 0) CHAIN();
+        JUMPTO(last + 1);
+
+    HANDLER(fxJNZK)
+        last = dc->loc;
+        if (reg[dc->r] != 0) CHAIN();
+        JUMPTO(last + 1);
+
+    HANDLER(fxJMPK)
+        last = dc->loc;
+        CHAIN();
+
+    // Superinstructions.  The micro-ops of the instructions they
+    // stand for follow them in the block, so each does the work of
+    // its first instructions and goes on to the micro-op after them.
+
+    HANDLER(fxLDLDOP)
+        fuseRuns[fxLDLDOP]++;
+        FASTLD(dc);
+        FASTLD(dc + 1);
+        dc += 2;
+        REDISPATCH();
+
+    HANDLER(fxSTLD)
+        fuseRuns[fxSTLD]++;
+        FASTST(dc);
+        reg[dc[1].r] = dMem[a];
+        dc += 2;
+        REDISPATCH();
+
+    HANDLER(fxSTLDV)
+        fuseRuns[fxSTLDV]++;
+        FASTSTV(dc);
+        reg[dc[1].r] = dMem[a];
+        dc += 2;
+        REDISPATCH();
+
+    HANDLER(fxCALL)
+        fuseRuns[fxCALL]++;
+        reg[dc->r] = dc->d;
+        dc++;
+        last = dc->loc;
+        CHAIN();
+
+    HANDLER(fxLDLDJMP)         // the return pops a frame
+        fuseRuns[fxLDLDJMP]++;
+        v = reg[FP_REG];
+        FASTLD(dc);
+        FASTLD(dc + 1);
+        if (reg[FP_REG] != v) frameMoved(m, v);
+        dc += 2;
+        last = dc->loc;
+        JUMPTO(dc->d + reg[dc->s]);
+
+    HANDLER(fxIMEM)             // never in a block: enter checks the pc
+        STOPAT(srIMEM_ERR, dc->loc, dc->loc);
+
+    HANDLER(fxTRAP)             // always a block of its own
+        if (breakHit(m, dc->loc)) {
+            if (coverMap) coverStop(m, blk, dc->loc);
+            left += blk->d;
+            target = dc->loc;
+            goto trap;
+        }
+        m->pc = m->lastpc = last = dc->loc;
+        reg[PC_REG] = last + 1;
+        result = executeInstruction(m, &iMem[last]);
+        if (result != srOKAY) {
+            next = reg[PC_REG];
+            goto stopped;
+        }
+        JUMPTO(reg[PC_REG]);
+
+    // Unchecked mode.  The header records the block so that a fault in
+    // it can be found and its steps counted by guardFault().
+
+    HANDLER(fxBLOCKU)
+        if (left<dc->d) goto oneAtATime;
+        left -= dc->d;
+        blk = dc;
+        m->faultBlock = dc - m->blockCode;
+        m->faultLeft = left;
+        NEXT();
+
+    HANDLER(fxLDU)
+        FASTLDU(dc);
+        NEXT();
+
+    HANDLER(fxSTU)
+        FASTSTU(dc);
+        NEXT();
+
+    HANDLER(fxSTVU)
+        FASTSTVU(dc);
+        NEXT();
+
+    HANDLER(fxLDLDOPU)
+        fuseRuns[fxLDLDOP]++;
+        FASTLDU(dc);
+        FASTLDU(dc + 1);
+        dc += 2;
+        REDISPATCH();
+
+    HANDLER(fxSTLDU)
+        fuseRuns[fxSTLD]++;
+        FASTSTU(dc);
+        reg[dc[1].r] = dMem[a];
+        dc += 2;
+        REDISPATCH();
+
+    HANDLER(fxSTLDVU)
+        fuseRuns[fxSTLDV]++;
+        FASTSTVU(dc);
+        reg[dc[1].r] = dMem[a];
+        dc += 2;
+        REDISPATCH();
+
+    HANDLER(fxLDLDJMPU)
+        fuseRuns[fxLDLDJMP]++;
+        v = reg[FP_REG];
+        FASTLDU(dc);
+        FASTLDU(dc + 1);
+        if (reg[FP_REG] != v) frameMoved(m, v);
+        dc += 2;
+        last = dc->loc;
+        JUMPTO(dc->d + reg[dc->s]);
+
+    // Coverage.  The first entry marks the block and goes on as the
+    // header it now is.
+
+    HANDLER(fxBLOCKC)
+        if (left<dc->d) goto oneAtATime;
+        coverBlock(m, dc);
+        REDISPATCH();
+
+    // The JIT.  The header counts the block's entries until it is hot,
+    // then has it compiled and becomes fxJIT, or the plain header if it
+    // can't be.  fxJIT runs the code, which goes on from block to block
+    // until it has to come back (see jitBlock()).
+
+    HANDLER(fxBLOCKJ)
+        if (left<dc->d) goto oneAtATime;
+        if (++dc->next >= JIT_HOT) {
+            dc->op = (jitBlock(m, dc) ? fxJIT : blockHeader(m, FALSE));
+            REDISPATCH();
+        }
+        left -= dc->d;
+        blk = dc;
+        m->faultBlock = dc - m->blockCode;
+        m->faultLeft = left;
+        NEXT();
+
+    HANDLER(fxJIT)
+        if (left<dc->d) goto oneAtATime;
+        js.left = left;
+        js.last = last;
+        js.dirtyLow = dirtyLow;
+        js.dirtyHigh = dirtyHigh;
+        a = ((JITENTRY)(void *)m->jitCode)(m, &js, m->jitCode + m->jitAt[dc->loc]);
+        left = js.left;
+        last = js.last;
+        dirtyLow = js.dirtyLow;
+        dirtyHigh = js.dirtyHigh;
+        if (a == jitJUMP) {
+            jitSite = js.site;
+            JUMPTO(js.target);
+        }
+        dc = &m->blockCode[js.block];
+        if (a == jitSHORT) goto oneAtATime;
+        blk = dc;
+        dc = &m->blockCode[js.at];
+        if (a == jitFAULT) goto jitFault;
+        REDISPATCH();
+
+#ifndef TM_THREADED
+        default:
+            break;
+        }
+        continue;
+#endif
+
+    /* the pc is target.  Check it and find its block. */
+enter:
+    if (left == 0) goto outOfSteps;
+    if (target<0 || target>=iMemSize) {
+        result = srIMEM_ERR;
+        next = target;
+        goto finished;
+    }
+    b = m->blockAt[target];
+    if (b == 0 && (b = translateBlock(m, (int)target)) == 0) {
+        /* no room in the block cache: step this one instruction */
+        if (fastCode[target].op == fxTRAP && breakHit(m, (int)target)) goto trap;
+stepOne:
+        chain = -1;
+        m->pc = m->lastpc = last = (int)target;
+        reg[PC_REG] = target + 1;
+        left--;
+        if (coverMap) coverMap[last] = COVERED;
+        result = executeInstruction(m, &iMem[last]);
+        target = reg[PC_REG];
+        if (result != srOKAY) {
+            next = target;
+            goto finished;
+        }
+        goto enter;
+    }
+    if (chain >= 0) {
+        m->blockCode[chain].next = b;
+        chain = -1;
+    }
+    if (jitSite >= 0) {
+        if (m->jitAt[target]) jitLink(m, jitSite, (int)target);
+        jitSite = -1;
+    }
+    dc = &m->blockCode[b - 1];
+#ifdef TM_THREADED
+    REDISPATCH();
+#else
+    }
+#endif
+
+    /* fewer steps left than the block at dc is long */
+oneAtATime:
+    target = dc->loc;
+    while (left>0) {
+        if (target<0 || target>=iMemSize) {
+            result = srIMEM_ERR;
+            next = target;
+            goto finished;
+        }
+        if (fastCode[target].op == fxTRAP && breakHit(m, (int)target)) goto trap;
+        m->pc = m->lastpc = last = (int)target;
+        reg[PC_REG] = target + 1;
+        left--;
+        if (coverMap) coverMap[last] = COVERED;
+        result = executeInstruction(m, &iMem[last]);
+        target = reg[PC_REG];
+        if (result != srOKAY) {
+            next = target;
+            goto finished;
+        }
+    }
+
+outOfSteps:
+    result = srOKAY;
+    next = target;
+    goto finished;
+
+    /* the code of the JIT found that the instruction of dc stops the run */
+jitFault:
+    switch (fastCode[dc->loc].plain) {
+    case fxDIV:
+    case fxMOD:
+        STOPAT(srZERODIVIDE, dc->loc, dc->loc + 1);
+    case fxST:
+    case fxSTV:
+        a = dc->d + reg[dc->s];
+        m->pc = dc->loc;
+        STOPAT(setDMem(m, a, reg[dc->r]), dc->loc, dc->loc + 1);
+    default:
+        a = dc->d + reg[dc->s];
+        m->pc = dc->loc;
+        STOPAT(getDMem(m, a, &reg[dc->r]), dc->loc, dc->loc + 1);
+    }
+
+    /* the block at blk stopped at last: give back the steps after it */
+stopped:
+    left += blk->d - (last - blk->loc + 1);
+    if (coverMap) coverStop(m, blk, last + 1);
+    goto finished;
+
+    /* stopped by the breakpoint at target before its instruction */
+trap:
+    m->breakSkip = (int)target;
+    trapped = TRUE;
+    result = srHALT;
+    next = target;
+
+finished:
+    if (coverMap && m->coverFresh >= 0) coverSettle(m);
+    dirtyDMem(m, dirtyLow, dirtyHigh);
+    *count = total - left;
+    m->instrCount += *count;
+    m->pc = (result == srIMEM_ERR || trapped ? (int)next : last);
+    m->lastpc = last;
+    reg[PC_REG] = next;
+    m->tagflag = TRUE;
+
+    return result;
+}				/* runTM */
+
+#undef HANDLER
+#undef REDISPATCH
+#undef NEXT
+#undef STOPAT
+#undef JUMPTO
+#undef CHAIN
+#undef DIRTY
+#undef FASTLD
+#undef FASTST
+#undef FASTSTV
+#undef FASTLDU
+#undef FASTSTU
+#undef FASTSTVU
+
+
+/********************************************/
+/* unchecked mode.  dMem and dMemTag are moved into the middle of
+   mappings with GUARD_WORDS inaccessible words on each side, enough
+   for any int address, so the unchecked micro-ops can leave the bounds
+   checks to the MMU.  A fault in a guard region while runGuarded() runs
+   a machine jumps back to it and guardFault() turns the fault into the
+   stop the checks would have made.
+*/
+
+/* move count elements of memory from newMemory() into the middle of a
+   guarded mapping returned in *guard and *guardSize.  NULL if it can't
+   be done (mem is left alone). */
+static void *guardMemory(void *mem, size_t count, size_t size, char **guard, size_t *guardSize)
+{
+    size_t gap, bytes;
+    char *base;
+    int flags;
+
+    gap = GUARD_WORDS*size;
+    bytes = count*size;
+    flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+    base = (char *)mmap(NULL, 2*gap + bytes, PROT_NONE, flags, -1, 0);
+    if (base == MAP_FAILED) return NULL;
+
+#ifdef MREMAP_FIXED
+    if (mremap(mem, bytes, bytes, MREMAP_MAYMOVE | MREMAP_FIXED, base + gap) == MAP_FAILED)
+#endif
+    {
+        /* no mremap(): copy it */
+        if (mprotect(base + gap, bytes, PROT_READ | PROT_WRITE) != 0) {
+            munmap(base, 2*gap + bytes);
+            return NULL;
+        }
+        memcpy(base + gap, mem, bytes);
+        freeMemory(mem, count, size);
+    }
+
+    *guard = base;
+    *guardSize = 2*gap + bytes;
+    return base + gap;
+}
+
+
+static int guardDMem(TMMachine *m)
+{
+    long page;
+    void *mem;
+
+    page = sysconf(_SC_PAGESIZE);
+    if (page<=0 || (m->dMemSize*sizeof(long long int)) % page != 0) {
+        tmSetMessage(m, "ERROR: unchecked mode needs a data memory size that is a multiple of %ld words",
+                     (page>0 ? page/(long)sizeof(long long int) : 1L));
+        return FALSE;
+    }
+
+    if (m->dMemGuard == NULL) {
+        mem = guardMemory(m->dMem, m->dMemSize, sizeof(long long int), &m->dMemGuard, &m->dMemGuardSize);
+        if (mem == NULL) goto noRoom;
+        m->dMem = (long long int *)mem;
+    }
+    if (m->dMemTagGuard == NULL) {
+        mem = guardMemory(m->dMemTag, m->dMemSize, sizeof(int), &m->dMemTagGuard, &m->dMemTagGuardSize);
+        if (mem == NULL) goto noRoom;
+        m->dMemTag = (int *)mem;
+    }
+    return TRUE;
+
+noRoom:
+    tmSetMessage(m, "ERROR: unable to map the guard regions for unchecked mode");
+    return FALSE;
+}
+
+
+/* the machine runGuarded() is running on this thread and where to go
+   back to on a fault in its guard regions */
+static __thread TMMachine *guardedMachine;
+static __thread sigjmp_buf *guardedEnv;
+
+static pthread_once_t guardOnce = PTHREAD_ONCE_INIT;
+static struct sigaction oldSegv;
+
+static int inGuard(char *p, char *guard, size_t size)
+{
+    return guard && p>=guard && p<guard+size;
+}
+
+
+/* a SIGSEGV in the guard regions of the running machine goes back to
+   runGuarded().  Any other is passed on to the handler there was
+   before, or if there was none the fault happens again without one. */
+static void guardHandler(int sig, siginfo_t *info, void *context)
+{
+    TMMachine *m;
+    char *p;
+
+    m = guardedMachine;
+    p = (char *)info->si_addr;
+    if (m && (inGuard(p, m->dMemGuard, m->dMemGuardSize) || inGuard(p, m->dMemTagGuard, m->dMemTagGuardSize))) {
+        guardedMachine = NULL;
+        siglongjmp(*guardedEnv, 1);
+    }
+
+    if (oldSegv.sa_flags & SA_SIGINFO) oldSegv.sa_sigaction(sig, info, context);
+    else if (oldSegv.sa_handler != SIG_DFL && oldSegv.sa_handler != SIG_IGN) oldSegv.sa_handler(sig);
+    else signal(sig, SIG_DFL);
+}
+
+
+static void installGuardHandler(void)
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = guardHandler;
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, &oldSegv);
+}
+
+
+int tmSetUnchecked(TMMachine *m, int unchecked)
+{
+    if (unchecked) {
+        if (! guardDMem(m)) return FALSE;
+        pthread_once(&guardOnce, installGuardHandler);
+    }
+    m->uncheckedflag = (unchecked != 0);
+    m->fastCodeStale = TRUE;
+    return TRUE;
+}
+
+
+/* the run of runTM() given limit stopped with a fault in a guard
+   region.  The fault was in the block runTM() entered last.  Its LD and
+   ST are done in order and the registers their addresses come from are
+   not changed after them in the block (see endsUncheckedBlock()), so
+   the first one with an address out of bounds now is the one.  Stop
+   there as runTM() would have. */
+static STEPRESULT guardFault(TMMachine *m, long long int limit, long long int *count)
+{
+    MICROOP *blk;
+    DECODED *dc;
+    STEPRESULT result;
+    long long int total, left;
+    int loc, a;
+
+    blk = &m->blockCode[m->faultBlock];
+    dc = NULL;
+    a = 0;
+    for (loc = blk->loc; loc<blk->loc + blk->d; loc++) {
+        dc = &m->fastCode[loc];
+        if (! isLoadStore(dc)) continue;
+        a = dc->d + m->reg[dc->s];
+        if (a<0 || a>=m->dMemSize) break;
+    }
+    m->tagflag = TRUE;
+    if (loc == blk->loc + blk->d) {
+        tmSetMessage(m, "ERROR: unchecked mode fault in the block at addr %d not found", blk->loc);
+        *count = 0;
+        return srDMEM_READ_ERR;
+    }
+
+    /* what the stores of the run wrote was lost with runTM() */
+    dirtyDMem(m, 0, m->dMemSize - 1);
+
+    m->pc = m->lastpc = loc;
+    if (dc->plain == fxST || dc->plain == fxSTV) result = setDMem(m, a, m->reg[dc->r]);
+    else result = getDMem(m, a, &m->reg[dc->r]);
+
+    if (m->coverMap) {
+        coverStop(m, blk, loc + 1);
+        if (m->coverFresh >= 0) coverSettle(m);
+    }
+
+    total = (limit>0 ? limit : 0x7fffffffffffffffLL);
+    left = m->faultLeft + blk->d - (loc - blk->loc + 1);
+    *count = total - left;
+    m->instrCount += *count;
+    m->reg[PC_REG] = loc + 1;
+
+    return result;
+}
+
+
+/* runTM() with the guard regions of m watched if it is unchecked */
+static STEPRESULT runGuarded(TMMachine *m, long long int limit, long long int *count)
+{
+    sigjmp_buf env;
+    sigjmp_buf *outerEnv;
+    TMMachine *outer;
+    STEPRESULT result;
+
+    if (! m->uncheckedflag) return runTM(m, limit, count);
+
+    outer = guardedMachine;
+    outerEnv = guardedEnv;
+    if (sigsetjmp(env, 0)) {
+        guardedMachine = outer;
+        guardedEnv = outerEnv;
+        return guardFault(m, limit, count);
+    }
+    guardedEnv = &env;
+    guardedMachine = m;
+    result = runTM(m, limit, count);
+    guardedMachine = outer;
+    guardedEnv = outerEnv;
+
+    return result;
+}
+
+
+/* the wall and thread CPU clocks in seconds */
+static void readClocks(double *wall, double *cpu)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    *wall = t.tv_sec + t.tv_nsec*1e-9;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    *cpu = t.tv_sec + t.tv_nsec*1e-9;
+}
+
+
+/* count the time since readClocks() gave wall and cpu as running */
+static void addClocks(TMMachine *m, double wall, double cpu)
+{
+    double wallNow, cpuNow;
+
+    readClocks(&wallNow, &cpuNow);
+    m->stats.wallSeconds += wallNow - wall;
+    m->stats.cpuSeconds += cpuNow - cpu;
+}
+
+
+/* runGuarded() that stops every flameInterval instructions to sample the
+   call stack when sampling is on */
+STEPRESULT runSampled(TMMachine *m, long long int limit, long long int *count)
+{
+    STEPRESULT result;
+    long long int n, done, total;
+    double wall, cpu;
+
+    readClocks(&wall, &cpu);
+    if (!m->flameflag) {
+        result = runGuarded(m, limit, count);
+        addClocks(m, wall, cpu);
+        return result;
+    }
+
+    total = 0;
+    do {
+        n = m->flameLeft;
+        if (limit>0 && limit - total<n) n = limit - total;
+        result = runGuarded(m, n, &done);
+        total += done;
+        m->flameLeft -= done;
+        if (m->flameLeft<=0) {
+            sampleStack(m);
+            m->flameLeft = m->flameInterval;
+        }
+    } while (result == srOKAY && (limit == 0 || total<limit));
+    *count = total;
+    addClocks(m, wall, cpu);
+
+    return result;
+}
+
+
+/* a result that stops a run is described in the message unless the
+   code that found it already has */
+static STEPRESULT describeResult(TMMachine *m, STEPRESULT result)
+{
+    switch (result) {
+    case srIMEM_ERR:
+    case srZERODIVIDE:
+    case srOUTPUTLIMIT_ERR:
+        tmSetMessage(m, "%s at addr %d", stepResultTab[result], m->pc);
+        break;
+    default:
+        break;
+    }
+    return result;
+}
+
+
+STEPRESULT tmStep(TMMachine *m)
+{
+    return describeResult(m, stepTM(m));
+}
+
+
+/* runTM() does all the work unless there is a profile to keep or a
+   trace to write, then it is stepTM() */
+STEPRESULT tmRun(TMMachine *m, long long int limit, long long int *count)
+{
+    STEPRESULT result;
+    long long int start, done;
+    double wall, cpu;
+
+    start = m->instrCount;
+    if (m->profileflag || m->trace) {
+        readClocks(&wall, &cpu);
+        result = srOKAY;
+        while (result == srOKAY && (limit == 0 || m->instrCount - start<limit)) result = stepTM(m);
+        addClocks(m, wall, cpu);
+    }
+    else result = runSampled(m, limit, &done);
+    if (count) *count = m->instrCount - start;
+
+    return describeResult(m, result);
+}
+
+
+STEPRESULT tmRunToHalt(TMMachine *m, long long int *count)
+{
+    return tmRun(m, 0, count);
+}
+
+
+
+/********************************************/
+/* snapshots */
+
+TMSnapshot *tmSnapshot(TMMachine *m)
+{
+    TMSnapshot *snap;
+    int at, n, i, used, lo, hi;
+
+    snap = (TMSnapshot *)calloc(1, sizeof(TMSnapshot));
+    if (snap == NULL) return NULL;
+    snap->program = (m->program ? m->program : m);
+    snap->loads = snap->program->loads;
+    memcpy(snap->reg, m->reg, sizeof(m->reg));
+    snap->pc = m->pc;
+    snap->lastpc = m->lastpc;
+    snap->instrCount = m->instrCount;
+    snap->outputInstrCount = m->outputInstrCount;
+    snap->readOnlyLow = m->readOnlyLow;
+    snap->leanRan = m->leanRan;
+    memcpy(snap->fuseRuns, m->fuseRuns, sizeof(m->fuseRuns));
+    snap->stats = m->stats;
+
+    /* the chunks of dMem in use.  Outside the part a clear left LIT data
+       in or a run wrote all is zero. */
+    n = (m->dMemSize + SNAPSHOT_CHUNK - 1)/SNAPSHOT_CHUNK;
+    snap->chunkAt = (int *)malloc(n*sizeof(int));
+    if (snap->chunkAt == NULL) {
+        tmFreeSnapshot(snap);
+        return NULL;
+    }
+    usedDMem(m, &lo, &hi);
+    for (at = lo - lo%SNAPSHOT_CHUNK; at<=hi; at += SNAPSHOT_CHUNK) {
+        n = (m->dMemSize - at<SNAPSHOT_CHUNK ? m->dMemSize - at : SNAPSHOT_CHUNK);
+        used = FALSE;
+        for (i = at; i<at + n && !used; i++) used = (m->dMem[i] != 0 || m->dMemTag[i] != UNUSED);
+        if (used) snap->chunkAt[snap->chunks++] = at;
+    }
+    snap->dMem = (long long int *)malloc((snap->chunks ? snap->chunks : 1)*SNAPSHOT_CHUNK*sizeof(long long int));
+    snap->dMemTag = (int *)malloc((snap->chunks ? snap->chunks : 1)*SNAPSHOT_CHUNK*sizeof(int));
+    if (snap->dMem == NULL || snap->dMemTag == NULL) {
+        tmFreeSnapshot(snap);
+        return NULL;
+    }
+    for (i = 0; i<snap->chunks; i++) {
+        at = snap->chunkAt[i];
+        n = (m->dMemSize - at<SNAPSHOT_CHUNK ? m->dMemSize - at : SNAPSHOT_CHUNK);
+        memcpy(&snap->dMem[i*SNAPSHOT_CHUNK], &m->dMem[at], n*sizeof(long long int));
+        memcpy(&snap->dMemTag[i*SNAPSHOT_CHUNK], &m->dMemTag[at], n*sizeof(int));
+    }
+
+    return snap;
+}
+
+
+/* the block cache only depends on iMem so it is kept */
+int tmRestore(TMMachine *m, const TMSnapshot *snap)
+{
+    const TMMachine *program;
+    int i, at, n;
+
+    program = (m->program ? m->program : m);
+    if (snap->program != program || snap->loads != program->loads) {
+        tmSetMessage(m, "ERROR: the snapshot is of another program");
+        return FALSE;
+    }
+
+    memcpy(m->reg, snap->reg, sizeof(m->reg));
+    m->pc = snap->pc;
+    m->lastpc = snap->lastpc;
+    m->instrCount = snap->instrCount;
+    m->outputInstrCount = snap->outputInstrCount;
+    m->leanRan = snap->leanRan;
+    m->breakSkip = -1;
+    memcpy(m->fuseRuns, snap->fuseRuns, sizeof(m->fuseRuns));
+    m->stats = snap->stats;
+
+    resetDMem(m, FALSE);
+    for (i = 0; i<snap->chunks; i++) {
+        at = snap->chunkAt[i];
+        n = (m->dMemSize - at<SNAPSHOT_CHUNK ? m->dMemSize - at : SNAPSHOT_CHUNK);
+        memcpy(&m->dMem[at], &snap->dMem[i*SNAPSHOT_CHUNK], n*sizeof(long long int));
+        memcpy(&m->dMemTag[at], &snap->dMemTag[i*SNAPSHOT_CHUNK], n*sizeof(int));
+        dirtyDMem(m, at, at + n - 1);
+    }
+    m->readOnlyLow = snap->readOnlyLow;
+
+    return TRUE;
+}
+
+
+void tmFreeSnapshot(TMSnapshot *snap)
+{
+    if (snap == NULL) return;
+    free(snap->chunkAt);
+    free(snap->dMem);
+    free(snap->dMemTag);
+    free(snap);
+}
+
+
+
+
+
+/********************************************/
+/* the profile: the counts stepTM() keeps for each address folded onto
+   opcodes and the C- source lines and functions of the source map */
+
+typedef struct
+{
+    long long int count;
+    int index;
+} PROFILEENTRY;
+
+static int profileCompare(const void *a, const void *b)
+{
+    const PROFILEENTRY *pa = (const PROFILEENTRY *)a;
+    const PROFILEENTRY *pb = (const PROFILEENTRY *)b;
+
+    if (pa->count != pb->count) return (pa->count<pb->count ? 1 : -1);
+    return pa->index - pb->index;
+}
+
+
+/* put the indexes of the nonzero counts in order, hottest first, and
+   return how many there are */
+static int profileOrder(long long int *count, int n, int *order)
+{
+    PROFILEENTRY *entry;
+    int i, used;
+
+    entry = (PROFILEENTRY *)malloc((n>0 ? n : 1)*sizeof(PROFILEENTRY));
+    used = 0;
+    for (i = 0; i<n; i++) {
+        if (count[i] == 0) continue;
+        entry[used].count = count[i];
+        entry[used].index = i;
+        used++;
+    }
+    qsort(entry, used, sizeof(PROFILEENTRY), profileCompare);
+    for (i = 0; i<used; i++) order[i] = entry[i].index;
+    free(entry);
+    return used;
+}
+
+
+const char *profileFunc(TMMachine *m, int f)
+{
+    return (f>0 && f<m->funcCount ? m->funcName[f] : "-");
+}
+
+
+/* write the profile report.  Each table lists at most top entries
+   (0 means all of them). */
+void writeProfile(TMMachine *m, FILE *out, int top)
+{
+    long long int total, *lineCnt, *funcCnt, opCnt[opEND];
+    int *order, *lineFunc, maxLine, loc, i, k, n;
+    INSTRUCTION *in;
+
+    total = 0;
+    maxLine = 0;
+    for (loc = 0; loc<m->profileTop; loc++) {
+        total += m->iMemCount[loc];
+        if (m->iMemLine[loc]>maxLine) maxLine = m->iMemLine[loc];
+    }
+    lineCnt = (long long int *)calloc(maxLine + 1, sizeof(long long int));
+    lineFunc = (int *)calloc(maxLine + 1, sizeof(int));
+    funcCnt = (long long int *)calloc(m->funcCount, sizeof(long long int));
+    n = m->profileTop;
+    if (maxLine + 1>n) n = maxLine + 1;
+    if (m->funcCount>n) n = m->funcCount;
+    if (opEND>n) n = opEND;
+    order = (int *)malloc(n*sizeof(int));
+    for (i = 0; i<opEND; i++) opCnt[i] = 0;
+    for (loc = 0; loc<m->profileTop; loc++) {
+        if (m->iMemCount[loc] == 0) continue;
+        if (lineCnt[m->iMemLine[loc]] == 0) lineFunc[m->iMemLine[loc]] = m->iMemFunc[loc];
+        lineCnt[m->iMemLine[loc]] += m->iMemCount[loc];
+        funcCnt[m->iMemFunc[loc]] += m->iMemCount[loc];
+        opCnt[m->iMem[loc].iop] += m->iMemCount[loc];
+    }
+#define PERCENT(c) (total ? 100.0*(c)/total : 0.0)
+#define TOP(n) (top>0 && (n)>top ? top : (n))
+
+    fprintf(out, "PROFILE: %s: %lld instructions counted\n", m->pgmName, total);
+
+    fprintf(out, "\nFunctions\n%14s %7s  %s\n", "count", "%", "function");
+    n = profileOrder(funcCnt, m->funcCount, order);
+    for (i = 0; i<TOP(n); i++) {
+        k = order[i];
+        fprintf(out, "%14lld %6.2f%%  %s\n", funcCnt[k], PERCENT(funcCnt[k]), profileFunc(m, k));
+    }
+
+    fprintf(out, "\nLines\n%14s %7s %6s  %s\n", "count", "%", "line", "function");
+    n = profileOrder(lineCnt, maxLine + 1, order);
+    for (i = 0; i<TOP(n); i++) {
+        k = order[i];
+        if (k) fprintf(out, "%14lld %6.2f%% %6d  %s\n", lineCnt[k], PERCENT(lineCnt[k]), k, profileFunc(m, lineFunc[k]));
+        else fprintf(out, "%14lld %6.2f%% %6s  %s\n", lineCnt[k], PERCENT(lineCnt[k]), "-", "-");
+    }
+
+    fprintf(out, "\nAddresses\n%14s %7s %6s %6s  %-16s %s\n", "count", "%", "addr", "line", "function", "instruction");
+    n = profileOrder(m->iMemCount, m->profileTop, order);
+    for (i = 0; i<TOP(n); i++) {
+        k = order[i];
+        in = &m->iMem[k];
+        fprintf(out, "%14lld %6.2f%% %6d ", m->iMemCount[k], PERCENT(m->iMemCount[k]), k);
+        if (m->iMemLine[k]) fprintf(out, "%6d", m->iMemLine[k]);
+        else fprintf(out, "%6s", "-");
+        fprintf(out, "  %-16s %5s  ", profileFunc(m, m->iMemFunc[k]), opCodeTab[in->iop]);
+        if (opClass(in->iop) == opclRR) fprintf(out, "%lld,%lld,%lld", in->iarg1, in->iarg2, in->iarg3);
+        else fprintf(out, "%lld,%lld(%lld)", in->iarg1, in->iarg2, in->iarg3);
+        fprintf(out, "  %s\n", (m->iMemCmt[k] ? m->iMemCmt[k] : ""));
+    }
+
+    fprintf(out, "\nOpcodes\n%14s %7s  %s\n", "count", "%", "op");
+    n = profileOrder(opCnt, opEND, order);
+    for (i = 0; i<TOP(n); i++) {
+        k = order[i];
+        fprintf(out, "%14lld %6.2f%%  %s\n", opCnt[k], PERCENT(opCnt[k]), opCodeTab[k]);
+    }
+#undef PERCENT
+#undef TOP
+
+    free(lineCnt);
+    free(lineFunc);
+    free(funcCnt);
+    free(order);
+}
+
+
+/* write the per address counts as tab separated values, one row for
+   each address that ran */
+void writeProfileData(TMMachine *m, FILE *out)
+{
+    int loc;
+
+    fprintf(out, "addr\tcount\top\tline\tfunction\n");
+    for (loc = 0; loc<m->profileTop; loc++) {
+        if (m->iMemCount[loc] == 0) continue;
+        fprintf(out, "%d\t%lld\t%s\t%d\t%s\n", loc, m->iMemCount[loc], opCodeTab[m->iMem[loc].iop],
+                m->iMemLine[loc], profileFunc(m, m->iMemFunc[loc]));
+    }
+}
+
+
+/********************************************/
+/* call stack sampling.  The code c- generates keeps a chain of frames:
+   the caller's fp is at 0(fp) and the return address at -1(fp).  The
+   frames are walked from reg[1] and each return address names the
+   function it returns into.  For a few instructions of each call and
+   return the frame and fp are out of step and the instruction at the
+   pc tells where the missing part is:
+
+     LDA 3,1(7); JMP 7,f(7)   the new frame has no return address yet
+     ST 3,-1(1)               the return address is still in r3
+     JMP 7,0(3)               fp is already the caller's again
+*/
+
+/* record one sample of the call stack */
+void sampleStack(TMMachine *m)
+{
+    int *frames = m->flameFrames;
+    long long int *reg = m->reg;
+    long long int *dMem = m->dMem;
+    INSTRUCTION *iMem = m->iMem;
+    long long int fp, next, ret, at;
+    int depth, truncated, i;
+    unsigned int hash;
+    INSTRUCTION *in;
+    FLAMESTACK *fs;
+
+    /* leaf first: the function about to execute, then the callers */
+    depth = 0;
+    truncated = FALSE;
+    fp = reg[1];
+    ret = -1;
+    at = reg[PC_REG];
+    if (at>=0 && at<m->iMemSize) {
+        frames[depth++] = m->iMemFunc[at];
+        in = &iMem[at];
+        if ((in->iop == opLDA && in->iarg2 == 1 && in->iarg3 == PC_REG && at+1<m->iMemSize && iMem[at+1].iop == opJMP) ||
+            (in->iop == opJMP && in->iarg3 == PC_REG && at>0 && iMem[at-1].iop == opLDA && iMem[at-1].iarg3 == PC_REG)) {
+            if (fp>=0 && fp<m->dMemSize) fp = dMem[fp];
+        }
+        else if (in->iop == opST && in->iarg2 == -1 && in->iarg3 == 1) ret = reg[in->iarg1];
+        else if (in->iop == opJMP && in->iarg2 == 0 && in->iarg3 != PC_REG) {
+            at = reg[in->iarg3];
+            if (at>=0 && at<m->iMemSize) frames[depth++] = m->iMemFunc[at];
+        }
+    }
+    else frames[depth++] = 0;
+    while (fp>=1 && fp<m->dMemSize) {
+        next = dMem[fp];
+        if (ret<0) ret = dMem[fp-1];
+
+        /* frames are deeper in memory than their callers and return
+           just after the JMP of a call.  The first frame points at
+           itself. */
+        if (next<=fp || next>=m->dMemSize || ret<1 || ret>=m->iMemSize || iMem[ret-1].iop != opJMP) break;
+        if (depth == FLAME_DEPTH) {
+            truncated = TRUE;
+            break;
+        }
+        frames[depth++] = m->iMemFunc[ret];
+        fp = next;
+        ret = -1;
+    }
+
+    hash = depth*2 + truncated;
+    for (i = 0; i<depth; i++) hash = hash*31 + frames[i];
+    hash %= FLAME_HASH;
+    for (fs = m->flameTab[hash]; fs; fs = fs->next) {
+        if (fs->depth == depth && fs->truncated == truncated &&
+            memcmp(fs->frames, frames, depth*sizeof(int)) == 0) {
+            fs->count++;
+            return;
+        }
+    }
+    fs = (FLAMESTACK *)malloc(sizeof(FLAMESTACK));
+    fs->frames = (int *)malloc(depth*sizeof(int));
+    memcpy(fs->frames, frames, depth*sizeof(int));
+    fs->depth = depth;
+    fs->truncated = truncated;
+    fs->count = 1;
+    fs->next = m->flameTab[hash];
+    m->flameTab[hash] = fs;
+    m->flameStacks++;
+}
+
+
+/* write the sampled stacks one per line as "main;f;g count", root
+   first.  "..." stands for the frames of a stack too deep to record. */
+void writeSamples(TMMachine *m, FILE *out)
+{
+    FLAMESTACK *fs;
+    int i, k;
+
+    for (i = 0; i<FLAME_HASH; i++) {
+        for (fs = m->flameTab[i]; fs; fs = fs->next) {
+            if (fs->truncated) fprintf(out, "...;");
+            for (k = fs->depth-1; k>=0; k--) fprintf(out, "%s%s", profileFunc(m, fs->frames[k]), (k>0 ? ";" : ""));
+            fprintf(out, " %lld\n", fs->count);
+        }
+    }
+}
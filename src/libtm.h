@@ -0,0 +1,296 @@
+#ifndef LIBTM_H
+#define LIBTM_H
+
+// libtm: the Tiny Machine as a library
+//
+// A TMMachine is one whole machine: its memories, registers, limits,
+// counters, I/O and the decoded code the fast engine runs.  Nothing is
+// shared between machines, so a program can load and run any number of
+// them, each on its own thread.  A single machine must only be used by
+// one thread at a time.  tm.c (the interactive TM) and tm2c.c are built
+// on it.
+//
+// TO COMPILE: gcc -c libtm.c     (link with -pthread)
+//
+// A minimal client:
+//
+//     TMMachine *m = tmNew(0, 0);
+//     if (! tmLoadFile(m, "prog.tm")) puts(tmMessage(m));
+//     else if (tmRunToHalt(m, NULL) != srHALT) puts(tmMessage(m));
+//     tmFree(m);
+
+#include <stdio.h>
+
+// the version tm, tm2c and tmbatch report.  It moves with the history
+// at the top of tm.c.
+#define TM_VERSION "4.9q"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct TMMachine TMMachine;
+
+// why a step or a run stopped
+typedef enum
+{
+    srOKAY,                     // nothing yet (a run used up its limit)
+    srHALT,                     // HALT, a # after input or a breakpoint
+    srIMEM_ERR,
+    srDMEM_SET_ERR,
+    srDMEM_RONLY_ERR,
+    srDMEM_READ_ERR,
+    srZERODIVIDE,
+    srOUTPUTLIMIT_ERR,
+    srINPUT_ERR                 // the input callback had no value
+} STEPRESULT;
+
+// what the input instructions ask the input callback for
+typedef enum
+{
+    tmINPUT_INT,                // IN
+    tmINPUT_BOOL,               // INB
+    tmINPUT_CHAR                // INC
+} TMINPUTKIND;
+
+// what an input callback returns
+typedef enum
+{
+    tmINPUT_OK,
+    tmINPUT_HALT,               // the value is good and the machine halts after it
+    tmINPUT_ERROR               // no value: the step ends with srINPUT_ERR
+} TMINPUTSTATUS;
+
+// how program output is pushed out through the flush callback
+typedef enum
+{
+    omBLOCK,                    // when the stream wants, at HALT or before input
+    omLINE,                     // also at each newline written
+    omUNBUFFERED                // after every output instruction
+} OUTPUTMODE;
+
+// I/O callbacks.  Any that are NULL use the default: output is written
+// to the output file (stdout unless tmSetOutputFile() says otherwise)
+// and input is read as a stream of values from the input file (see
+// tmSetInputFile()).  An input callback that fails should say why with
+// tmSetMessage().
+typedef struct
+{
+    void *context;              // handed to every callback
+    TMINPUTSTATUS (*input)(TMMachine *m, void *context, TMINPUTKIND kind, long long int *value);
+    void (*write)(TMMachine *m, void *context, const char *text, int length);
+    void (*flush)(TMMachine *m, void *context);
+} TMIO;
+
+// machines.  Sizes of 0 give the default of 10000 words.  tmNew()
+// returns NULL if the memories cannot be mapped.
+TMMachine *tmNew(int iMemSize, int dMemSize);
+void tmFree(TMMachine *m);
+
+// a machine that runs the program loaded into program without a copy
+// of it: the instructions, comments and source map are shared read only
+// and everything a run changes is its own.  It starts, and tmClear()
+// puts it back, with the LIT data program was loaded with.  Any number
+// of machines on any threads can share one program as long as program
+// itself is not run, cleared, loaded or freed while they exist.
+// Loading a file into a sharing machine gives it its own program again.
+TMMachine *tmNewShared(TMMachine *program);
+
+// loading .tm text or a .tmb image from c- -B.  A load clears the
+// machine first.  They return 0 on failure and tmMessage() says why.
+int tmLoadFile(TMMachine *m, const char *fileName);
+int tmLoadBuffer(TMMachine *m, const char *name, const char *data, long size);
+
+// clear the registers, dMem (LIT data too) and the counters for a new
+// run of the loaded code.  The pc goes back to the entry point.
+// tmRerun() does the same but puts back the LIT data the program was
+// loaded with, so the code can run again without loading it again.
+// Both only redo the part of dMem written since the last clear, so they
+// cost what the run did and not what dMem is.
+void tmClear(TMMachine *m);
+void tmRerun(TMMachine *m);
+
+// execution.  tmStep() executes one instruction.  tmRun() executes up to
+// limit instructions (0 is no limit) exactly as that many tmStep() calls
+// would and puts the number executed in *count (count may be NULL).
+// After a result other than srOKAY and srHALT tmMessage() describes it.
+STEPRESULT tmStep(TMMachine *m);
+STEPRESULT tmRun(TMMachine *m, long long int limit, long long int *count);
+STEPRESULT tmRunToHalt(TMMachine *m, long long int *count);
+
+// state.  tmGetDMem() and tmSetDMem() return 0 for an address outside
+// dMem.  tmSetDMem() may write read only (LIT) locations.
+long long int tmGetReg(TMMachine *m, int r);
+void tmSetReg(TMMachine *m, int r, long long int value);
+int tmGetDMem(TMMachine *m, int addr, long long int *value);
+int tmSetDMem(TMMachine *m, int addr, long long int value);
+int tmIMemSize(TMMachine *m);
+int tmDMemSize(TMMachine *m);
+int tmPc(TMMachine *m);                       // address of the last instruction executed
+long long int tmInstructions(TMMachine *m);   // executed since the load or clear
+int tmOutputs(TMMachine *m);                  // output instructions since then
+
+// the statistics of the runs since the load or clear, for sizing dMem
+// and the limits.  The times are those spent in tmRun() (and the
+// runSampled() of tm).  The stack figures follow reg[1] as c- code
+// uses it: its first value is the bottom frame, lowering it pushes a
+// frame and raising it pops one.
+typedef struct
+{
+    long long int instructions;
+    int outputs;
+    double wallSeconds;
+    double cpuSeconds;          // CPU time of the running thread
+    double instructionsPerSecond;   // instructions/wallSeconds (0 if no time)
+    int frames;                 // reg[1] was set.  If not the next four are 0.
+    long long int stackWords;   // from the first frame pointer down to the lowest
+    long long int lowestFp;     // the lowest reg[1]
+    int callDepth;              // most frames on the stack at once
+    long long int globalWords;  // words above the first frame (globals and LIT)
+                                // from the lowest set or LIT one to the top
+    long long int movWords;     // words copied by MOV
+    long long int setWords;     // words set by SET
+    long long int coWords;      // words compared by CO and COA
+} TMSTATS;
+
+void tmGetStats(TMMachine *m, TMSTATS *stats);
+
+// settings
+void tmSetIO(TMMachine *m, const TMIO *io);   // NULL for the defaults
+int tmSetInputFile(TMMachine *m, const char *name);  // - is stdin, NULL none.  0 if it won't open
+void tmSetOutputFile(TMMachine *m, FILE *out);
+void tmSetOutputMode(TMMachine *m, OUTPUTMODE mode);
+void tmSetOutputLimit(TMMachine *m, int limit);       // 0 is no limit
+void tmSetSeed(TMMachine *m, unsigned int seed);      // for RND
+void tmSetLean(TMMachine *m, int lean);               // see the m command of tm
+
+// unchecked mode.  dMem is moved into a mapping with inaccessible guard
+// regions on both sides, large enough for any address an instruction
+// can form, and the fast engine does LD and ST without bounds checks.
+// A fault in a guard region stops the run with the same result and
+// message the checks give.  Only programs that pass tmVerify() run
+// unchecked.  The data memory size must be a whole number of pages
+// (a multiple of 512 words with 4K pages).  tmSetUnchecked() returns 0
+// and tmMessage() says why if the mode cannot be used.  It handles
+// SIGSEGV while such a machine runs and passes on other faults.
+int tmSetUnchecked(TMMachine *m, int unchecked);
+
+// the JIT.  tmRun() compiles the blocks of the fast engine that run
+// often into x86-64 code, which goes straight from block to block.  The
+// code counts its steps and checks every dMem address, LIT store and
+// division as the engine does, and hands the I/O, RND and block
+// (MOV, SET, CO and COA) instructions back to it, so a run has the same
+// results, messages and counts either way.  tmSetJit() returns 0 and
+// tmMessage() says why if it can't be used (it needs x86-64 Linux and
+// memory that can be mapped executable); the machine then goes on
+// without it.
+int tmSetJit(TMMachine *m, int jit);
+
+// the binary trace.  tmTraceFile() records every instruction the machine
+// steps from now on in fileName: its address, the registers it changed
+// and the dMem word it named (see tmTrace.h).  The file is mapped, so
+// what is recorded is in it even if the process dies.  ring keeps only
+// the last ring records (one per instruction, plus one for registers
+// changed between instructions); 0 lets the file grow.  A NULL fileName
+// ends the trace.  It returns 0 and tmMessage() says why if the file
+// cannot be written.  tmRun() steps while tracing, like with a profile.
+// tmtrace turns a trace into the text of the t(race command of tm.
+int tmTraceFile(TMMachine *m, const char *fileName, long long int ring);
+long long int tmTraceRecords(TMMachine *m);   // written so far (0 if not tracing)
+
+// coverage.  tmSetCoverage() marks each address of iMem the machine
+// executes from now on.  A clear keeps the marks, so they gather all
+// the runs since coverage was turned on; a load or turning it off
+// drops them.  tmRun() runs at full speed: the fast engine marks a
+// block the first time it enters it and then runs it as before.
+// tmAddCoverage() adds the marks of from to those of m, which must
+// share its program (see tmNewShared()) or be the machine sharing it.
+// Source lines and functions come from the "* Line n:" and "* FUNCTION"
+// comments c- writes: a line or function is hit if any instruction of
+// it ran.  tmWriteCoverage() writes one lcov tracefile record for the
+// program, named as its c- source (prog.tm is prog.c-) and testName
+// (NULL none).  lcov -a merges the files of separate processes.
+typedef struct
+{
+    int instructions;           // addresses loaded
+    int instructionsHit;
+    int lines;                  // source lines with instructions
+    int linesHit;
+    int functions;              // functions with a source line
+    int functionsHit;
+} TMCOVERAGE;
+
+int tmSetCoverage(TMMachine *m, int on);      // 0 and tmMessage() says why if no memory
+int tmAddCoverage(TMMachine *m, TMMachine *from);   // 0 if they don't share a program
+void tmGetCoverage(TMMachine *m, TMCOVERAGE *coverage);   // all 0 if coverage is off
+void tmWriteCoverage(TMMachine *m, FILE *out, const char *testName);
+
+// the verifier.  Loading checks that every instruction has a TM opcode
+// and registers, and that every jump with a target known at load time
+// lands in iMem.  tmVerify() returns 0 and tmMessage() describes the
+// first instruction that fails.  Such a program runs, but with checks.
+int tmVerify(TMMachine *m);
+
+// breakpoints.  A run stops with srHALT before it executes the
+// instruction at a breakpoint whose condition holds and goes on past it
+// when it is run again.  There can be any number of them, one to an
+// address.  The instruction at a breakpoint is replaced by a trap in
+// the code the fast engine runs, so the others run at full speed.
+typedef enum
+{
+    tmALWAYS,                   // no condition
+    tmEQ,                       // the value compared is ==, !=, <, <=, > or >= value
+    tmNE,
+    tmLT,
+    tmLE,
+    tmGT,
+    tmGE
+} TMCOMPARE;
+
+typedef struct
+{
+    int addr;                   // stop before the instruction here
+    TMCOMPARE compare;
+    int reg;                    // compare register reg or, if it is -1,
+    int base;                   // dMem[offset + register base] (base -1: dMem[offset])
+    long long int offset;
+    long long int value;
+} TMBREAKPOINT;
+
+// tmAddBreakpoint() replaces any breakpoint at the same address.  It
+// returns 0 and tmMessage() says why if bp is not a good one.
+// tmRemoveBreakpoint() returns 0 if there was none at addr; -1 removes
+// them all.  tmBreakpoint() gives them in address order, NULL past the
+// last.  tmSetBreakpoint() adds one with no condition (-1 removes all).
+int tmAddBreakpoint(TMMachine *m, const TMBREAKPOINT *bp);
+int tmRemoveBreakpoint(TMMachine *m, int addr);
+int tmBreakpoints(TMMachine *m);
+const TMBREAKPOINT *tmBreakpoint(TMMachine *m, int i);
+const TMBREAKPOINT *tmBreakpointAt(TMMachine *m, int addr);   // NULL if none
+void tmSetBreakpoint(TMMachine *m, int addr);
+
+// where main is entered in code from c-: the target of the JMP its
+// init code makes to main.  -1 if there is none.
+int tmMainEntry(TMMachine *m);
+
+// snapshots of the state of a run: the registers, dMem, the pc and the
+// counters.  Not the program, the settings, the position in the input,
+// the RND generator or the profile.  A snapshot can be restored into
+// the machine it was taken from or any machine sharing the same
+// program (see tmNewShared()) as long as it has not loaded another
+// since.  tmRestore() returns 0 and tmMessage() says why if it can't.
+typedef struct TMSnapshot TMSnapshot;
+TMSnapshot *tmSnapshot(TMMachine *m);         // NULL if out of memory
+int tmRestore(TMMachine *m, const TMSnapshot *snap);
+void tmFreeSnapshot(TMSnapshot *snap);
+
+// messages
+const char *tmMessage(TMMachine *m);
+void tmSetMessage(TMMachine *m, const char *format, ...);
+const char *tmResultText(STEPRESULT result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -76,6 +76,7 @@ int main(int argc, char* argv[])
 				printf("-p \t- print the abstract syntax tree\n");
 				printf("-P \t- print the abstract syntax tree plus type information\n");
 				printf("-M \t- print the abstract syntax tree plus type and memory information\n");
+				printf("-B \t- also write the code as a binary TM image (.tmb)\n");
 				return 0;
 			}
 			// enables ast printing
@@ -104,6 +105,11 @@ int main(int argc, char* argv[])
 			{
 				printMemTree = true;
 			}
+			// enables writing the binary TM image
+			else if (strcmp(argv[i], "-B") == 0)
+			{
+				binaryImage = true;
+			}
 			// unknown option
 			else
 			{
@@ -6,6 +6,70 @@
 //
 // Transmogrifier: Dr. Robert Heckendorn, University of Idaho (should be rewritten)
 
+// v4.9q   --jit and j(it compile the hot blocks of g(o to x86-64 code.
+//           The results, messages and counts are those of the engine.
+//           See tmSetJit() and jitBlock().  SLT and SGT with a negative r
+//           compare reg[t] with reg[s] rather than negating both, which
+//           overflowed for LLONG_MIN.  make check runs tmcheck.
+// v4.9p   the decoded code is packed (16 byte micro-ops with a 32 bit d)
+//           and instruction comments are kept in iMemCmt, apart from the
+//           code.  dMem no longer keeps comments: d finds them from the
+//           tags.  tmbench.c times the engine on large loops by default.
+// v4.9o   c r(erun) clears for another run but keeps the LIT data.  Clears
+//           only zero what the runs since the last one wrote.  See tmRerun().
+// v4.9n   --coverage and y(coverage mark each address as it runs, over
+//           all runs since, and write lcov line and function coverage
+//           from the * Line comments.  See tmSetCoverage().
+// v4.9m   --trace and t file record a binary trace of every instruction
+//           into a mapped file, optionally a ring of the last n.  tmtrace.c
+//           prints it as t(race would.  See tmTraceFile().
+// v4.9l   e(xecStats and the --json summary give the run time, the peak
+//           stack and call depth, the globals and LIT in use and the
+//           words MOV, SET and CO handled.  See tmGetStats().
+// v4.9k   -U runs verified programs unchecked: LD and ST leave their
+//           bounds to guard pages around dMem.  Loading verifies the
+//           program.  See tmSetUnchecked() and runGuarded().
+// v4.9j   any number of breakpoints, with conditions on a register or a
+//           dMem location.  They are traps patched into the decoded code
+//           so g(o runs the fast engine with them set.  See patchTrap().
+// v4.9i   z(snapshot saves and restores the state of a run.  z m runs the
+//           init code to main first.  tmbatch --snapshot-main starts
+//           each run at main.  See tmSnapshot().
+// v4.9h   tmbatch.c runs batches of programs in parallel.  Machines made
+//           by tmNewShared() share one load of a program.
+// v4.9g   the machine is in libtm (libtm.c, libtm.h): each TMMachine has
+//           its own state so a program can run many.  tm is its command
+//           line client.
+// v4.9f   runTM() runs basic blocks translated once into a block cache.
+//           Each block checks the pc and counts its instructions once.
+//           See translateBlock().
+// v4.9e   tm2c.c translates TM programs to C.
+// v4.9d   --flame samples the call stack by walking the frame pointer
+//           chain and writes collapsed stacks for flame graph tools.
+//           See sampleStack().
+// v4.9c   k(ount, --profile and --profile-tsv count the executions of each
+//           address and fold them onto C- lines and functions.  See
+//           writeProfile().
+// v4.9b   --run loads a program, runs it to the end and exits with a
+//           status for the result.  --json writes a summary.  See runExit().
+// v4.9a   the .tm loader reads the whole file and scans it in place with
+//           a hashed opcode lookup (see readText()).  Comments stay in the
+//           file buffer.  tmbench -l times it.
+// v4.9    loads the binary images written by c- -B.  See readImage().
+// v4.8d   -i streams input for IN, INB and INC from a file.  See streamInput().
+// v4.8c   output instructions no longer flush stdout every time.  See
+//           outputDone() and the w(riteMode command.
+// v4.8b   MOV, SET, CO and COA check the whole block once and then
+//           copy, fill or compare it directly.
+// v4.8a   lean mode (-L or m) where go only keeps dMem values, not the
+//           provenance in dMemTag and dMemCmt.  tmbench.c times go's
+//           stores both ways.
+// v4.8    -I and -D set the instruction and data memory sizes.  The
+//           memories are mapped at startup and only committed as touched.
+// v4.7a   the loader fuses common code generator idioms into
+//           superinstructions for runTM().  f(useStats reports them.
+// v4.7    g(o runs a pre-decoded, direct threaded copy of iMem when no
+//           breakpoint or tracing is on.  See runTM().
 // v4.6a    R0=addr of top of Dmem, LIT loads at top of mem at minus addr for LIT instruction from R0
 //           this sets up for indexing literals from global space like any other memory
 // v4.5d   make C language compliant
@@ -72,159 +136,106 @@
 //
 // v1.0 Kenneth C. Louden's original
 //
-// TO COMPILE: gcc tm.c -o tm
+// TO COMPILE: make tm     (or gcc tm.c libtm.c -o tm -pthread)
+// TO RUN:     tm [-I imemsize] [-D dmemsize] [-L] [-U] [-W b|l|u] [file]
+//             -L starts in lean mode (see the m command)
+//             -U runs unchecked: the fast engine leaves the dMem bounds of
+//                LD and ST to guard pages.  Programs that fail the load
+//                time verifier still run checked.  dmemsize must be a
+//                multiple of the page size in words (e.g. -D 10240)
+//             -W sets how program output is buffered (see the w command)
+//             -i reads IN, INB and INC from inputfile (- is stdin) as a
+//                stream of values, -e echoes each IN and INB value read
+//             file is .tm text or a .tmb binary image from c- -B
+//
+//             tm --run [--limit n] [--output-limit n] [--seed n] [--json file]
+//                [-I imemsize] [-D dmemsize] [-L] [-U] [-W b|l|u] [-i inputfile [-e]] file
+//             runs file without the command loop.  Only the program's own
+//             output goes to stdout.  Input comes from stdin unless -i is
+//             given.  --limit and --output-limit are the a and o limits
+//             (0 is no limit, the default with --run).  --seed seeds RND
+//             (1 with --run).  --json writes a summary (- is stdout).
+//             Exit status: 0 halted, 1 not run (usage, load or input
+//             error), 2-7 the STEPRESULT of the fault, 8 instruction limit.
+//
+//             --profile file writes an execution profile report to file
+//             when tm exits and --profile-tsv file writes the per address
+//             counts as tab separated values (see the k command)
+//
+//             --flame file samples the call stack every n instructions
+//             (--flame-interval n, default 1000) and writes the stacks in
+//             the collapsed "main;f;g count" form flame graph tools read
+//
+//             --trace file records every instruction executed in a binary
+//             trace (--trace-ring n keeps only the last n records).
+//             tmtrace file prints it in the form of the t command.
+//
+//             --coverage file writes the lines and functions of the
+//             program run since the load as an lcov tracefile at exit
+//             (see the y command)
+//
+//             --jit compiles the blocks g(o runs often to x86-64 code
+//             (see the j command)
 //
-
-char *versionNumber =(char *)"TM version 4.6a";
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
-#include <sys/types.h>
 #include <unistd.h>
+#include <time.h>
+#include "tmMachine.h"
+
+char *versionNumber =(char *)"TM version " TM_VERSION;   // TM_VERSION is in libtm.h
 
-#ifndef TRUE
-#define TRUE 1
-#endif
-#ifndef FALSE
-#define FALSE 0
-#endif
 #define UP +1
 #define DOWN -1
 #define TRACE 1
 #define NOTRACE 0
-#define USED 1
-#define UNUSED -1
-#define READONLY -2
 
 /******* const *******/
-#define   IADDR_SIZE  10000	/* increase for large programs */
-#define   DADDR_SIZE  10000	/* increase for large programs */
-#define   NO_REGS 8
-#define   PC_REG  7
-
-#define   LINESIZE  200
-#define   WORDSIZE  1000        /* maximum length of a word of text */
 #define   DEFAULT_ABORT_LIMIT 50000
-#define   DEFAULT_OUTPUT_LIMIT 1000
-
-/******* type  *******/
-
-// classes of op codes by format
-typedef enum
-{
-    opclRR,			/* reg operands r, s, t */
-    opclRA,			/* reg r, int d+s */
-    opclLIT                     /* literal command */
-} OPCLASS;
-
-// list of all of the op codes
-typedef enum
-{
-    // RR instructions 
-    opHALT,			// RR     halt, operands are ignored 
-    opNOP,			// RR     no op, operands are ignored 
-    opIN,			// RR     read integer into reg(r); s and t are ignored 
-    opINB,			// RR     read bool into reg(r); s and t are ignored 
-    opINC,			// RR     read char into reg(r); s and t are ignored 
-    opOUT,			// RR     write integer from reg(r), s and t are ignored 
-    opOUTB,			// RR     write bool from reg(r), s and t are ignored 
-    opOUTC,			// RR     write char from reg(r), s and t are ignored 
-    opOUTNL,			// RR     write newline regs r, s and t are ignored 
-    opADD,			// RR     reg(r) = reg(s)+reg(t) 
-    opSUB,			// RR     reg(r) = reg(s)-reg(t) 
-    opMUL,			// RR     reg(r) = reg(s)*reg(t) 
-    opDIV,			// RR     reg(r) = reg(s)/reg(t) 
-    opMOD,			// RR     reg(r) = reg(s)%reg(t) 
-    opAND,			// RR     reg(r) = reg(s)&reg(t) 
-    opOR,			// RR     reg(r) = reg(s)|reg(t) 
-    opXOR,			// RR     reg(r) = reg(s)^reg(t) 
-    opNOT,			// RR     reg(r) = ~reg(s) 
-    opNEG,			// RR     reg(r) = -reg(s) 
-    opSWP,			// RR     reg[r] = min(reg[r], reg[s]), reg[s] = max(reg[r], reg[s])  
-    opRND,			// RR     reg[r] = random(0, abs(reg[s])) 
-
-    opTLT,			// RR     if reg(s)<reg(t) then reg(r) = 1  else reg(r) = 0 
-    opSLT,			// RR     if (reg[r]>=0) reg[r] = (reg[s]<reg[t] ? 1 : 0); else reg[r] = (-reg[s] < -reg[t] ? 1 : 0);
-    opTLE,			// RR     if reg(s)<=reg(t) then reg(r) = 1  else reg(r) = 0 
-    opTGT,			// RR     if reg(s)>reg(t) then reg(r) = 1  else reg(r) = 0 
-    opSGT,	                // RR     if (reg[r]<=0) reg[r] = (reg[s]>reg[t] ? 1 : 0); else reg[r] = (-reg[s] > -reg[t] ? 1 : 0);
-    opTGE,			// RR     if reg(s)>=reg(t) then reg(r) = 1  else reg(r) = 0 
-    opTEQ,			// RR     if reg(s)==reg(t) then reg(r) = 1  else reg(r) = 0 
-    opTNE,			// RR     if reg(s)!=reg(t) then reg(r) = 1  else reg(r) = 0 
-
-    opMOV,                      // RR     dMem[reg[r] + (0..reg[t]-1)] = dMem[reg[s] + (0..reg[t]-1)] 
-    opSET,                      // RR     dMem[reg[r] + (0..reg[t]-1)] = reg[s] 
-    opCO,                       // RR     compare memory instruction
-    opCOA,                      // RR     compare memory instruction returning address
-    opRRLim,			// limit of RR opcodes 
-
-    // RA instructions 
-    opLD,			// RM     reg(r) = mem(d+reg(s)) 
-    opST,			// RM     mem(d+reg(s)) = reg(r) 
-    opLDA,			// RA     reg(r) = d+reg(s) 
-    opLDC,			// RA     reg(r) = d ; reg(t) is ignored 
-    opJZR,			// RA     if reg(r)==0 then reg(7) = d+reg(s) 
-    opJNZ,			// RA     if reg(r)!=0 then reg(7) = d+reg(s) 
-    opJMP,                      // RA     reg(7) = d+reg(s) 
-
-    opRALim,                    // limit of RA opcodes
-    opLIT,                      // the special litteral op code
-
-    opEND			// Limit of RA opcodes 
-} OPCODE;
-
-typedef enum
-{
-    srOKAY,
-    srHALT,
-    srIMEM_ERR,
-    srDMEM_SET_ERR,
-    srDMEM_RONLY_ERR,
-    srDMEM_READ_ERR,
-    srZERODIVIDE,
-    srOUTPUTLIMIT_ERR
-} STEPRESULT;
-
-/* needs to do a better job of producing error messages */
-char *stepResultTab[] = {
-    (char *)"OK",
-    (char *)"Halted",
-    (char *)"ERROR: Instruction Memory Fault",
-    (char *)"ERROR: Set Data Memory Range Fault",
-    (char *)"ERROR: Set of Readonly Data Memory",
-    (char *)"ERROR: Read Data Memory Range Fault",
-    (char *)"ERROR: Division by 0",
-    (char *)"ERROR: Output Instruction Limit Exceeded"
+#define   OUTPUT_BUFFER_SIZE (1<<16)  /* stdout buffer for TM program output */
+#define   RUN_FAIL_STATUS 1           /* --run exit status when nothing could run */
+#define   RUN_LIMIT_STATUS 8          /* --run exit status at the instruction limit */
+
+char *outputModeTab[] = {
+    (char *)"block",
+    (char *)"line",
+    (char *)"unbuffered"
 };
 
+// result names in the --json summary.  --run only stops with srOKAY
+// when it reaches its instruction limit.
+char *stepResultKey[] = {
+    (char *)"instruction_limit",
+    (char *)"halted",
+    (char *)"imem_fault",
+    (char *)"dmem_set_fault",
+    (char *)"dmem_readonly_fault",
+    (char *)"dmem_read_fault",
+    (char *)"zero_divide",
+    (char *)"output_limit",
+    (char *)"input_error"
+};
 
-/* The structure for a instruction  */
-typedef struct
-{
-    int iop;
-    long long int iarg1;
-    long long int iarg2;
-    long long int iarg3;
-    char *comment;
-} INSTRUCTION;
 
 /******** GLOBAL VARIABLES ********/
+TMMachine *tm;             // the machine being debugged (see libtm.c)
 int iloc = 0;
 int dloc = 0;
 int promptflag = TRUE;
 int traceflag = FALSE;
 int icountflag = FALSE;
 int abortLimit = DEFAULT_ABORT_LIMIT;
-int outputLimit = DEFAULT_OUTPUT_LIMIT;
+char outputBuffer[OUTPUT_BUFFER_SIZE];
 int stepcnt;
-int pc, lastpc;
-int savedbreakpoint, breakpoint;
-char *emptyString = (char *)"";
-char pgmName[WORDSIZE];
-int instrCount = 0;
-int outputInstrCount = 0;
+int runflag = FALSE;       // --run: run the program and exit, no command loop
+int uncheckedflag = FALSE; // -U: run verified programs unchecked
+int jitflag = FALSE;       // --jit: compile hot blocks
+long long int runLimit = 0;     // --run instruction limit (0 is none)
+double runStart;           // when --run started the program
+char *jsonName = NULL;     // --json summary file (- is stdout)
 int dmemStart = 0;
 int dmemCount = 0;
 int dmemDown = +1;
@@ -232,62 +243,15 @@ int imemStart = 0;
 int imemCount = 0;
 int imemDown = +1;
 
-INSTRUCTION iMem[IADDR_SIZE];
-int iMemTag[IADDR_SIZE];
-long long int dMem[DADDR_SIZE];
-int dMemTag[DADDR_SIZE];   // if >= 0 then last address modified, == -1 unused, == -2 read/only
-char *dMemCmt[DADDR_SIZE];
-long long int reg[NO_REGS];
+char *profileName = NULL;         // --profile report file
+char *profileDataName = NULL;     // --profile-tsv data file
+char *flameName = NULL;           // --flame output file
+char *traceName = NULL;           // --trace file
+long long int traceRing = 0;      // --trace-ring
+char traceFile[WORDSIZE];         // the binary trace being written (--trace or t file)
+char *coverageName = NULL;        // --coverage lcov file
+TMSnapshot *snapshot = NULL;      // z(snapshot
 
-char *opCodeTab[100];
-
-void initOpCodeTab()
-{
-    opCodeTab[(int)opHALT] = (char *)"HALT";
-    opCodeTab[(int)opNOP] = (char *)"NOP";
-    opCodeTab[(int)opIN] = (char *)"IN";
-    opCodeTab[(int)opINB] = (char *)"INB";
-    opCodeTab[(int)opINC] = (char *)"INC";
-    opCodeTab[(int)opOUT] = (char *)"OUT";
-    opCodeTab[(int)opOUTB] = (char *)"OUTB";
-    opCodeTab[(int)opOUTC] = (char *)"OUTC";
-    opCodeTab[(int)opOUTNL] = (char *)"OUTNL";
-    opCodeTab[(int)opADD] = (char *)"ADD";
-    opCodeTab[(int)opSUB] = (char *)"SUB";
-    opCodeTab[(int)opMUL] = (char *)"MUL";
-    opCodeTab[(int)opDIV] = (char *)"DIV";
-    opCodeTab[(int)opMOD] = (char *)"MOD";
-    opCodeTab[(int)opAND] = (char *)"AND";
-    opCodeTab[(int)opOR] = (char *)"OR";
-    opCodeTab[(int)opXOR] = (char *)"XOR";
-    opCodeTab[(int)opNOT] = (char *)"NOT";
-    opCodeTab[(int)opNEG] = (char *)"NEG";
-    opCodeTab[(int)opSWP] = (char *)"SWP";
-    opCodeTab[(int)opRND] = (char *)"RND";
-    opCodeTab[(int)opTLT] = (char *)"TLT";
-    opCodeTab[(int)opSLT] = (char *)"SLT";
-    opCodeTab[(int)opTLE] = (char *)"TLE";
-    opCodeTab[(int)opTGT] = (char *)"TGT";
-    opCodeTab[(int)opSGT] = (char *)"SGT";
-    opCodeTab[(int)opTGE] = (char *)"TGE";
-    opCodeTab[(int)opTEQ] = (char *)"TEQ";
-    opCodeTab[(int)opTNE] = (char *)"TNE";
-    opCodeTab[(int)opMOV] = (char *)"MOV";
-    opCodeTab[(int)opSET] = (char *)"SET";
-    opCodeTab[(int)opCO] = (char *)"CO";
-    opCodeTab[(int)opCOA] = (char *)"COA";
-    opCodeTab[(int)opRRLim] = (char *)"RRLim";
-    opCodeTab[(int)opLD] = (char *)"LD";
-    opCodeTab[(int)opST] = (char *)"ST";
-    opCodeTab[(int)opLDA] = (char *)"LDA";
-    opCodeTab[(int)opLDC] = (char *)"LDC";
-    opCodeTab[(int)opJZR] = (char *)"JZR";
-    opCodeTab[(int)opJNZ] = (char *)"JNZ";
-    opCodeTab[(int)opJMP] = (char *)"JMP";
-    opCodeTab[(int)opRALim] = (char *)"RALim";
-    opCodeTab[(int)opLIT] = (char *)"LIT";
-    opCodeTab[(int)opEND] = (char *)"END OF OPCODES";
-}
 
 char *niceStringIn(char *s)
 {
@@ -328,7 +292,7 @@ char *niceStringIn(char *s)
     return t;
 }
 
-char *niceStringOut(char *s) 
+char *niceStringOut(char *s)
 {
     int len;
     char *t;
@@ -388,944 +352,411 @@ char *niceChar(int n) {
 }
 
 
-/* The ad hoc scanner's global state */
-char in_Line[LINESIZE];
-char *in_LinePtr;
-int lineLen;
-int inCol;
-long long int num;
-char word[WORDSIZE];
-int wordset;  // bool that says if word was set last (truly horrible, needs total rewrite)
-char ch;
+/* The command scanner.  main() points its in_Line at lineBuffer, which
+   also holds the lines typed for IN, INB and INC when there is no -i. */
+char lineBuffer[LINESIZE];
+TMSCAN scan;
 /********************************************/
 
 void printVersion()
 {
     printf("%s (enter h for help)\n", versionNumber);
-    printf("Data Addresses: 0-%d\n", DADDR_SIZE-1);
-    printf("Instruction Addresses: 0-%d\n", IADDR_SIZE-1);
+    printf("Data Addresses: 0-%d\n", tm->dMemSize-1);
+    printf("Instruction Addresses: 0-%d\n", tm->iMemSize-1);
     printf("Instruction Execution Limit: %d\n", abortLimit);
-    printf("Output Instruction Limit: %d\n", outputLimit);
+    printf("Output Instruction Limit: %d\n", tm->outputLimit);
     fflush(stdout);
 }
 
 
-STEPRESULT setDMem(int m, long long int value) {
-//    printf("setDMem: %d %lld\n", m, value);
-    if (dMemTag[m]==READONLY) {
-        printf("ERROR(setDMem): instruction at addr %d attempting to set data memory marked as read only at loc: %d\n", pc, m);
-        exit(1);
-    }
-    if (m<0 ||  m>=DADDR_SIZE) {
-        printf("ERROR(setDMem): instruction at addr %d attempting to set out of bounds data memory at loc: %d\n", pc, m);
-        exit(1);
-    }
+/* seconds on a monotonic clock */
+double wallTime()
+{
+    struct timespec t;
 
-    dMem[m] = value;
-    dMemTag[m] = pc;
-    dMemCmt[m] = iMem[pc].comment;
-    return srOKAY;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
 }
 
-
-
-long long int getDMem(int m) {
-    if (m<0 ||  m>=DADDR_SIZE) {
-        printf("ERROR(getDMem): instruction at addr %d attempting to get out of bounds data memory at loc: %d\n", pc, m);
-        
-        exit(1);
-    }
-    else {
-        return dMem[m];
-    }
-}
-
-
-/********************************************/
-int opClass(int c)
+double cpuTime()
 {
-    if (c <= (int)opRRLim) return opclRR;
-    else if (c <= (int)opRALim) return opclRA;
-    else return opclLIT;
+    struct timespec t;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
 }
 
 
+void writeProfileFiles(void);
 
-/********************************************/
-void writeInstruction(int loc, int trace)
+/* --run is over: write the --json summary if asked for and exit with
+   status.  result is a stepResultKey or names why nothing ran. */
+void runSummary(const char *result, int status)
 {
-//DEBUG    printf("PC: %d  R7: %lld  loc: %d\n", pc, reg[7], loc);
-    printf("%4d: ", loc);
-    if ((loc >= 0) && (loc<IADDR_SIZE)) {
-	printf("%4s%3lld,", opCodeTab[iMem[loc].iop], iMem[loc].iarg1);
-	switch (opClass(iMem[loc].iop)) {
-	case opclRR:
-	    printf("%3lld, %1lld ", iMem[loc].iarg2, iMem[loc].iarg3);
-	    if (trace) {
-                printf(" | ");
-                {
-                    int i;
-                    for (i=0; i<7; i++) printf(" r[%1d]:%-3lld", i, reg[i]);
-                }
-                printf(" | ");
-	    }
-	    break;
-	case opclRA:
-	    printf("%4lld(%1lld)", iMem[loc].iarg2, iMem[loc].iarg3);
-	    if (trace) {
-                long long int tmp;
+    FILE *json;
+    const char *p;
+    double elapsed;
+    TMSTATS st;
 
-                printf(" | ");
-                {
-                    int i;
-                    for (i=0; i<7; i++) printf(" r[%1d]:%-3lld", i, reg[i]);
-                }
-/*   zzz   */
-                tmp = iMem[loc].iarg2 + reg[iMem[loc].iarg3];
-                if ((tmp >= 0) && (tmp<DADDR_SIZE)) {
-
-                    printf(" m[%lld]:%-3lld",
-                           iMem[loc].iarg2 + reg[iMem[loc].iarg3],
-                           dMem[iMem[loc].iarg2 + reg[iMem[loc].iarg3]]);
-                    printf(" | ");
-                }
-            }
-	    break;
-	}
-        if (breakpoint == loc || savedbreakpoint == loc) printf(" %s", "<-[break]");
-        if (reg[7] == loc && !trace) printf(" %s", "<-[pc]");
-	printf(" %s\n", iMem[loc].comment);
-    }
+    elapsed = wallTime() - runStart;
     fflush(stdout);
-}				/* writeInstruction */
-
-
-
-/********************************************/
-/* get the next character
-*/
-int getCh()
-{
-//    printf("LINE: \'%s\'  LINELEN: %d INCOL: %d\n", in_Line, lineLen, inCol);
-    if (++inCol<lineLen) {
-	ch = in_Line[inCol];
-        return 1;
-    }
-    else {
-	ch = ' ';
-        return 0;
+    writeProfileFiles();
+    if (jsonName) {
+        json = (strcmp(jsonName, "-") == 0 ? stdout : fopen(jsonName, "w"));
+        if (json == NULL) {
+            fprintf(stderr, "ERROR: unable to write summary file: %s\n", jsonName);
+            exit(RUN_FAIL_STATUS);
+        }
+        fprintf(json, "{\"program\": \"");
+        for (p = tm->pgmName; *p; p++) {
+            if (*p=='"' || *p=='\\') fprintf(json, "\\%c", *p);
+            else if ((unsigned char)*p<' ') fprintf(json, "\\u%04x", *p);
+            else putc(*p, json);
+        }
+        fprintf(json, "\", \"result\": \"%s\", \"status\": %d, ", result, status);
+        fprintf(json, "\"instructions\": %lld, ", tmInstructions(tm));
+        fprintf(json, "\"output_instructions\": %d, \"pc\": %d, \"wall_seconds\": %.6f, ",
+                tmOutputs(tm), tmPc(tm), elapsed);
+        tmGetStats(tm, &st);
+        fprintf(json, "\"cpu_seconds\": %.6f, \"instructions_per_second\": %.0f, ",
+                st.cpuSeconds, st.instructionsPerSecond);
+        fprintf(json, "\"stack_words\": %lld, \"call_depth\": %d, \"global_words\": %lld, ",
+                st.stackWords, st.callDepth, st.globalWords);
+        fprintf(json, "\"mov_words\": %lld, \"set_words\": %lld, \"co_words\": %lld}\n",
+                st.movWords, st.setWords, st.coWords);
+        if (json == stdout) fflush(stdout);
+        else fclose(json);
     }
+    exit(status);
 }
 
 
-
-/********************************************/
-/* span a bunch of whitespace
-*/
-int nonBlank(void)
+/* --run stopped with result */
+void runExit(STEPRESULT result)
 {
-    while ((inCol<lineLen) &&
-	   ((in_Line[inCol] == ' ') || (in_Line[inCol] == '\t'))) inCol++;
-    if (inCol<lineLen) {
-	ch = in_Line[inCol];
-	return TRUE;
-    }
-    else {
-	ch = ' ';
-	return FALSE;
+    if (result == srHALT) runSummary(stepResultKey[result], 0);
+    fflush(stdout);
+    if (result == srINPUT_ERR) runSummary(stepResultKey[result], RUN_FAIL_STATUS);
+    if (result == srOKAY) {
+        fprintf(stderr, "%s: instruction limit reached (limit = %lld) at addr %d\n",
+                tm->pgmName, runLimit, tmPc(tm));
+        runSummary(stepResultKey[result], RUN_LIMIT_STATUS);
     }
+    fprintf(stderr, "%s: %s at addr %d\n", tm->pgmName, tmResultText(result), tmPc(tm));
+    runSummary(stepResultKey[result], (int)result);
 }
 
-/********************************************/
-/* span a bunch of whitespace
-*/
-int uptoComment(void)
+
+/* the faults that end the program where they happen: bad data memory
+   addresses and input that can't be read.  The command loop has
+   always exited with 1 for these.  */
+int fatalResult(STEPRESULT result)
 {
-    while ((inCol<lineLen) && (in_Line[inCol] != '*')) inCol++;
-    if (inCol<lineLen) {
-	ch = in_Line[inCol];
-	return TRUE;
-    }
-    else {
-	ch = ' ';
-	return FALSE;
-    }
+    return result == srDMEM_SET_ERR || result == srDMEM_RONLY_ERR ||
+        result == srDMEM_READ_ERR || result == srINPUT_ERR;
 }
 
-
-//  returns the numerical equivalent of a character in num.
-//  returns success or failure in function value
-//
-void getCleanChar(void)
+void fatalStep(STEPRESULT result)
 {
-        getCh();
-        if (ch == '\\') {
-            getCh();
-            if (ch == '0') num = '\0';
-            else if (ch == 't') num = '\t';
-            else if (ch == 'n') num = '\n';
-            else if (ch == '\\') num = '\\';
-            else if (ch == '\'') num = '\'';
-            else num = ch;
-        }
-        else if (ch == '^') {
-            getCh();
-            num = ch;
-            num ^= 0x40;
-        }
-        else {
-            num = ch;
-        }
+    printf("%s\n", tmMessage(tm));
+    if (runflag) runExit(result);
+    writeProfileFiles();
+    exit(1);
 }
 
 
-// return a string in word[]
-int getString(void)
+/* a step of the command loop */
+STEPRESULT commandStep(void)
 {
-    int i;
-    int ok = FALSE;
-    if (ch == '"') {
-        i = 0;
-        do {
-            getCleanChar();
-            word[i++] = ch;
-        } while (ch != '"');
-        word[i-1] = '\0';
-        ok = TRUE;
-    }
+    STEPRESULT result;
 
-    return ok;
+    result = stepTM(tm);
+    if (fatalResult(result)) fatalStep(result);
+    return result;
 }
 
-int getChar(void)
-{
-    int ok = FALSE;
-
-    num = 0;
-    if (ch == '\'') {
-        getCleanChar();
-        getCh();
-        if (ch == '\'') {
-            ok = TRUE;
-            getCh();
-        }
-    }
-
-    return ok;
-}
 
-//  returns the number in num.
-// returns success or failure in function value
-//
-int getNum(void)
+/* read a line typed for an input instruction into the command scanner.
+   keepNewline leaves the newline on the end for INC. */
+void readInputLine(int keepNewline)
 {
-    int sign;
-    long long int term;
-    int ok = FALSE;
+    char *p;
 
-    num = 0;
-    nonBlank();
-    do {
-	sign = 1;
-	while ((ch == '+') || (ch == '-')) {
-	    ok = FALSE;
-	    if (ch == '-')
-		sign = -sign;
-	    getCh();
-	}
-	term = 0;
-	while (isdigit(ch)) {
-	    ok = TRUE;
-	    term = term*10 + (ch - '0');
-	    getCh();
-	}
-	num = num + (term*sign);
+    fgets(scan.in_Line, LINESIZE - 2, stdin);
+    for (p=scan.in_Line; *p; p++) {
+        if (*p=='\n') {
+            if (keepNewline) p++;  // include newline
+            else *p='\0';
+            break;
+        }
     }
-    while ((ch == '+') || (ch == '-'));
-
-//    printf("NUM: %d\n", num);
-    return ok;
-}				/* getNum */
-
-
-
-
-
-/********************************************/
-int getNumOrChar(void)
-{
-    nonBlank();
-    if ((ch == '+') || (ch == '-') || isdigit(ch)) return getNum();
-    else return getChar();
+    scan.lineLen = p-scan.in_Line;
 }
 
 
-/********************************************/
-int getWord(void)
-{
-    int temp = FALSE;
-    int length = 0;
-    if (nonBlank()) {
-	while (isalnum(ch) || ch=='=' || ch=='?') {
-	    if (length<WORDSIZE - 1)
-		word[length++] = ch;
-	    getCh();
-	}
-	word[length] = '\0';
-	temp = (length != 0);
-    }
-    return temp;
-}				/* getWord */
-
-
-/********************************************/
-int getBool(void)
+/* the input callback when there is no -i: IN and INB prompt for a line
+   and scan it like a command.  INC takes characters from what is left
+   of the last line read, prompting for more when it runs out.
+*/
+TMINPUTSTATUS commandInput(TMMachine *m, void *context, TMINPUTKIND kind, long long int *value)
 {
-    nonBlank();
-
-    num = 1;
-    if ((ch=='F') || (ch=='f') || (ch=='0')) num = 0;
-    getWord();
+    (void)m;
+    (void)context;
 
-    return TRUE;
-}
+    if (kind == tmINPUT_CHAR) {
+        fflush(stdin);
+        fflush(stdout);
 
+        while (scan.inCol+1>=scan.lineLen) {
+            if (promptflag) printf("Enter characters: ");
+            readInputLine(TRUE);
+            scan.inCol = -1;
+        }
 
-/********************************************/
-int skipCh(char c)
-{
-    int temp = FALSE;
-    if (nonBlank() && (ch == c)) {
-	getCh();
-	temp = TRUE;
+        getCh(&scan);
+        *value = scan.ch;
+        return tmINPUT_OK;
     }
-    return temp;
-}				/* skipCh */
-
 
+    if (promptflag) printf(kind == tmINPUT_INT ? "Enter integer value: " : "Enter Boolean value: ");
+    fflush(stdin);
+    fflush(stdout);
+    readInputLine(FALSE);
+    if (!promptflag) printf("entered: %s\n", scan.in_Line);
 
-/********************************************/
-/* note this returns a duplicate string and not true or false */
-char *getRemaining(void)
-{
-    skipCh(')');
-    if (nonBlank()) return strdup(&in_Line[inCol]);
-    return emptyString;
+    scan.inCol = 0;
+    if (kind == tmINPUT_BOOL) getBool(&scan);
+    else if (!getNum(&scan)) {
+        printf("Illegal value in input: \"%s\"\n", scan.in_Line);
+        exit(1);
+    }
+    *value = scan.num;
+    return (skipCh(&scan, '#') ? tmINPUT_HALT : tmINPUT_OK);
 }
 
 
-
-/********************************************/
-int atEOL(void)
-{
-    return (!nonBlank());
-}				/* atEOL */
-
-
-
-/********************************************/
-int error(char *msg, int lineNo, int instNo)
-{
-    printf("ERROR: Line %d", lineNo);
-    if (instNo >= 0)
-	printf(" (Address: %d)", instNo);
-    printf("   %s\n", msg);
-    return FALSE;
-}				/* error */
-
-
-
-/* clear registers and data memory */
-void clearMachine()
+/* the memory views start over with each clear */
+void clearViews(void)
 {
-    int regNo, loc;
-
     iloc = 0;
     dloc = 0;
-    for (regNo = 0; regNo<NO_REGS; regNo++) reg[regNo] = 0;
-    reg[0] = DADDR_SIZE - 1;   // v 4.6
-
-    for (loc = 0; loc<DADDR_SIZE; loc++) {
-	dMem[loc] = 0;
-	dMemTag[loc] = UNUSED;
-        dMemCmt[loc] = (char *)"";
-    }
-// NO LONGER starting v4.6   dMem[0] = DADDR_SIZE - 1;
-
-    dmemStart = reg[0];
+    dmemStart = tm->reg[0];
     dmemCount = 20;
     dmemDown = -1;
     imemStart = 0;
     imemCount = 20;
     imemDown = +1;
-    instrCount = outputInstrCount = 0;
 }
 
-/* clear registers, data and instruction memory */
-void fullClearMachine()
-{
-    int loc;
 
-    /* clear registers and data memory */
-    clearMachine();
-    savedbreakpoint = breakpoint = -1;
-
-    /* zero out instruction memory */
-    for (loc = 0; loc<IADDR_SIZE; loc++) {
-	iMem[loc].iop = opHALT;
-	iMem[loc].iarg1 = 0;
-	iMem[loc].iarg2 = 0;
-	iMem[loc].iarg3 = 0;
-	iMem[loc].comment = (char *)"* initially empty";
-	iMemTag[loc] = UNUSED;
-    }
-}
+/* the comparisons of breakpoint conditions by TMCOMPARE */
+const char *compareTab[] = { "", "==", "!=", "<", "<=", ">", ">=" };
 
 
-int readInstructions(char *fileName)
+/* the condition of a breakpoint from the rest of the command line:
+   if r<r>|<d>|<d>(<s>) <compare> <value> */
+int getBreakCondition(TMBREAKPOINT *bp)
 {
-    FILE *pgm;
-    OPCODE op;
-    long long int arg1, arg2, arg3;
-    int loc, lineNo;
-    char errorString[128];
-
-    /* load program */
-    if (*fileName!='\0') strcpy(pgmName, fileName);
-    if (strchr(pgmName, '.') == NULL) strcat(pgmName, (char *)".tm");
-    pgm = fopen(pgmName, "r");
-    if (pgm == NULL) {
-	printf("ERROR(readInstructions): file '%s' not found\n", pgmName);
-	return FALSE;
+    char op[3];
+    int i, n;
+
+    if (!getWord(&scan) || strcmp(scan.word, "if") != 0) return FALSE;
+    nonBlank(&scan);
+    if (scan.ch == 'r') {
+        getCh(&scan);
+        if (!getNum(&scan) || scan.num<0 || scan.num>=NO_REGS) return FALSE;
+        bp->reg = scan.num;
     }
-    printf("Loading file: %s\n", pgmName);
-
-    /* clear the way for the new program */
-    fullClearMachine();
-
-    /* load program */
-    lineNo = 0;
-    loc = -1;   /* fist location to load is 0 */
-    /* get line */
-    fgets(in_Line, LINESIZE - 2, pgm);
-    while (!feof(pgm)) {
-        /* process line */
-	inCol = 0;
-	lineNo++;
-	lineLen = strlen(in_Line) - 1;
-	if (in_Line[lineLen] == '\n')
-	    in_Line[lineLen] = '\0';
-	else
-	    in_Line[++lineLen] = '\0';
-
-        /* process an instruction */
-	if ((nonBlank()) && (in_Line[inCol] != '*')) {
-            /* get address */
-	    if (getNum()) {
-                loc = num;
-
-                /* colon after address */
-                if (!skipCh(':')) {
-                    return error((char *)"Missing colon", lineNo, loc);
-                }
-            }
-            else {   /* if no address given then just increment counter */
-                loc++;
-            }
-	    if (loc<0 || loc>=IADDR_SIZE) {
-                printf("ERROR(readInstructions): at line %d attempting to set out of bounds instruction memory at loc: %d\n", lineNo, loc);
-                exit(1);
-            }
-
-            /* get op code */
-	    if (!getWord())
-		return error((char *)"Missing opcode", lineNo, loc);
-
-            { int opcnt;
-
-                for (opcnt = 0; opcnt<(int)opEND; opcnt++) {
-                    if (strncmp(opCodeTab[opcnt], word, 4) == 0) break;
-                }
-                if (opcnt>=(int)opEND) {
-                    sprintf(errorString, (char *)"Illegal opcode: %s", word);
-                    return error(errorString, lineNo, loc);
-                }
-		op = (OPCODE)opcnt;
-            }
-
-            /* process args to op code */
-            arg1 = arg2 = arg3 = 0;
-            if (op==opHALT || op==opNOP) {
-                uptoComment();
-            }
-            else {
-                switch (opClass(op)) {
-                case opclRR:
-                    /***********************************/
-                    /* arg 1 */
-                    if ((!getNum()) || (num<0) || (num >= NO_REGS))
-                        return error((char *)"Bad first register", lineNo, loc);
-                    arg1 = num;
-                    if (!skipCh(','))
-                        return error((char *)"Missing comma", lineNo, loc);
-
-                    /* arg 2 */
-                    if ((!getNum()) || (num<0) || (num >= NO_REGS))
-                        return error((char *)"Bad second register", lineNo, loc);
-                    arg2 = num;
-                    if (!skipCh(','))
-                        return error((char *)"Missing comma", lineNo, loc);
-
-                    /* arg 3 */
-                    if ((!getNum()) || (num<0) || (num >= NO_REGS))
-                        return error((char *)"Bad third register", lineNo, loc);
-                    arg3 = num;
-                    break;
-
-                case opclRA:
-                    /***********************************/
-                    /* arg 1 */
-                    if (!getNum() || ((num<0) || (num >= NO_REGS)))
-                        return error((char *)"Bad first register", lineNo, loc);
-                    arg1 = num;
-                    if (!skipCh(','))
-                        return error((char *)"Missing comma", lineNo, loc);
-
-                    /* arg 2 */
-                    if (!getNumOrChar())
-                        return error((char *)"Bad displacement", lineNo, loc);
-                    arg2 = num;
-                    if (!skipCh('(') && !skipCh(',')) {
-                        if (op==opLDC) {
-                            break;
-                        }
-                        return error((char *)"Missing left paren", lineNo, loc);
-                    }
-
-                    /* arg 3 */
-                    if ((!getNum()) || (num<0) || (num >= NO_REGS))
-                        return error((char *)"Bad second register", lineNo, loc);
-                    arg3 = num;
-                    break;
-                case opclLIT:
-                    nonBlank();
-                    (wordset = getString()) || getNum() || getChar();
-                    break;
-                }
-                
-            }
-
-            // set data memory with LIT instruction.
-            // location is at loc offset from *top* of memory!
-            if (op==opLIT) {
-                int dloc;
-
-                dloc = DADDR_SIZE - 1 - loc;
-                if (wordset) {
-                    int len, k;
-
-                    len = strlen(word);
-                    for (k=0; k<len; k++) {
-                        setDMem(dloc-k, word[k]);
-                        dMemTag[dloc-k] = READONLY;
-                    }
-                    setDMem(dloc+1, len);
-                    dMemTag[dloc+1] = READONLY;
-                }
-                else {
-                    setDMem(dloc, num);
-                    dMemTag[dloc] = READONLY;
-                }
-            }
-            // set instruction memory
-            else {
-                iMem[loc].iop = op;
-                iMem[loc].iarg1 = arg1;
-                iMem[loc].iarg2 = arg2;
-                iMem[loc].iarg3 = arg3;
-                iMem[loc].comment = getRemaining();
-                iMemTag[loc] = USED;     /* correctly counts assignments to same loc  */
-            }
-	}
-
-        /* get next line */
-        fgets(in_Line, LINESIZE - 2, pgm);
+    else {
+        if (!getNum(&scan)) return FALSE;
+        bp->reg = bp->base = -1;
+        bp->offset = scan.num;
+        if (skipCh(&scan, '(')) {
+            if (!getNum(&scan) || scan.num<0 || scan.num>=NO_REGS || !skipCh(&scan, ')')) return FALSE;
+            bp->base = scan.num;
+        }
     }
-    return TRUE;
-}				/* readInstructions */
-
-
 
+    nonBlank(&scan);
+    for (n = 0; n<2 && scan.ch && strchr("=!<>", scan.ch); n++) {
+        op[n] = scan.ch;
+        getCh(&scan);
+    }
+    op[n] = '\0';
+    if (strcmp(op, "=") == 0) strcpy(op, "==");
+    bp->compare = tmALWAYS;
+    for (i = tmEQ; i<=tmGE; i++) if (strcmp(op, compareTab[i]) == 0) bp->compare = (TMCOMPARE)i;
+    if (bp->compare == tmALWAYS || !getNum(&scan)) return FALSE;
+    bp->value = scan.num;
+
+    return atEOL(&scan);
+}
 
-/********************************************/
 
-int outputLimitFail()
+void listBreakpoints(void)
 {
-    outputInstrCount++;
-    if (outputInstrCount>outputLimit && outputLimit!=0) return 1;
-    return 0;
+    const TMBREAKPOINT *bp;
+    int i;
+
+    if (tmBreakpoints(tm) == 0) printf("No breakpoints.\n");
+    for (i = 0; (bp = tmBreakpoint(tm, i)); i++) {
+        printf("Breakpoint at %d", bp->addr);
+        if (bp->compare == tmALWAYS) printf("\n");
+        else if (bp->reg >= 0) printf(" if r%d %s %lld\n", bp->reg, compareTab[bp->compare], bp->value);
+        else if (bp->base >= 0) printf(" if %lld(%d) %s %lld\n", bp->offset, bp->base, compareTab[bp->compare], bp->value);
+        else printf(" if %lld %s %lld\n", bp->offset, compareTab[bp->compare], bp->value);
+    }
 }
 
 
-STEPRESULT stepTM(void)
+/* load a program: the last file if name is empty and with .tm added
+   if it has no extension */
+int loadProgram(char *name)
 {
-    INSTRUCTION currentinstruction;
-    long long int r, s, t, d, m;
+    char fileName[WORDSIZE + 4];
     int ok;
 
-    pc = reg[PC_REG];
-    if ((pc<0) || (pc>=IADDR_SIZE))
-	return srIMEM_ERR;
-
-    if (pc == breakpoint) {
-	savedbreakpoint = breakpoint;
-	breakpoint = -1;
-	return srHALT;
-    }
-    breakpoint = savedbreakpoint;
-
-    lastpc = pc;
-    reg[PC_REG] = pc + 1;
-    currentinstruction = iMem[pc];
-    instrCount++;
-
-    /* get the args to the instruction */
-    if (opClass(currentinstruction.iop) == opclRR) {
-        r = currentinstruction.iarg1;
-        s = currentinstruction.iarg2;
-        t = currentinstruction.iarg3;
-    }
-    else {  /* note s changes its position */
-	r = currentinstruction.iarg1;
-        d = currentinstruction.iarg2;
-	s = currentinstruction.iarg3;
-	m = currentinstruction.iarg2 + reg[s];
+    strcpy(fileName, (*name!='\0' ? name : tm->pgmName));
+    if (strchr(fileName, '.') == NULL) strcat(fileName, (char *)".tm");
+    if (!runflag && access(fileName, R_OK) == 0) printf("Loading file: %s\n", fileName);
+    ok = tmLoadFile(tm, fileName);
+    if (!ok) printf("%s\n", tmMessage(tm));
+    else if (uncheckedflag && !tmVerify(tm)) {
+        fprintf((runflag ? stderr : stdout), "WARNING: %s (running with the checks)\n", tmMessage(tm));
     }
+    clearViews();
+    return ok;
+}
 
-    switch (currentinstruction.iop) {
-	/* RR instructions */
-    case opHALT:
-        /***********************************/
-	return srHALT;
-	/* break; */
-
-    case opNOP:
-        break;
-
-    case opIN:
-        /***********************************/
-	do {
-	    if (promptflag) printf("Enter integer value: ");
-	    fflush(stdin);
-	    fflush(stdout);
-
-            fgets(in_Line, LINESIZE - 2, stdin);
-            {
-                char *p;
-
-                for (p=in_Line; *p; p++) {
-                    if (*p=='\n') {
-                        *p='\0';
-                        break;
-                    }
-                }
-                lineLen = p-in_Line;
-            }
-
-	    if (!promptflag) printf("entered: %s\n", in_Line);
-
-	    inCol = 0;
-	    ok = getNum();
-	    if (!ok) {
-		printf("Illegal value in input: \"%s\"\n", in_Line);
-                exit(1);
-            }
-	    else {
-		reg[r] = num;
-            }
-	}
-	while (!ok);
-	if (skipCh('#')) return srHALT;
-	break;
 
-    case opINB:
-        /***********************************/
-	if (promptflag) printf("Enter Boolean value: ");
-	fflush(stdin);
-	fflush(stdout);
 
-	fgets(in_Line, LINESIZE - 2, stdin);
-	{
-	    char *p;
+/********************************************/
+void writeInstruction(int loc, int trace)
+{
+    INSTRUCTION *iMem = tm->iMem;
+    long long int *reg = tm->reg;
 
-	    for (p=in_Line; *p; p++) {
-		if (*p=='\n') {
-		    *p='\0';
-		    break;
-		}
+//DEBUG    printf("PC: %d  R7: %lld  loc: %d\n", pc, reg[7], loc);
+    printf("%4d: ", loc);
+    if ((loc >= 0) && (loc<tm->iMemSize)) {
+	printf("%4s%3lld,", opCodeTab[iMem[loc].iop], iMem[loc].iarg1);
+	switch (opClass(iMem[loc].iop)) {
+	case opclRR:
+	    printf("%3lld, %1lld ", iMem[loc].iarg2, iMem[loc].iarg3);
+	    if (trace) {
+                printf(" | ");
+                {
+                    int i;
+                    for (i=0; i<7; i++) printf(" r[%1d]:%-3lld", i, reg[i]);
+                }
+                printf(" | ");
 	    }
-	    lineLen = p-in_Line;
-	}
-
-	if (!promptflag) printf("entered: %s\n", in_Line);
-
-	inCol = 0;
-	getBool();
-	reg[r] = num;
-	if (skipCh('#')) return srHALT;
-	break;
-
-    case opINC:
-        /***********************************/
-	fflush(stdin);
-	fflush(stdout);
-
-        while (inCol+1>=lineLen) {
-            char *p;
+	    break;
+	case opclRA:
+	    printf("%4lld(%1lld)", iMem[loc].iarg2, iMem[loc].iarg3);
+	    if (trace) {
+                long long int tmp;
 
-	    if (promptflag) printf("Enter characters: ");
-            fgets(in_Line, LINESIZE - 2, stdin);
+                printf(" | ");
+                {
+                    int i;
+                    for (i=0; i<7; i++) printf(" r[%1d]:%-3lld", i, reg[i]);
+                }
+/*   zzz   */
+                tmp = iMem[loc].iarg2 + reg[iMem[loc].iarg3];
+                if ((tmp >= 0) && (tmp<tm->dMemSize)) {
 
-            for (p=in_Line; *p; p++) {
-                if (*p=='\n') {
-//                    *p='\0';  // RH TEST
-//                    *p='\n';
-                    p++;  // include newline
-                    break;
+                    printf(" m[%lld]:%-3lld",
+                           iMem[loc].iarg2 + reg[iMem[loc].iarg3],
+                           tm->dMem[iMem[loc].iarg2 + reg[iMem[loc].iarg3]]);
+                    printf(" | ");
                 }
             }
-            lineLen = p-in_Line;
-            inCol = -1;
-        }
-
-        if (getCh()) {
-            reg[r] = ch;
-        }
-
-	break;
-
-    case opOUT:
-        if (outputLimitFail()) return srOUTPUTLIMIT_ERR;
-	printf("%lld ", reg[r]);
-        fflush(stdout);
-	break;
-
-    case opOUTB:
-        if (outputLimitFail()) return srOUTPUTLIMIT_ERR;
-	if (reg[r]) printf("T ");
-	else printf("F ");
-        fflush(stdout);
-	break;
-
-    case opOUTC:
-        if (outputLimitFail()) return srOUTPUTLIMIT_ERR;
-	printf("%c", (char)reg[r]);
-        fflush(stdout);
-	break;
-
-    case opOUTNL:
-        if (outputLimitFail()) return srOUTPUTLIMIT_ERR;
-	printf("\n");
-        fflush(stdout);
-	break;
-
-    case opADD:
-	reg[r] = reg[s] + reg[t];
-	break;
-
-    case opSUB:
-	reg[r] = reg[s] - reg[t];
-	break;
+	    break;
+	}
+        if (tmBreakpointAt(tm, loc)) printf(" %s", "<-[break]");
+        if (reg[7] == loc && !trace) printf(" %s", "<-[pc]");
+	printf(" %s\n", (tm->iMemCmt[loc] ? tm->iMemCmt[loc] : "* initially empty"));
+    }
+    fflush(stdout);
+}				/* writeInstruction */
 
-    case opMUL:
-	reg[r] = reg[s]*reg[t];
-	break;
 
-    case opDIV:
-	if (reg[t] != 0)
-	    reg[r] = reg[s]/reg[t];
-	else
-	    return srZERODIVIDE;
-	break;
 
-    case opMOD:
-	if (reg[t] != 0) {
-            long long int tmp;  // r may equal t
+/* the next thing on the command line as a file name: up to a blank */
+int getFileName(char *name)
+{
+    int length;
 
-	    tmp = reg[s]%reg[t];
-            if (tmp<0) tmp += llabs(reg[t]);  // always return a nonnegative answer
-	    reg[r] = tmp;
+    length = 0;
+    if (nonBlank(&scan)) {
+        while (scan.ch != ' ' && scan.ch != '\t' && length<WORDSIZE - 1) {
+            name[length++] = scan.ch;
+            getCh(&scan);
         }
-	else
-	    return srZERODIVIDE;
-	break;
-
-    case opAND:
-	reg[r] = reg[s]&reg[t];
-	break;
-
-    case opOR:
-	reg[r] = reg[s]|reg[t];
-	break;
-
-    case opXOR:
-	reg[r] = reg[s]^reg[t];
-	break;
-
-    case opNOT:
-	reg[r] = ~reg[s];
-	break;
+    }
+    name[length] = '\0';
+    return length != 0;
+}
 
-    case opNEG:
-	reg[r] = -reg[s];
-	break;
 
-    case opSWP:
-        if (reg[r]>reg[s]) {
-            long long int tmp;
-            tmp = reg[r];
-            reg[r] = reg[s];
-            reg[s] = tmp;
-        }
-	break;
+/* start the binary trace of --trace or t file */
+int startTrace(const char *name, long long int ring)
+{
+    if (! tmTraceFile(tm, name, ring)) {
+        fprintf((runflag ? stderr : stdout), "%s\n", tmMessage(tm));
+        return FALSE;
+    }
+    snprintf(traceFile, WORDSIZE, "%s", name);
+    return TRUE;
+}
 
-    case opRND:
-	if (reg[s] != 0)
-            reg[r] = random()%llabs(reg[s]);
-	else
-	    return srZERODIVIDE;
-	break;
 
-    case opMOV: {
-        int raddr, saddr;
-        int i;
+/* write the coverage as an lcov tracefile */
+int writeCoverageFile(const char *name)
+{
+    FILE *out;
 
-        raddr = reg[r];
-        saddr = reg[s];
-        for (i=0; i<reg[t]; i++) {
-            setDMem(raddr, getDMem(saddr));
-            raddr--;
-            saddr--;
-        }
+    if ((out = fopen(name, "w")) == NULL) {
+        printf("ERROR: unable to write coverage: %s\n", name);
+        return FALSE;
     }
-        break;
+    tmWriteCoverage(tm, out, NULL);
+    fclose(out);
+    return TRUE;
+}
 
-    case opSET: {
-        int raddr, svalue;
-        int i;
 
-        raddr = reg[r];
-        svalue = reg[s];
-        for (i=0; i<reg[t]; i++) {
-            setDMem(raddr, svalue);
-            raddr--;
-        }
-    }
-        break;
+/* write the --profile, --profile-tsv, --flame and --coverage files and
+   end the binary trace */
+void writeProfileFiles(void)
+{
+    FILE *out;
 
-    
-    // find the first place that is different put the differing mem
-    // values in r and s.   Memory is checked from high address
-    // to low!  If the length of the comparison (stored in reg[t]) is
-    // zero then r and s will be set to 0.
-    case opCO: {
-        int raddr, saddr;
-	int i;
-
-        raddr = reg[r];
-        saddr = reg[s];
-        if (reg[t]==0) {
-            reg[r] = reg[s] = 0;
+    if (profileName) {
+        if ((out = fopen(profileName, "w")) == NULL) printf("ERROR: unable to write profile: %s\n", profileName);
+        else {
+            writeProfile(tm, out, 0);
+            fclose(out);
         }
+    }
+    if (profileDataName) {
+        if ((out = fopen(profileDataName, "w")) == NULL) printf("ERROR: unable to write profile: %s\n", profileDataName);
         else {
-            for (i=0; i<reg[t]; i++) {
-                reg[r] = getDMem(raddr);
-                reg[s] = getDMem(saddr);
-                if (reg[r] != reg[s]) break;
-                raddr--;
-                saddr--;
-            }
+            writeProfileData(tm, out);
+            fclose(out);
         }
     }
-    break;
-
-    // find the addresses of the first place that is different put the addresses of 
-    // the differing mem values in r5 and r6
-    case opCOA: {
-        int raddr, saddr;
-	int i;
-
-        raddr = reg[r];
-        saddr = reg[s];
-        for (i=0; i<reg[t]; i++) {
-            reg[r] = raddr;
-            reg[s] = saddr;
-            if (getDMem(raddr) != getDMem(saddr)) break;
-            raddr--;
-            saddr--;
+    if (flameName) {
+        if ((out = fopen(flameName, "w")) == NULL) printf("ERROR: unable to write profile: %s\n", flameName);
+        else {
+            writeSamples(tm, out);
+            fclose(out);
         }
     }
-        break;
-
-        /*************** RA instructions ********************/
-    case opLD:
-	reg[r] = getDMem(m);
-	break;
-    case opST:
-        setDMem(m, reg[r]);
-	break;
-    case opLDA:
-	reg[r] = m;
-	break;
-    case opLDC:
-	reg[r] = d;
-	break;
-    case opTLT:
-        reg[r] = (reg[s]<reg[t] ? 1 : 0);
-	break;
-    case opSLT:
-        if (reg[r]>=0) reg[r] = (reg[s]<reg[t] ? 1 : 0);
-        else reg[r] = (-reg[s] < -reg[t] ? 1 : 0);
-	break;
-    case opTGT:
-        reg[r] = (reg[s]>reg[t] ? 1 : 0);
-	break;
-    case opSGT:
-        if (reg[r]>=0) reg[r] = (reg[s]>reg[t] ? 1 : 0);
-        else reg[r] = (-reg[s] > -reg[t] ? 1 : 0);
-	break;
-    case opTLE:
-        reg[r] = (reg[s]<=reg[t] ? 1 : 0);
-	break;
-    case opTGE:
-        reg[r] = (reg[s]>=reg[t] ? 1 : 0);
-	break;
-    case opTEQ:
-        reg[r] = (reg[s]==reg[t] ? 1 : 0);
-	break;
-    case opTNE:
-        reg[r] = (reg[s]!=reg[t] ? 1 : 0);
-	break;
-    case opJZR:
-	if (reg[r] == 0)
-	    reg[PC_REG] = m;
-	break;
-    case opJNZ:
-	if (reg[r] != 0)
-	    reg[PC_REG] = m;
-	break;
-    case opJMP:
-        reg[PC_REG] = m;
-	break;
-
-	/* end of legal instructions */
-    }				/* case */
-    return srOKAY;
-}				/* stepTM */
-
-
-
-
+    if (coverageName) writeCoverageFile(coverageName);
+    if (tm->trace && ! tmTraceFile(tm, NULL, 0)) printf("%s\n", tmMessage(tm));
+}
 /********************************************/
 void usage()
 {
@@ -1333,27 +764,47 @@ void usage()
     printf("\nCommands are:\n");
     printf(" a(bortLimit <<n>>  Maximum number of instructions between halts (default is %d).\n", DEFAULT_ABORT_LIMIT);
     printf(" b(reakpoint <<n>>  Set a breakpoint for instr n.  No n means clear breakpoints.\n");
-    printf(" c(lear             Reset TM for new execution of program\n");
+    printf("                      b n if <what> <cmp> <value> stops only when what, r<r> (a register),\n");
+    printf("                      <d> or <d>(<s>) (a dMem loc), compares to value by ==, !=, <, <=, > or >=.\n");
+    printf("                      b l(ist) lists them and b d(elete) n removes the one at n\n");
+    printf(" c(lear <r>         Reset TM for new execution of program.  c r(erun) keeps the LIT data\n");
     printf(" d(Mem <b <n>>      Print n dMem locations (counting down) starting at b (n can be negative to count up). No args means all used memory locations.\n");
     printf(" e(xecStats         Print execution statistics since last load or clear\n");
+    printf(" f(useStats         Print superinstruction counts for 'go' since last load or clear and the\n");
+    printf("                      size of the block cache\n");
     printf(" g(o                Execute TM instructions until HALT\n");
     printf(" h(elp              Cause this list of commands to be printed\n");
+    printf(" j(it               Toggle compiling the blocks 'go' runs often to x86-64 code\n");
+    printf(" k(ount <n>         Toggle counting the executions of each address.  n prints the n hottest\n");
+    printf("                      functions, lines, addresses and opcodes since last load or clear\n");
     printf(" i(Mem <b <n>>      Print n iMem locations (counting up) starting at b.  No args means all used memory locations.\n");
-    printf(" l(oad filename     Load filename into memory (default is last file)\n");
+    printf(" l(oad filename     Load filename into memory (default is last file).  .tm text or .tmb image\n");
+    printf(" m(emTags           Toggle recording the instr that last set each dMem loc during 'go'\n");
+    printf("                      (off is lean mode; step and trace always record)\n");
     printf(" n(ext              Print the next command that will be executed\n");
     printf(" o(utputLimit <<n>> Maximum combined number of calls to any output instruction (default is %d)\n", DEFAULT_OUTPUT_LIMIT);
     printf(" p(rint             Toggle printing of total number instructions executed ('go' only)\n");
     printf(" q(uit              Terminate TM\n");
     printf(" r(egs              Print the contents of the registers\n");
     printf(" s(tep <n>          Execute n (default 1) TM instructions\n");
-    printf(" t(race             Toggle instruction tracing (printing) during execution\n");
+    printf(" t(race <file <n>>  Toggle instruction tracing (printing) during execution.  With file,\n");
+    printf("                      record every instruction in a binary trace file instead (only the last\n");
+    printf("                      n records with n) for tmtrace to print.  t - ends the recording\n");
     printf(" u(nprompt)         Unprompted for script input\n");
     printf(" v                  Print the version information\n");
+    printf(" w(riteMode <mode>  Buffer TM program output by b(lock), l(ine) or u(nbuffered).\n");
+    printf("                      No mode prints the current one (default is line on a terminal)\n");
     printf(" x(it               Terminate TM\n");
+    printf(" y(coverage <file>  Toggle marking the instructions that run (kept across clears).  With\n");
+    printf("                      file, write the source lines and functions they cover as an lcov tracefile\n");
+    printf(" z(snapshot <r|m>   Save the registers, dMem, pc and counters.  z r restores them (the\n");
+    printf("                      program, settings and input are left as they are).  z m runs the\n");
+    printf("                      init code up to the entry of main and saves it there\n");
     printf(" = <r> <n>          Set register number r to value n (e.g. set the pc)\n");
     printf(" < <addr> <value>   Set dMem at addr to value\n");
     printf(" (empty line does a step)\n");
     printf("Also a # character placed after input will cause TM to halt\n  after processing the IN or INB commands (e.g. 34#  or f# )\n");
+    if (tm->inputName) printf("Input instructions are reading from %s.\n", tm->inputName);
 }
 
 
@@ -1365,6 +816,10 @@ int doCommand(void)
     int printcnt;
     int stepResult;
     int loc;
+    long long int ran;
+    double wall, cpu;
+    char name[WORDSIZE];
+    TMBREAKPOINT bp;
 
     stepcnt = 0;
     do {
@@ -1372,45 +827,66 @@ int doCommand(void)
 	fflush(stdin);
 	fflush(stdout);
 
-	fgets(in_Line, LINESIZE - 2, stdin);
+	fgets(scan.in_Line, LINESIZE - 2, stdin);
 	if (feof(stdin)) {
-	    word[0] = 'q';
-	    word[1] = '\0';
+	    scan.word[0] = 'q';
+	    scan.word[1] = '\0';
 	    break;
 	}
 
 	{
 	    char *p;
 
-	    for (p=in_Line; *p; p++) {
+	    for (p=scan.in_Line; *p; p++) {
 		if (*p=='\n') {
 		    *p='\0';
 		    break;
 		}
 	    }
-	    lineLen = p-in_Line;
+	    scan.lineLen = p-scan.in_Line;
 	}
-	inCol = 0;
+	scan.inCol = 0;
     }
-    while ((lineLen>0) && !getWord());
+    while ((scan.lineLen>0) && !getWord(&scan));
 
-    if (lineLen==0) {
-        word[0] = 's';
-        word[1] = '\0';
+    if (scan.lineLen==0) {
+        scan.word[0] = 's';
+        scan.word[1] = '\0';
     }
 
-    if (! promptflag) printf("command: %s\n", in_Line);
+    if (! promptflag) printf("command: %s\n", scan.in_Line);
 
-    cmd = word[0];
+    cmd = scan.word[0];
     switch (cmd) {
     case 'l':
         /***********************************/
-	if (!getWord()) *word = '\0';
-	readInstructions(word);
+	if (!getWord(&scan)) *scan.word = '\0';
+	loadProgram(scan.word);
+	break;
+
+    case 'k':
+        /***********************************/
+	if (getNum(&scan)) writeProfile(tm, stdout, llabs(scan.num));
+	else {
+	    tm->profileflag = !tm->profileflag;
+	    printf("Execution counting now %s.\n", (tm->profileflag ? "on" : "off"));
+	}
 	break;
 
     case 't':
         /***********************************/
+	if (getFileName(name)) {
+	    if (tm->trace) {
+		ran = tmTraceRecords(tm);
+		if (tmTraceFile(tm, NULL, 0)) printf("Trace of %lld records written to %s.\n", ran, traceFile);
+		else printf("%s\n", tmMessage(tm));
+	    }
+	    else if (strcmp(name, "-") == 0) printf("No trace is being recorded.\n");
+	    if (strcmp(name, "-") == 0) break;
+	    if (startTrace(name, (getNum(&scan) ? llabs(scan.num) : 0)))
+		printf("Recording a trace to %s.\n", name);
+	    break;
+	}
 	traceflag = !traceflag;
 	printf("Tracing now ");
 	if (traceflag)
@@ -1419,6 +895,17 @@ int doCommand(void)
 	    printf("off.\n");
 	break;
 
+        /***********************************/
+    case 'y':
+	if (getFileName(name)) {
+	    if (tm->coverMap == NULL) printf("Coverage is off.\n");
+	    else if (writeCoverageFile(name)) printf("Coverage written to %s.\n", name);
+	    break;
+	}
+	if (! tmSetCoverage(tm, tm->coverMap == NULL)) printf("%s\n", tmMessage(tm));
+	else printf("Coverage now %s.\n", (tm->coverMap ? "on" : "off"));
+	break;
+
         /***********************************/
     case 'u':
 //        printf("\n");
@@ -1436,6 +923,37 @@ int doCommand(void)
 	usage();
 	break;
 
+    case 'j':
+        /***********************************/
+	if (! tmSetJit(tm, !tm->jitflag)) printf("%s\n", tmMessage(tm));
+	else if (tm->jitflag) printf("Compiling hot blocks during go now on.\n");
+	else printf("Compiling hot blocks during go now off.\n");
+	break;
+
+    case 'm':
+        /***********************************/
+	tmSetLean(tm, !tm->leanflag);
+	printf("Recording memory tags during go now ");
+	if (tm->leanflag)
+	    printf("off.\n");
+	else
+	    printf("on.\n");
+	break;
+
+    case 'w':
+        /***********************************/
+	if (getWord(&scan)) {
+	    if (scan.word[0]=='b') tmSetOutputMode(tm, omBLOCK);
+	    else if (scan.word[0]=='l') tmSetOutputMode(tm, omLINE);
+	    else if (scan.word[0]=='u') tmSetOutputMode(tm, omUNBUFFERED);
+	    else {
+		printf("Output mode must be b(lock), l(ine) or u(nbuffered)\n");
+		break;
+	    }
+	}
+	printf("Output mode is %s.\n", outputModeTab[tm->outputMode]);
+	break;
+
     case 'p':
         /***********************************/
 	icountflag = !icountflag;
@@ -1448,8 +966,8 @@ int doCommand(void)
 
     case 'a':
         /***********************************/
-        if (getNum()) {
-	    abortLimit = llabs(num);
+        if (getNum(&scan)) {
+	    abortLimit = llabs(scan.num);
         }
 	else {
 	    abortLimit = 0;
@@ -1459,43 +977,97 @@ int doCommand(void)
 
     case 'o':
         /***********************************/
-        if (getNum()) {
-	    outputLimit = llabs(num);
+        if (getNum(&scan)) {
+	    tmSetOutputLimit(tm, llabs(scan.num));
         }
 	else {
-	    outputLimit = 0;
+	    tmSetOutputLimit(tm, 0);
 	    printf("Output limit turned off.\n");
         }
 	break;
 
     case 's':
         /***********************************/
-	if (atEOL())
+	if (atEOL(&scan))
 	    stepcnt = 1;
-	else if (getNum())
-	    stepcnt = llabs(num);
+	else if (getNum(&scan))
+	    stepcnt = llabs(scan.num);
 	else
 	    printf("Step count?\n");
-        if (! traceflag) writeInstruction(reg[7], NOTRACE);
+        if (! traceflag) writeInstruction(tm->reg[7], NOTRACE);
         break;
 
     case 'e':
         /***********************************/
     { int cnt;
-            printf("EXEC STAT: Number of instructions executed: %d\n", instrCount);
-            printf("EXEC STAT: Number of output instructions executed: %d\n", outputInstrCount);
+        TMSTATS st;
+        TMCOVERAGE cov;
+
+            printf("EXEC STAT: Number of instructions executed: %lld\n", tm->instrCount);
+            printf("EXEC STAT: Number of output instructions executed: %d\n", tm->outputInstrCount);
 
 	    cnt = 0;
-	    for (i = 0; i<IADDR_SIZE; i++) if (iMemTag[i]==USED) cnt++;
+	    for (i = 0; i<tm->iMemSize; i++) if (tm->iMemTag[i]==USED) cnt++;
 	    printf("EXEC STAT: Instruction memory used: %d\n", cnt);
 
 	    cnt = 0;
-	    for (i = 0; i<IADDR_SIZE; i++) if (dMemTag[i]>=0) cnt++;
+	    for (i = 0; i<tm->dMemSize; i++) if (tm->dMemTag[i]>0) cnt++;
 	    printf("EXEC STAT: Data memory touched: %d\n", cnt);
+            if (tm->leanRan) printf("EXEC STAT: (lean mode go since last clear: stores were not recorded)\n");
 
 	    cnt = 0;
-	    for (i = 0; i<IADDR_SIZE; i++) if (dMemTag[i]==READONLY) cnt++;
+	    for (i = 0; i<tm->dMemSize; i++) if (tm->dMemTag[i]==READONLY) cnt++;
 	    printf("EXEC STAT: Read only memory: %d\n", cnt);
+
+            tmGetStats(tm, &st);
+            printf("EXEC STAT: Run time: %.6f s wall, %.6f s CPU (%.0f instructions per second)\n",
+                   st.wallSeconds, st.cpuSeconds, st.instructionsPerSecond);
+            if (st.frames) {
+                printf("EXEC STAT: Peak stack depth: %lld words (lowest frame pointer: %lld)\n",
+                       st.stackWords, st.lowestFp);
+                printf("EXEC STAT: Peak call depth: %d\n", st.callDepth);
+                if (st.globalWords)
+                    printf("EXEC STAT: Globals and LIT in use: %lld words (down to dMem loc %lld)\n",
+                           st.globalWords, tm->dMemSize - st.globalWords);
+                else printf("EXEC STAT: Globals and LIT in use: none\n");
+            }
+            else printf("EXEC STAT: The frame pointer (r1) was never set: no stack statistics\n");
+            printf("EXEC STAT: Words copied by MOV: %lld, set by SET: %lld, compared by CO/COA: %lld\n",
+                   st.movWords, st.setWords, st.coWords);
+            if (tm->coverMap) {
+                tmGetCoverage(tm, &cov);
+                printf("EXEC STAT: Coverage: %d of %d instructions, %d of %d lines, %d of %d functions\n",
+                       cov.instructionsHit, cov.instructions, cov.linesHit, cov.lines,
+                       cov.functionsHit, cov.functions);
+            }
+    }
+    break;
+
+    case 'f':
+        /***********************************/
+    { int op;
+        long long int saved, total;
+        static const char *fuseName[fxEND];
+        static int fuseLen[fxEND];
+
+        fuseName[fxLDLDOP] = "LD,LD,op";   fuseLen[fxLDLDOP] = 3;
+        fuseName[fxSTLD] = "ST,LD";        fuseLen[fxSTLD] = 2;
+        fuseName[fxSTLDV] = "ST,LD lean";  fuseLen[fxSTLDV] = 2;
+        fuseName[fxCALL] = "LDA,JMP";      fuseLen[fxCALL] = 2;
+        fuseName[fxLDLDJMP] = "LD,LD,JMP"; fuseLen[fxLDLDJMP] = 3;
+
+        total = 0;
+        for (op = fxLDLDOP; op<=fxLDLDJMP; op++) {
+            saved = tm->fuseRuns[op]*(fuseLen[op]-1);
+            total += saved;
+            printf("FUSE STAT: %-10s  sites: %5d  executed: %10lld  dispatches saved: %10lld\n",
+                   fuseName[op], tm->fuseSites[op], tm->fuseRuns[op], saved);
+        }
+        printf("FUSE STAT: Total dispatches saved: %lld of %lld instructions executed\n", total, tm->instrCount);
+        printf("BLOCK STAT: Blocks translated: %d  micro-ops: %d  block starts marked: %d\n",
+               tm->blocksMade, tm->blockCodeUsed, blockStarts(tm));
+        if (tm->jitflag) printf("JIT STAT: Blocks compiled: %d  code bytes: %d\n",
+                                tm->jitBlocks, tm->jitUsed - tm->jitFirst);
     }
     break;
 
@@ -1507,18 +1079,18 @@ int doCommand(void)
     case 'r':
         /***********************************/
 	for (i = 0; i<NO_REGS; i++) {
-	    printf("r[%1d]: %-4lld   ", i, reg[i]);
+	    printf("r[%1d]: %-4lld   ", i, tm->reg[i]);
 	    if ((i%4) == 3) printf("\n");
 	}
 	break;
 
     case '=':
         /***********************************/
-	if (getNum()) {
-	    loc = num;
-	    if (getNum()) {
+	if (getNum(&scan)) {
+	    loc = scan.num;
+	    if (getNum(&scan)) {
 		if (loc<0 || loc>=NO_REGS) printf("%d is not a legal register number\n", loc);
-		else reg[loc] = num;
+		else tmSetReg(tm, loc, scan.num);
 	    }
 	    else printf("Register value?\n");
 	}
@@ -1527,8 +1099,8 @@ int doCommand(void)
 
         /***********************************/
     case 'n':
-	iloc = reg[PC_REG];
-	if ((iloc >= 0) && (iloc<IADDR_SIZE)) writeInstruction(iloc, TRACE);
+	iloc = tm->reg[PC_REG];
+	if ((iloc >= 0) && (iloc<tm->iMemSize)) writeInstruction(iloc, TRACE);
 	break;
 
     case 'i':
@@ -1538,23 +1110,23 @@ int doCommand(void)
 
         usedonly = 1;
         imemStart = 0;
-        imemCount = IADDR_SIZE;
+        imemCount = tm->iMemSize;
         dmemDown = 1;
-        if (getNum()) {
+        if (getNum(&scan)) {
             usedonly = 0;
-            imemStart = num;
-            if (getNum()) {
+            imemStart = scan.num;
+            if (getNum(&scan)) {
                 imemDown = +1;
-                if (num<0) imemDown = -1;
-                imemCount = llabs(num);
+                if (scan.num<0) imemDown = -1;
+                imemCount = llabs(scan.num);
             }
         }
         iloc = imemStart;
         printcnt = imemCount;
 
         for (i=0; i<printcnt; i++, iloc+=imemDown) {
-            iloc = (DADDR_SIZE + iloc) % DADDR_SIZE;
-            if (! usedonly || iMemTag[iloc]!=UNUSED) {
+            iloc = (tm->iMemSize + iloc) % tm->iMemSize;
+            if (! usedonly || tm->iMemTag[iloc]!=UNUSED) {
                 writeInstruction(iloc, NOTRACE);
             }
         }
@@ -1567,34 +1139,35 @@ int doCommand(void)
         int usedonly;
 
         usedonly = 1;
-        dmemStart = DADDR_SIZE-1;
-        dmemCount = DADDR_SIZE;
+        dmemStart = tm->dMemSize-1;
+        dmemCount = tm->dMemSize;
         dmemDown = -1;
-        if (getNum()) {
+        if (getNum(&scan)) {
             usedonly = 0;
-            dmemStart = num;
-            if (getNum()) {
+            dmemStart = scan.num;
+            if (getNum(&scan)) {
                 dmemDown = +1;
-                if (num<0) dmemDown = -1;
-                dmemCount = llabs(num);
+                if (scan.num<0) dmemDown = -1;
+                dmemCount = llabs(scan.num);
             }
         }
         dloc = dmemStart;
         printcnt = dmemCount;
         printf("%5s: %5s", "addr", "value");
         printf("    %s\n", "instr that last assigned this loc");
+        if (tm->leanRan) printf("(lean mode go since last clear: nonzero locs it set show as untracked)\n");
         for (i=0; i<printcnt; i++, dloc+=dmemDown) {
             char *c;
 
-            dloc = (DADDR_SIZE + dloc) % DADDR_SIZE;
-            if (! usedonly || dMemTag[dloc]!=UNUSED) {
-                c = niceChar(dMem[dloc]);
-                if (c) printf("%5d: %5lld '%s'", dloc, dMem[dloc], c);
-                else printf("%5d: %5lld %3s", dloc, dMem[dloc], "");
+            dloc = (tm->dMemSize + dloc) % tm->dMemSize;
+            if (! usedonly || tm->dMemTag[dloc]!=UNUSED || (tm->leanRan && tm->dMem[dloc]!=0)) {
+                c = niceChar(tm->dMem[dloc]);
+                if (c) printf("%5d: %5lld '%s'", dloc, tm->dMem[dloc], c);
+                else printf("%5d: %5lld %3s", dloc, tm->dMem[dloc], "");
 
-                if (dMemTag[dloc]>=0)
-                    printf("    %3d %s\n", dMemTag[dloc], dMemCmt[dloc]);
-                else if (dMemTag[dloc]==UNUSED) printf("    %s\n", "unused");
+                if (tm->dMemTag[dloc]>0)
+                    printf("    %3d %s\n", tm->dMemTag[dloc]-1, (tm->iMemCmt[tm->dMemTag[dloc]-1] ? tm->iMemCmt[tm->dMemTag[dloc]-1] : ""));
+                else if (tm->dMemTag[dloc]==UNUSED) printf("    %s\n", (tm->leanRan && tm->dMem[dloc]!=0 ? "untracked" : "unused"));
                 else printf("    %s\n", "readOnly");
             }
         }
@@ -1602,21 +1175,29 @@ int doCommand(void)
     break;
 
     case '<':
-            if (getNum()) {
-                dloc = num;
-                getNum();
-            }
-            if (dloc >= 0 && dloc<DADDR_SIZE) {
-                dMem[dloc] = num;
+            if (getNum(&scan)) {
+                dloc = scan.num;
+                getNum(&scan);
             }
+            tmSetDMem(tm, dloc, scan.num);
             break;
 
     case 'b':
-	if (atEOL()) {
-	    savedbreakpoint = breakpoint = -1;
+	if (atEOL(&scan)) {
+	    tmRemoveBreakpoint(tm, -1);
 	}
-	else if (getNum())
-	    savedbreakpoint = breakpoint = llabs(num);
+	else if (getNum(&scan)) {
+            memset(&bp, 0, sizeof(bp));
+            bp.addr = llabs(scan.num);
+            bp.compare = tmALWAYS;
+            if (!atEOL(&scan) && !getBreakCondition(&bp))
+                printf("Breakpoint condition must be: if r<r>|<d>|<d>(<s>) ==|!=|<|<=|>|>= <value>\n");
+            else if (!tmAddBreakpoint(tm, &bp)) printf("%s\n", tmMessage(tm));
+        }
+        else if (getWord(&scan) && scan.word[0] == 'l') listBreakpoints();
+        else if (scan.word[0] == 'd' && getNum(&scan)) {
+            if (scan.num<0 || !tmRemoveBreakpoint(tm, scan.num)) printf("No breakpoint at %lld.\n", scan.num);
+        }
 	else
 	    printf("Breakpoint location?\n");
 	break;
@@ -1624,11 +1205,51 @@ int doCommand(void)
 
     case 'c':
         /***********************************/
-	clearMachine();
-	lastpc = 0;
+        if (getWord(&scan) && scan.word[0] == 'r') tmRerun(tm);
+        else tmClear(tm);
+	clearViews();
+	tm->lastpc = 0;
         stepcnt = 0;
 	break;
 
+    case 'z':
+        /***********************************/
+    {
+        int entry;
+
+        if (! getWord(&scan)) scan.word[0] = '\0';
+        else if (scan.word[0]!='r' && scan.word[0]!='m') {
+            printf("Snapshot command must be z, z r(estore) or z m(ain)\n");
+            break;
+        }
+        if (scan.word[0]=='r') {
+            if (snapshot == NULL) printf("No snapshot to restore.\n");
+            else if (! tmRestore(tm, snapshot)) printf("%s\n", tmMessage(tm));
+            else printf("Snapshot restored.  PC is now %lld\n", tm->reg[PC_REG]);
+            break;
+        }
+        if (scan.word[0]=='m') {
+            entry = tmMainEntry(tm);
+            if (entry<0) {
+                printf("No jump to main found.\n");
+                break;
+            }
+            stepResult = srOKAY;
+            for (i = 0; tm->reg[PC_REG]!=entry && stepResult==srOKAY && (abortLimit==0 || i<abortLimit); i++) {
+                stepResult = commandStep();
+            }
+            if (tm->reg[PC_REG]!=entry) {
+                printf("main was not reached.  Status: %s\n", stepResultTab[stepResult]);
+                break;
+            }
+        }
+        tmFreeSnapshot(snapshot);
+        snapshot = tmSnapshot(tm);
+        if (snapshot == NULL) printf("ERROR: no memory for a snapshot\n");
+        else printf("Snapshot taken at PC %lld after %lld instructions.\n", tm->reg[PC_REG], tm->instrCount);
+    }
+    break;
+
     case 'q':
     case 'x':
 	return FALSE;		/* break; */
@@ -1642,14 +1263,27 @@ int doCommand(void)
     stepResult = srOKAY;
     if (stepcnt>0) {
 	if (cmd == 'g') {
-            outputInstrCount = stepcnt = 0;
+            tm->outputInstrCount = stepcnt = 0;
 //	    stepcnt = 0;
+            if (!traceflag && !tm->profileflag && !tm->trace) {
+                /* nothing to check between steps so use the fast engine */
+                stepResult = runSampled(tm, abortLimit, &ran);
+                if (fatalResult((STEPRESULT)stepResult)) fatalStep((STEPRESULT)stepResult);
+                stepcnt = ran;
+                iloc = tm->lastpc;
+            }
+
+            /* stepping (trace or profile) counts as running for e(xecStats */
+            wall = wallTime();
+            cpu = cpuTime();
 	    while ((stepResult == srOKAY) && ((abortLimit==0) || (stepcnt<abortLimit))) {
-		iloc = reg[PC_REG];
-		stepResult = stepTM();
+		iloc = tm->reg[PC_REG];
+		stepResult = commandStep();
 		if (traceflag) writeInstruction(iloc, TRACE);
 		stepcnt++;
 	    }
+            tm->stats.wallSeconds += wallTime() - wall;
+            tm->stats.cpuSeconds += cpuTime() - cpu;
 	    if ((stepcnt>=abortLimit) && (abortLimit!=0)) {
 		stepResult = srHALT;
 		printf("Abort limit reached! (limit = %d) (see 'a' command in help).\n", abortLimit);
@@ -1659,8 +1293,8 @@ int doCommand(void)
 	}
 	else {
 	    while ((stepcnt>0) && (stepResult == srOKAY)) {
-		iloc = reg[PC_REG];
-		stepResult = stepTM();
+		iloc = tm->reg[PC_REG];
+		stepResult = commandStep();
 		if (traceflag) writeInstruction(iloc, TRACE);
 		stepcnt--;
 	    }
@@ -1669,9 +1303,9 @@ int doCommand(void)
 	printf("\nStatus: %s\n", stepResultTab[stepResult]);
 	if (stepResult!=srOKAY) {
 	    printf("Last executed cmd: ");
-	    writeInstruction(lastpc, TRACE);
+	    writeInstruction(tm->lastpc, TRACE);
 	}
-	printf("PC was %d, PC is now %lld\n", lastpc, reg[PC_REG]);
+	printf("PC was %d, PC is now %lld\n", tm->lastpc, tm->reg[PC_REG]);
     }
     return TRUE;
 }				/* doCommand */
@@ -1684,21 +1318,168 @@ int doCommand(void)
 
 int main(int argc, char *argv[])
 {
-    srandom(getpid()*332+1);
-    initOpCodeTab();
+    char *fileName, *inputArg;
+    long size;
+    long long int n, instrLimit, outLimit, seed;
+    int i, iSize, dSize, lean, echo, flameEvery, mode;
+    STEPRESULT result;
+    TMIO io;
+
+    /* TM program output is flushed by outputDone() and the places that
+       wait for input rather than after every character */
+    setvbuf(stdout, outputBuffer, _IOFBF, OUTPUT_BUFFER_SIZE);
+    mode = (isatty(fileno(stdout)) ? omLINE : omBLOCK);
+    scan.in_Line = lineBuffer;
+
+    /* process the command line */
+    fileName = inputArg = NULL;
+    instrLimit = outLimit = seed = -1;
+    iSize = IADDR_SIZE;
+    dSize = DADDR_SIZE;
+    lean = echo = FALSE;
+    flameEvery = FLAME_INTERVAL;
+    for (i = 1; i<argc; i++) {
+        if (strcmp(argv[i], "--run") == 0) runflag = TRUE;
+        else if (strcmp(argv[i], "--json") == 0 && i+1<argc) jsonName = argv[++i];
+        else if (strcmp(argv[i], "--profile") == 0 && i+1<argc) profileName = argv[++i];
+        else if (strcmp(argv[i], "--flame") == 0 && i+1<argc) flameName = argv[++i];
+        else if (strcmp(argv[i], "--flame-interval") == 0 && i+1<argc) {
+            flameEvery = atoi(argv[++i]);
+            if (flameEvery<1) {
+                printf("ERROR: --flame-interval must be at least 1\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--profile-tsv") == 0 && i+1<argc) profileDataName = argv[++i];
+        else if (strcmp(argv[i], "--trace") == 0 && i+1<argc) traceName = argv[++i];
+        else if (strcmp(argv[i], "--coverage") == 0 && i+1<argc) coverageName = argv[++i];
+        else if (strcmp(argv[i], "--jit") == 0) jitflag = TRUE;
+        else if (strcmp(argv[i], "--trace-ring") == 0 && i+1<argc) {
+            traceRing = atoll(argv[++i]);
+            if (traceRing<1) {
+                printf("ERROR: --trace-ring must be at least 1\n");
+                return 1;
+            }
+        }
+        else if ((strcmp(argv[i], "--limit") == 0 || strcmp(argv[i], "--output-limit") == 0 ||
+                  strcmp(argv[i], "--seed") == 0) && i+1<argc) {
+            n = atoll(argv[i+1]);
+            if (n<0 || (n>0x7fffffff && strcmp(argv[i], "--limit") != 0)) {
+                printf("ERROR: %s must be from 0 to %d\n", argv[i], 0x7fffffff);
+                return 1;
+            }
+            if (argv[i][2] == 'l') instrLimit = n;
+            else if (argv[i][2] == 'o') outLimit = n;
+            else seed = n;
+            i++;
+        }
+        else if (strcmp(argv[i], "-L") == 0) lean = TRUE;
+        else if (strcmp(argv[i], "-U") == 0) uncheckedflag = TRUE;
+        else if (strcmp(argv[i], "-i") == 0 && i+1<argc) inputArg = argv[++i];
+        else if (strcmp(argv[i], "-e") == 0) echo = TRUE;
+        else if (strcmp(argv[i], "-W") == 0 && i+1<argc && strchr("blu", argv[i+1][0]) && argv[i+1][0]) {
+            mode = (argv[i+1][0]=='b' ? omBLOCK : (argv[i+1][0]=='l' ? omLINE : omUNBUFFERED));
+            i++;
+        }
+        else if ((strcmp(argv[i], "-I") == 0 || strcmp(argv[i], "-D") == 0) && i+1<argc) {
+            size = atol(argv[i+1]);
+            if (size<1 || size>MAX_ADDR_SIZE) {
+                printf("ERROR: memory size for %s must be from 1 to %d\n", argv[i], MAX_ADDR_SIZE);
+                return 1;
+            }
+            if (argv[i][1] == 'I') iSize = size;
+            else dSize = size;
+            i++;
+        }
+        else if (argv[i][0] == '-') {
+            printf("usage: tm [-I imemsize] [-D dmemsize] [-L] [-U] [-W b|l|u] [-i inputfile [-e]] [file]\n");
+            printf("       tm --run [--limit n] [--output-limit n] [--seed n] [--json file] [options] file\n");
+            printf("       --profile file and --profile-tsv file write an execution profile at exit\n");
+            printf("       --flame file [--flame-interval n] writes sampled call stacks at exit\n");
+            printf("       --trace file [--trace-ring n] records a binary trace (see tmtrace)\n");
+            printf("       --coverage file writes lcov line and function coverage at exit\n");
+            printf("       --jit compiles hot blocks to x86-64 code\n");
+            return 1;
+        }
+        else fileName = argv[i];
+    }
 
-    printVersion();
+    tm = tmNew(iSize, dSize);
+    if (tm == NULL) {
+        printf("ERROR: unable to map memory for TM\n");
+        return 1;
+    }
+    tmSetOutputMode(tm, (OUTPUTMODE)mode);
+    tmSetLean(tm, lean);
+    if (uncheckedflag && ! tmSetUnchecked(tm, TRUE)) {
+        printf("%s\n", tmMessage(tm));
+        return 1;
+    }
+    if (jitflag && ! tmSetJit(tm, TRUE)) printf("%s\n", tmMessage(tm));
+    if (coverageName && ! tmSetCoverage(tm, TRUE)) {
+        printf("%s\n", tmMessage(tm));
+        return 1;
+    }
+    tm->inputEcho = echo;
+    tm->profileflag = (profileName || profileDataName);
+    tm->flameflag = (flameName != NULL);
+    tm->flameInterval = tm->flameLeft = flameEvery;
+    if (inputArg && ! tmSetInputFile(tm, inputArg)) {
+        printf("%s\n", tmMessage(tm));
+        return 1;
+    }
+
+    /* --run has no limits and a fixed seed unless told otherwise */
+    if (runflag) {
+        if (fileName == NULL) {
+            printf("ERROR: --run needs a file to run\n");
+            return RUN_FAIL_STATUS;
+        }
+        runLimit = (instrLimit<0 ? 0 : instrLimit);
+        tmSetOutputLimit(tm, (outLimit<0 ? 0 : outLimit));
+        if (seed<0) seed = 1;
+        if (inputArg == NULL && ! tmSetInputFile(tm, "-")) return RUN_FAIL_STATUS;
+    }
+    else {
+        if (instrLimit>0x7fffffff) {
+            printf("ERROR: --limit must be from 0 to %d\n", 0x7fffffff);
+            return 1;
+        }
+        if (instrLimit>=0) abortLimit = instrLimit;
+        if (outLimit>=0) tmSetOutputLimit(tm, outLimit);
+    }
+    tmSetSeed(tm, (seed>=0 ? seed : getpid()*332+1));
+
+    /* without -i the input instructions read lines the way commands are read */
+    if (inputArg == NULL && ! runflag) {
+        memset(&io, 0, sizeof(io));
+        io.input = commandInput;
+        tmSetIO(tm, &io);
+    }
 
-    /* guarantee a full clear even if the file load fails */
-    fullClearMachine();
+    /* run the program with no command loop */
+    if (runflag) {
+        runStart = wallTime();
+        if (! loadProgram(fileName)) runSummary("load_error", RUN_FAIL_STATUS);
+        if (traceName && ! startTrace(traceName, traceRing)) return RUN_FAIL_STATUS;
+        runStart = wallTime();
+        result = tmRun(tm, runLimit, NULL);
+        if (fatalResult(result)) fatalStep(result);
+        runExit(result);
+    }
+
+    printVersion();
+    clearViews();
 
     /* read the program if supplied as an argument */
-    if (argc == 2) readInstructions(argv[1]);
+    if (fileName) loadProgram(fileName);
+    if (traceName) startTrace(traceName, traceRing);
 
     /* do stuff */
     while (doCommand());
 
+    writeProfileFiles();
     printf("Bye.\n");
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,859 @@
+// // // // // // // // // // // // // // // // // // // // // // // //
+//
+// File: tm2c.c
+// Translate a TM program into a C program that runs it natively
+//
+// The program is loaded by libtm, the machine tm is built on, so .tm
+// text and .tmb images are read exactly as tm reads them.
+// Each instruction becomes a few lines of C under a label.  Jumps with
+// a target known at translation time are gotos.  Jumps through a
+// register, such as the JMP 7,0(3) of a return, go through a switch over
+// the addresses a program can compute: the return addresses made by
+// LDA r,d(7) and every address that is also a direct jump target.  With
+// -a every instruction is in the switch.
+//
+// The translated program behaves like tm --run: the same output, the
+// same error messages and the same exit status (see runExit() in tm.c).
+// Register 7 is the pc.  Reading it gives the address of the next
+// instruction and writing it jumps.  There is no instruction limit.
+//
+// TO COMPILE: make tm2c     (or gcc tm2c.c libtm.c -o tm2c -pthread)
+// TO RUN:     tm2c [-I imemsize] [-D dmemsize] [-a] [-o out.c] file
+//             cc -O2 out.c -o prog
+//             prog [-i inputfile] [--output-limit n] [--seed n]
+//             -I and -D must match the sizes tm would run file with.
+//             out.c defaults to file with its extension replaced by .c
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "tmMachine.h"
+
+char *tm2cVersion = (char *)"tm2c for TM version " TM_VERSION;
+
+// The runtime each translation starts with.  It is the part of tm that
+// a program can reach at run time: data memory with its bounds and read
+// only checks, the streaming input of -i, buffered output with the
+// output limit and the block instructions.  It is kept in step with
+// setDMem(), getDMem(), streamInput() and the block kernels in libtm.c.
+static const char *runtime[] = {
+    "#define _DEFAULT_SOURCE",
+    "#include <stdio.h>",
+    "#include <stdlib.h>",
+    "#include <string.h>",
+    "#include <ctype.h>",
+    "#include <unistd.h>",
+    "",
+    "#define TMADD(x, y) ((long long int)((unsigned long long int)(x) + (unsigned long long int)(y)))",
+    "#define TMSUB(x, y) ((long long int)((unsigned long long int)(x) - (unsigned long long int)(y)))",
+    "#define TMMUL(x, y) ((long long int)((unsigned long long int)(x) * (unsigned long long int)(y)))",
+    "#define TMNEG(x) ((long long int)(0ULL - (unsigned long long int)(x)))",
+    "#define COMPARE_CHUNK 64",
+    "",
+    "static long long int D[DSIZE];",
+    "static unsigned char RO[DSIZE - RO_LOW + 1];   /* LIT locations from RO_LOW up */",
+    "static int outputLimit = 0;",
+    "static int lineMode = 0;",
+    "static char outputBuffer[1<<16];",
+    "static FILE *inputFile = NULL;",
+    "static const char *inputName = \"-\";",
+    "",
+    "static const char *resultTab[] = {",
+    "    \"OK\",",
+    "    \"Halted\",",
+    "    \"ERROR: Instruction Memory Fault\",",
+    "    \"ERROR: Set Data Memory Range Fault\",",
+    "    \"ERROR: Set of Readonly Data Memory\",",
+    "    \"ERROR: Read Data Memory Range Fault\",",
+    "    \"ERROR: Division by 0\",",
+    "    \"ERROR: Output Instruction Limit Exceeded\"",
+    "};",
+    "",
+    "static void tmHalt(void)",
+    "{",
+    "    fflush(stdout);",
+    "    exit(0);",
+    "}",
+    "",
+    "/* stop with a STEPRESULT as tm --run does */",
+    "static void tmFault(int pc, int result)",
+    "{",
+    "    fflush(stdout);",
+    "    fprintf(stderr, \"%s: %s at addr %d\\n\", pgmName, resultTab[result], pc);",
+    "    exit(result);",
+    "}",
+    "",
+    NULL
+};
+
+// the parts of the runtime for helpers the code may not call.  Each is
+// written only if emitInstruction() used it (see helpers).
+static const char *runtimeGet[] = {
+    "static long long int tmGet(int pc, int m)",
+    "{",
+    "    if (m<0 || m>=DSIZE) {",
+    "        printf(\"ERROR(getDMem): instruction at addr %d attempting to get out of bounds data memory at loc: %d\\n\", pc, m);",
+    "        tmFault(pc, 5);",
+    "    }",
+    "    return D[m];",
+    "}",
+    "",
+    NULL
+};
+
+static const char *runtimeSet[] = {
+    "static void tmSet(int pc, int m, long long int value)",
+    "{",
+    "    if (m<0 || m>=DSIZE) {",
+    "        printf(\"ERROR(setDMem): instruction at addr %d attempting to set out of bounds data memory at loc: %d\\n\", pc, m);",
+    "        tmFault(pc, 3);",
+    "    }",
+    "    if (m>=RO_LOW && RO[m-RO_LOW]) {",
+    "        printf(\"ERROR(setDMem): instruction at addr %d attempting to set data memory marked as read only at loc: %d\\n\", pc, m);",
+    "        tmFault(pc, 4);",
+    "    }",
+    "    D[m] = value;",
+    "}",
+    "",
+    NULL
+};
+
+static const char *runtimeOutput[] = {
+    "static int outputCount = 0;",
+    "",
+    "static void tmOutput(int pc)",
+    "{",
+    "    outputCount++;",
+    "    if (outputCount>outputLimit && outputLimit!=0) tmFault(pc, 7);",
+    "}",
+    "",
+    "static void tmOutputDone(int newline)",
+    "{",
+    "    if (lineMode && newline) fflush(stdout);",
+    "}",
+    "",
+    NULL
+};
+
+static const char *runtimeInput[] = {
+    "#define INGETC() getc_unlocked(inputFile)",
+    "",
+    "static void tmInputFail(int pc, const char *op, const char *msg)",
+    "{",
+    "    char text[40];",
+    "    int c, i;",
+    "",
+    "    fflush(stdout);",
+    "    i = 0;",
+    "    while (i<(int)sizeof(text)-1 && (c = INGETC())!=EOF && c!='\\n') text[i++] = c;",
+    "    text[i] = '\\0';",
+    "    if (i==0 && c==EOF) printf(\"ERROR(%s): instruction at addr %d found end of input in %s\\n\", op, pc, inputName);",
+    "    else printf(\"%s in %s: \\\"%s\\\"\\n\", msg, inputName, text);",
+    "    fflush(stdout);",
+    "    exit(1);",
+    "}",
+    "",
+    "static int tmInputValueEnd(void)",
+    "{",
+    "    int c, halt;",
+    "",
+    "    while ((c = INGETC())==' ' || c=='\\t');",
+    "    halt = (c=='#');",
+    "    if (halt) while ((c = INGETC())==' ' || c=='\\t');",
+    "    if (c=='\\r') c = INGETC();",
+    "    if (c!='\\n' && c!=EOF) ungetc(c, inputFile);",
+    "    return halt;",
+    "}",
+    "",
+    "/* IN (op 0), INB (1) and INC (2).  Returns 1 if the input halts TM. */",
+    "static int tmInput(int pc, int op, long long int *r)",
+    "{",
+    "    static const char *name[] = {\"IN\", \"INB\", \"INC\"};",
+    "    int c, sign, ok;",
+    "    long long int term, value;",
+    "",
+    "    if (op == 2) {",
+    "        if ((c = INGETC())==EOF) tmInputFail(pc, name[op], \"\");",
+    "        *r = (char)c;",
+    "        return 0;",
+    "    }",
+    "",
+    "    while (isspace(c = INGETC()));",
+    "    if (c==EOF) tmInputFail(pc, name[op], \"\");",
+    "",
+    "    value = 0;",
+    "    if (op == 1) {",
+    "        value = !(c=='F' || c=='f' || c=='0');",
+    "        while (isalnum(c) || c=='=' || c=='?') c = INGETC();",
+    "    }",
+    "    else {",
+    "        ok = 0;",
+    "        do {",
+    "            sign = 1;",
+    "            while ((c == '+') || (c == '-')) {",
+    "                ok = 0;",
+    "                if (c == '-') sign = -sign;",
+    "                c = INGETC();",
+    "            }",
+    "            term = 0;",
+    "            while (isdigit(c)) {",
+    "                ok = 1;",
+    "                term = term*10 + (c - '0');",
+    "                c = INGETC();",
+    "            }",
+    "            value = value + (term*sign);",
+    "        }",
+    "        while ((c == '+') || (c == '-'));",
+    "        if (!ok) {",
+    "            if (c!=EOF) ungetc(c, inputFile);",
+    "            tmInputFail(pc, name[op], \"Illegal value in input\");",
+    "        }",
+    "    }",
+    "    if (c!=EOF) ungetc(c, inputFile);",
+    "",
+    "    *r = value;",
+    "    return tmInputValueEnd();",
+    "}",
+    "",
+    NULL
+};
+
+static const char *runtimeRangeOk[] = {
+    "/* is D[hi-n+1 .. hi] in bounds? */",
+    "static int tmRangeOk(int hi, long long int n)",
+    "{",
+    "    return n>0 && hi<DSIZE && hi-n+1>=0;",
+    "}",
+    "",
+    NULL
+};
+
+static const char *runtimeRangeWritable[] = {
+    "/* is D[hi-n+1 .. hi] in bounds and free of read only locations? */",
+    "static int tmRangeWritable(int hi, long long int n)",
+    "{",
+    "    int a;",
+    "",
+    "    if (! tmRangeOk(hi, n)) return 0;",
+    "    if (hi<RO_LOW) return 1;",
+    "    for (a = hi-n+1; a<=hi; a++) if (a>=RO_LOW && RO[a-RO_LOW]) return 0;",
+    "    return 1;",
+    "}",
+    "",
+    NULL
+};
+
+static const char *runtimeMove[] = {
+    "static void tmMoveBlock(int raddr, int saddr, int n)",
+    "{",
+    "    int i;",
+    "",
+    "    if (raddr>=saddr || saddr-raddr>=n) {",
+    "        memmove(&D[raddr-n+1], &D[saddr-n+1], (size_t)n*sizeof(long long int));",
+    "    }",
+    "    else {",
+    "        for (i = 0; i<n; i++) D[raddr-i] = D[saddr-i];",
+    "    }",
+    "}",
+    "",
+    NULL
+};
+
+static const char *runtimeEqual[] = {
+    "static int tmEqualBlock(int raddr, int saddr, int n)",
+    "{",
+    "    int i, len;",
+    "",
+    "    i = 0;",
+    "    while (i<n) {",
+    "        len = (n-i<COMPARE_CHUNK ? n-i : COMPARE_CHUNK);",
+    "        if (memcmp(&D[raddr-i-len+1], &D[saddr-i-len+1], (size_t)len*sizeof(long long int)) != 0) break;",
+    "        i += len;",
+    "    }",
+    "    while (i<n && D[raddr-i]==D[saddr-i]) i++;",
+    "    return i;",
+    "}",
+    "",
+    NULL
+};
+
+// and the rest, always written
+static const char *runtimeEnd[] = {
+    "/* a jump to an address with no label */",
+    "static void tmNoCode(int target)",
+    "{",
+    "    int lo, hi, mid;",
+    "",
+    "    if (target<0 || target>=ISIZE) tmFault(target, 2);",
+    "    lo = 0;",
+    "    hi = LOADED_COUNT - 1;",
+    "    while (lo<=hi) {",
+    "        mid = (lo + hi)/2;",
+    "        if (loaded[mid] == target) {",
+    "            fflush(stdout);",
+    "            fprintf(stderr, \"%s: jump to addr %d which was not translated as a jump target (see tm2c -a)\\n\", pgmName, target);",
+    "            exit(1);",
+    "        }",
+    "        if (loaded[mid]<target) lo = mid + 1;",
+    "        else hi = mid - 1;",
+    "    }",
+    "    tmHalt();   /* an unused address holds HALT 0,0,0 */",
+    "}",
+    "",
+    "#undef INGETC",
+    NULL
+};
+
+
+TMMachine *tm;             // the loaded program
+int allTargets = FALSE;    // -a: every instruction can be reached by a computed jump
+char *label;               // label[a]: address a gets a label and a case in the dispatch
+int helpers;               // the parts of the runtime the code calls (use bits)
+
+// use bits: which optional parts of the runtime emitInstruction() called
+#define useGET 1
+#define useSET 2
+#define useOUTPUT 4
+#define useINPUT 8
+#define useRANGE 16
+#define useWRITABLE (32 | useRANGE)
+#define useMOVE 64
+#define useEQUAL 128
+
+
+/* a long long as a C constant */
+char *cConst(long long int v)
+{
+    static char text[4][40];
+    static int next = 0;
+    char *p;
+
+    p = text[next];
+    next = (next + 1)%4;
+    if (v == (-0x7fffffffffffffffLL - 1)) sprintf(p, "(-0x7fffffffffffffffLL - 1)");
+    else sprintf(p, "%lldLL", v);
+    return p;
+}
+
+
+int loaded(long long int a)
+{
+    return a>=0 && a<tm->iMemTop && tm->iMemTag[a]==USED;
+}
+
+
+/* the target of a jump by the instruction at a if it is a constant */
+int staticTarget(int a, long long int *target)
+{
+    INSTRUCTION *in;
+
+    in = &tm->iMem[a];
+    switch (in->iop) {
+    case opLDC:
+        if (in->iarg1 != PC_REG) return FALSE;
+        *target = in->iarg2;
+        return TRUE;
+    case opLDA:
+        if (in->iarg1 != PC_REG) return FALSE;
+        /* fall through */
+    case opJZR:
+    case opJNZ:
+    case opJMP:
+        if (in->iarg3 != PC_REG) return FALSE;
+        *target = in->iarg2 + a + 1;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+
+/* choose the addresses that get labels */
+void findLabels(void)
+{
+    INSTRUCTION *in;
+    long long int target;
+    int a;
+
+    label = (char *)calloc(tm->iMemSize + 1, 1);
+    if (loaded(tm->entryPc)) label[tm->entryPc] = TRUE;
+    for (a = 0; a<tm->iMemTop; a++) {
+        if (!loaded(a)) continue;
+        in = &tm->iMem[a];
+        if (allTargets) label[a] = TRUE;
+
+        /* direct jumps */
+        if (staticTarget(a, &target) && loaded(target)) label[target] = TRUE;
+
+        /* return addresses: LDA r,d(7) puts an address in a register */
+        if (in->iop == opLDA && in->iarg3 == PC_REG && in->iarg1 != PC_REG) {
+            target = in->iarg2 + a + 1;
+            if (loaded(target)) label[target] = TRUE;
+        }
+    }
+}
+
+
+/* write the lines of a part of the runtime */
+void emitLines(FILE *out, const char **line)
+{
+    for (; *line; line++) fprintf(out, "%s\n", *line);
+}
+
+
+/* jump to target (a C expression) through the dispatch */
+void emitJump(FILE *out, const char *target)
+{
+    fprintf(out, "{ target = (int)(%s); goto dispatch; }", target);
+}
+
+
+/* jump to a target known now */
+void emitStaticJump(FILE *out, long long int target)
+{
+    if (loaded(target)) fprintf(out, "goto L%lld;", target);
+    else emitJump(out, cConst(target));
+}
+
+
+/* the data address d(s) of an RA instruction at a */
+char *address(int a, INSTRUCTION *in)
+{
+    static char text[80];
+
+    if (in->iarg3 == PC_REG) return cConst(in->iarg2 + a + 1);
+    if (in->iarg2 == 0) sprintf(text, "r%lld", in->iarg3);
+    else sprintf(text, "TMADD(%s, r%lld)", cConst(in->iarg2), in->iarg3);
+    return text;
+}
+
+
+/* the C for one instruction.  Register 7 is r7 set to the address of
+   the next instruction before any instruction that names it. */
+void emitInstruction(FILE *out, int a)
+{
+    INSTRUCTION *in;
+    long long int r, s, t, target;
+    char *m, *p, *comment;
+    int writes7;
+
+    in = &tm->iMem[a];
+    r = in->iarg1;
+    s = in->iarg2;
+    t = in->iarg3;
+
+    if (label[a]) fprintf(out, "L%d:\n", a);
+    fprintf(out, "    /* %d: %s ", a, opCodeTab[in->iop]);
+    if (opClass(in->iop) == opclRR) fprintf(out, "%lld,%lld,%lld", r, s, t);
+    else fprintf(out, "%lld,%lld(%lld)", r, s, t);
+    comment = tm->iMemCmt[a];
+    if (comment && *comment) {
+        fprintf(out, "  ");
+        for (p = comment; *p; p++) {
+            if (*p == '*' && p[1] == '/') fputs("* ", out);
+            else if ((unsigned char)*p >= ' ') putc(*p, out);
+        }
+    }
+    fprintf(out, " */\n");
+
+    /* jumps */
+    if (staticTarget(a, &target)) {
+        if (r == PC_REG && (in->iop == opJZR || in->iop == opJNZ)) fprintf(out, "    r7 = %d;\n", a + 1);
+        if (in->iop == opJZR) fprintf(out, "    if (r%lld == 0) ", r);
+        else if (in->iop == opJNZ) fprintf(out, "    if (r%lld != 0) ", r);
+        else fprintf(out, "    ");
+        emitStaticJump(out, target);
+        fprintf(out, "\n");
+        return;
+    }
+    if (opClass(in->iop) == opclRA) {
+        m = address(a, in);
+        if (in->iop == opJZR || in->iop == opJNZ || in->iop == opJMP || (in->iop == opLDA && r == PC_REG)) {
+            if (r == PC_REG || t == PC_REG) fprintf(out, "    r7 = %d;\n", a + 1);
+            if (in->iop == opJZR) fprintf(out, "    if (r%lld == 0) ", r);
+            else if (in->iop == opJNZ) fprintf(out, "    if (r%lld != 0) ", r);
+            else fprintf(out, "    ");
+            emitJump(out, m);
+            fprintf(out, "\n");
+            return;
+        }
+    }
+
+    /* everything else.  An instruction that names register 7 sees the
+       next address in r7 and jumps if it changes it. */
+    writes7 = FALSE;
+    if (opClass(in->iop) == opclRR) {
+        if (r == PC_REG || s == PC_REG || t == PC_REG) fprintf(out, "    r7 = %d;\n", a + 1);
+    }
+    else {
+        if (r == PC_REG || t == PC_REG) fprintf(out, "    r7 = %d;\n", a + 1);
+    }
+
+    switch (in->iop) {
+    case opHALT:
+        fprintf(out, "    tmHalt();\n");
+        return;
+    case opNOP:
+        break;
+    case opIN:
+    case opINB:
+        fprintf(out, "    if (tmInput(%d, %d, &r%lld)) tmHalt();\n", a, (in->iop == opIN ? 0 : 1), r);
+        helpers |= useINPUT;
+        writes7 = (r == PC_REG);
+        break;
+    case opINC:
+        fprintf(out, "    tmInput(%d, 2, &r%lld);\n", a, r);
+        helpers |= useINPUT;
+        writes7 = (r == PC_REG);
+        break;
+    case opOUT:
+        fprintf(out, "    tmOutput(%d);\n    printf(\"%%lld \", r%lld);\n    tmOutputDone(0);\n", a, r);
+        helpers |= useOUTPUT;
+        break;
+    case opOUTB:
+        fprintf(out, "    tmOutput(%d);\n    fputs(r%lld ? \"T \" : \"F \", stdout);\n    tmOutputDone(0);\n", a, r);
+        helpers |= useOUTPUT;
+        break;
+    case opOUTC:
+        fprintf(out, "    tmOutput(%d);\n    putchar((char)r%lld);\n    tmOutputDone((char)r%lld=='\\n');\n", a, r, r);
+        helpers |= useOUTPUT;
+        break;
+    case opOUTNL:
+        fprintf(out, "    tmOutput(%d);\n    putchar('\\n');\n    tmOutputDone(1);\n", a);
+        helpers |= useOUTPUT;
+        break;
+    case opADD:
+        fprintf(out, "    r%lld = TMADD(r%lld, r%lld);\n", r, s, t);
+        writes7 = (r == PC_REG);
+        break;
+    case opSUB:
+        fprintf(out, "    r%lld = TMSUB(r%lld, r%lld);\n", r, s, t);
+        writes7 = (r == PC_REG);
+        break;
+    case opMUL:
+        fprintf(out, "    r%lld = TMMUL(r%lld, r%lld);\n", r, s, t);
+        writes7 = (r == PC_REG);
+        break;
+    case opDIV:
+        fprintf(out, "    if (r%lld == 0) tmFault(%d, 6);\n    r%lld = r%lld/r%lld;\n", t, a, r, s, t);
+        writes7 = (r == PC_REG);
+        break;
+    case opMOD:
+        fprintf(out, "    if (r%lld == 0) tmFault(%d, 6);\n", t, a);
+        fprintf(out, "    { long long int tmp = r%lld%%r%lld; if (tmp<0) tmp += llabs(r%lld); r%lld = tmp; }\n", s, t, t, r);
+        writes7 = (r == PC_REG);
+        break;
+    case opAND:
+        fprintf(out, "    r%lld = r%lld & r%lld;\n", r, s, t);
+        writes7 = (r == PC_REG);
+        break;
+    case opOR:
+        fprintf(out, "    r%lld = r%lld | r%lld;\n", r, s, t);
+        writes7 = (r == PC_REG);
+        break;
+    case opXOR:
+        fprintf(out, "    r%lld = r%lld ^ r%lld;\n", r, s, t);
+        writes7 = (r == PC_REG);
+        break;
+    case opNOT:
+        fprintf(out, "    r%lld = ~r%lld;\n", r, s);
+        writes7 = (r == PC_REG);
+        break;
+    case opNEG:
+        fprintf(out, "    r%lld = TMNEG(r%lld);\n", r, s);
+        writes7 = (r == PC_REG);
+        break;
+    case opSWP:
+        if (r == s) break;
+        fprintf(out, "    if (r%lld > r%lld) { long long int tmp = r%lld; r%lld = r%lld; r%lld = tmp; }\n", r, s, r, r, s, s);
+        writes7 = (r == PC_REG || s == PC_REG);
+        break;
+    case opRND:
+        fprintf(out, "    if (r%lld == 0) tmFault(%d, 6);\n    r%lld = random()%%llabs(r%lld);\n", s, a, r, s);
+        writes7 = (r == PC_REG);
+        break;
+    case opTLT:
+    case opTLE:
+    case opTGT:
+    case opTGE:
+    case opTEQ:
+    case opTNE:
+        if (s == t) {           // known, and no self-comparison for cc to warn about
+            fprintf(out, "    r%lld = %d;\n", r, (in->iop == opTLE || in->iop == opTGE || in->iop == opTEQ));
+            writes7 = (r == PC_REG);
+            break;
+        }
+        fprintf(out, "    r%lld = (r%lld %s r%lld ? 1 : 0);\n", r, s,
+                (in->iop == opTLT ? "<" : in->iop == opTLE ? "<=" : in->iop == opTGT ? ">" :
+                 in->iop == opTGE ? ">=" : in->iop == opTEQ ? "==" : "!="), t);
+        writes7 = (r == PC_REG);
+        break;
+    case opSLT:
+    case opSGT:
+        if (s == t) {
+            fprintf(out, "    r%lld = 0;\n", r);
+            writes7 = (r == PC_REG);
+            break;
+        }
+        fprintf(out, "    if (r%lld>=0) r%lld = (r%lld %s r%lld ? 1 : 0);\n", r, r, s, (in->iop == opSLT ? "<" : ">"), t);
+        fprintf(out, "    else r%lld = (r%lld %s r%lld ? 1 : 0);\n", r, t, (in->iop == opSLT ? "<" : ">"), s);
+        writes7 = (r == PC_REG);
+        break;
+
+    /* the block instructions as the word at a time loops of tm, with
+       the whole block done at once when it is all in bounds */
+    case opMOV:
+        fprintf(out, "    { int raddr = r%lld, saddr = r%lld, i;\n", r, s);
+        fprintf(out, "      if (tmRangeOk(saddr, r%lld) && tmRangeWritable(raddr, r%lld)) tmMoveBlock(raddr, saddr, r%lld);\n", t, t, t);
+        fprintf(out, "      else for (i=0; i<r%lld; i++) { tmSet(%d, raddr, tmGet(%d, saddr)); raddr--; saddr--; } }\n", t, a, a);
+        helpers |= useWRITABLE | useMOVE | useGET | useSET;
+        break;
+    case opSET:
+        fprintf(out, "    { int raddr = r%lld, svalue = r%lld, i;\n", r, s);
+        fprintf(out, "      if (tmRangeWritable(raddr, r%lld)) for (i=raddr-r%lld+1; i<=raddr; i++) D[i] = svalue;\n", t, t);
+        fprintf(out, "      else for (i=0; i<r%lld; i++) { tmSet(%d, raddr, svalue); raddr--; } }\n", t, a);
+        helpers |= useWRITABLE | useSET;
+        break;
+    case opCO:
+    case opCOA:
+        fprintf(out, "    { int raddr = r%lld, saddr = r%lld, i;\n", r, s);
+        if (in->iop == opCO) fprintf(out, "      if (r%lld==0) { r%lld = 0; r%lld = 0; }\n      else ", t, r, s);
+        else fprintf(out, "      ");
+        if (r!=s && t!=r && t!=s) {
+            fprintf(out, "if (tmRangeOk(raddr, r%lld) && tmRangeOk(saddr, r%lld)) {\n", t, t);
+            fprintf(out, "          i = tmEqualBlock(raddr, saddr, r%lld);\n          if (i==r%lld) i--;\n", t, t);
+            if (in->iop == opCO) fprintf(out, "          r%lld = D[raddr-i];\n          r%lld = D[saddr-i];\n", r, s);
+            else fprintf(out, "          r%lld = raddr-i;\n          r%lld = saddr-i;\n", r, s);
+            fprintf(out, "      }\n      else ");
+            helpers |= useRANGE | useEQUAL;
+        }
+        if (in->iop == opCO) {
+            fprintf(out, "for (i=0; i<r%lld; i++) {\n", t);
+            fprintf(out, "          r%lld = tmGet(%d, raddr);\n          r%lld = tmGet(%d, saddr);\n", r, a, s, a);
+            if (r != s) fprintf(out, "          if (r%lld != r%lld) break;\n", r, s);
+        }
+        else {
+            fprintf(out, "for (i=0; i<r%lld; i++) {\n", t);
+            fprintf(out, "          r%lld = raddr;\n          r%lld = saddr;\n", r, s);
+            fprintf(out, "          if (tmGet(%d, raddr) != tmGet(%d, saddr)) break;\n", a, a);
+        }
+        fprintf(out, "          raddr--;\n          saddr--;\n      } }\n");
+        helpers |= useGET;
+        writes7 = (r == PC_REG || s == PC_REG);
+        break;
+
+    case opLD:
+        fprintf(out, "    r%lld = tmGet(%d, (int)(%s));\n", r, a, address(a, in));
+        helpers |= useGET;
+        writes7 = (r == PC_REG);
+        break;
+    case opST:
+        fprintf(out, "    tmSet(%d, (int)(%s), r%lld);\n", a, address(a, in), r);
+        helpers |= useSET;
+        break;
+    case opLDA:
+        fprintf(out, "    r%lld = %s;\n", r, address(a, in));
+        break;
+    case opLDC:
+        fprintf(out, "    r%lld = %s;\n", r, cConst(s));
+        break;
+    }
+
+    if (writes7) {
+        fprintf(out, "    if ((int)r7 != %d) ", a + 1);
+        emitJump(out, "r7");
+        fprintf(out, "\n");
+    }
+}
+
+
+/* write main(): the setup of the machine and the code of the program */
+void translateMain(FILE *out)
+{
+    int a;
+
+    fprintf(out, "int main(int argc, char *argv[])\n{\n");
+    fprintf(out, "    long long int r0, r1, r2, r3, r4, r5, r6, r7;\n");
+    fprintf(out, "    long long int seed;\n    int target, i;\n\n");
+    fprintf(out, "    seed = 1;\n");
+    fprintf(out, "    for (i = 1; i<argc; i++) {\n");
+    fprintf(out, "        if (strcmp(argv[i], \"-i\") == 0 && i+1<argc) {\n");
+    fprintf(out, "            inputName = argv[++i];\n");
+    fprintf(out, "            if (strcmp(inputName, \"-\") != 0 && (inputFile = fopen(inputName, \"r\")) == NULL) {\n");
+    fprintf(out, "                printf(\"ERROR: unable to open input file: %%s\\n\", inputName);\n");
+    fprintf(out, "                return 1;\n            }\n        }\n");
+    fprintf(out, "        else if (strcmp(argv[i], \"--output-limit\") == 0 && i+1<argc) outputLimit = atoi(argv[++i]);\n");
+    fprintf(out, "        else if (strcmp(argv[i], \"--seed\") == 0 && i+1<argc) seed = atoll(argv[++i]);\n");
+    fprintf(out, "        else {\n");
+    fprintf(out, "            printf(\"usage: %%s [-i inputfile] [--output-limit n] [--seed n]\\n\", argv[0]);\n");
+    fprintf(out, "            return 1;\n        }\n    }\n");
+    fprintf(out, "    if (inputFile == NULL) inputFile = stdin;\n");
+    fprintf(out, "    setvbuf(inputFile, NULL, _IOFBF, 1<<16);\n");
+    fprintf(out, "    setvbuf(stdout, outputBuffer, _IOFBF, sizeof(outputBuffer));\n");
+    fprintf(out, "    lineMode = isatty(fileno(stdout));\n");
+    fprintf(out, "    srandom(seed);\n");
+    fprintf(out, "    for (i = 0; lits[i].loc>=0; i++) {\n");
+    fprintf(out, "        D[lits[i].loc] = lits[i].value;\n");
+    fprintf(out, "        RO[lits[i].loc - RO_LOW] = 1;\n    }\n\n");
+    fprintf(out, "    r0 = DSIZE - 1;\n    r1 = r2 = r3 = r4 = r5 = r6 = r7 = 0;\n");
+    fprintf(out, "    ");
+    emitStaticJump(out, tm->entryPc);
+    fprintf(out, "\n\n");
+
+    for (a = 0; a<tm->iMemTop; a++) {
+        if (!loaded(a)) continue;
+        emitInstruction(out, a);
+
+        /* running off the end of the loaded code */
+        if (!loaded(a + 1)) {
+            fprintf(out, "    ");
+            emitJump(out, cConst(a + 1));
+            fprintf(out, "\n");
+        }
+    }
+
+    fprintf(out, "\ndispatch:\n    switch (target) {\n");
+    for (a = 0; a<tm->iMemTop; a++) {
+        if (label[a]) fprintf(out, "    case %d: goto L%d;\n", a, a);
+    }
+    fprintf(out, "    }\n    tmNoCode(target);\n    (void)r0; (void)r1; (void)r2; (void)r3;\n");
+    fprintf(out, "    (void)r4; (void)r5; (void)r6; (void)r7;\n    return 1;\n}\n");
+}
+
+
+/* write the translation of the loaded program.  The code is made
+   first, in a temporary file, so only the helpers it calls are
+   written.  FALSE if there is nowhere to make it. */
+int translate(FILE *out)
+{
+    FILE *code;
+    char buffer[1<<16];
+    size_t length;
+    int a, n;
+
+    findLabels();
+    code = tmpfile();
+    if (code == NULL) return FALSE;
+    helpers = 0;
+    translateMain(code);
+
+    fprintf(out, "/* %s translated to C by %s.  It runs like tm --run %s */\n\n", tm->pgmName, tm2cVersion, tm->pgmName);
+    fprintf(out, "#define ISIZE %d\n#define DSIZE %d\n#define RO_LOW %d\n", tm->iMemSize, tm->dMemSize, tm->readOnlyLow);
+    fprintf(out, "static const char *pgmName = \"");
+    for (a = 0; tm->pgmName[a]; a++) {
+        if (tm->pgmName[a] == '"' || tm->pgmName[a] == '\\') putc('\\', out);
+        putc(tm->pgmName[a], out);
+    }
+    fprintf(out, "\";\n\n");
+
+    /* the loaded addresses for tmNoCode() */
+    n = 0;
+    fprintf(out, "static const int loaded[] = {");
+    for (a = 0; a<tm->iMemTop; a++) {
+        if (!loaded(a)) continue;
+        fprintf(out, "%s%d", (n%16 ? ", " : (n ? ",\n    " : "\n    ")), a);
+        n++;
+    }
+    fprintf(out, "%s-1\n};\n#define LOADED_COUNT %d\n\n", (n ? ",\n    " : "\n    "), n);
+
+    emitLines(out, runtime);
+    if (helpers & useGET) emitLines(out, runtimeGet);
+    if (helpers & useSET) emitLines(out, runtimeSet);
+    if (helpers & useOUTPUT) emitLines(out, runtimeOutput);
+    if (helpers & useINPUT) emitLines(out, runtimeInput);
+    if (helpers & useRANGE) emitLines(out, runtimeRangeOk);
+    if ((helpers & useWRITABLE) == useWRITABLE) emitLines(out, runtimeRangeWritable);
+    if (helpers & useMOVE) emitLines(out, runtimeMove);
+    if (helpers & useEQUAL) emitLines(out, runtimeEqual);
+    emitLines(out, runtimeEnd);
+
+    /* the LIT data */
+    n = 0;
+    fprintf(out, "\nstatic const struct { int loc; long long int value; } lits[] = {");
+    for (a = tm->readOnlyLow; a<tm->dMemSize; a++) {
+        if (tm->dMemTag[a] != READONLY) continue;
+        fprintf(out, "%s{%d, %s}", (n%4 ? ", " : (n ? ",\n    " : "\n    ")), a, cConst(tm->dMem[a]));
+        n++;
+    }
+    fprintf(out, "%s{-1, 0}\n};\n\n", (n ? ",\n    " : "\n    "));
+
+    rewind(code);
+    while ((length = fread(buffer, 1, sizeof(buffer), code))>0) fwrite(buffer, 1, length, out);
+    fclose(code);
+    return TRUE;
+}
+
+
+int main(int argc, char *argv[])
+{
+    char *fileName, *outName, *p;
+    FILE *out;
+    long size;
+    int i, iSize, dSize;
+    char name[WORDSIZE + 4];
+
+    fileName = outName = NULL;
+    iSize = IADDR_SIZE;
+    dSize = DADDR_SIZE;
+    for (i = 1; i<argc; i++) {
+        if (strcmp(argv[i], "-a") == 0) allTargets = TRUE;
+        else if (strcmp(argv[i], "-o") == 0 && i+1<argc) outName = argv[++i];
+        else if ((strcmp(argv[i], "-I") == 0 || strcmp(argv[i], "-D") == 0) && i+1<argc) {
+            size = atol(argv[i+1]);
+            if (size<1 || size>MAX_ADDR_SIZE) {
+                printf("ERROR: memory size for %s must be from 1 to %d\n", argv[i], MAX_ADDR_SIZE);
+                return 1;
+            }
+            if (argv[i][1] == 'I') iSize = size;
+            else dSize = size;
+            i++;
+        }
+        else if (argv[i][0] == '-' || fileName) {
+            printf("usage: tm2c [-I imemsize] [-D dmemsize] [-a] [-o out.c] file\n");
+            return 1;
+        }
+        else fileName = argv[i];
+    }
+    if (fileName == NULL) {
+        printf("usage: tm2c [-I imemsize] [-D dmemsize] [-a] [-o out.c] file\n");
+        return 1;
+    }
+
+    tm = tmNew(iSize, dSize);
+    if (tm == NULL) {
+        printf("ERROR: unable to map memory for TM\n");
+        return 1;
+    }
+
+    /* the name as tm would take it: with .tm if it has no extension */
+    snprintf(name, WORDSIZE, "%s", fileName);
+    if (strchr(name, '.') == NULL) strcat(name, (char *)".tm");
+    if (access(name, R_OK) == 0) printf("Loading file: %s\n", name);
+    if (! tmLoadFile(tm, name)) {
+        printf("%s\n", tmMessage(tm));
+        return 1;
+    }
+
+    /* prog.tm -> prog.c */
+    if (outName == NULL) {
+        outName = (char *)malloc(strlen(tm->pgmName) + 3);
+        strcpy(outName, tm->pgmName);
+        p = strrchr(outName, '.');
+        if (p && strchr(p, '/') == NULL) *p = '\0';
+        strcat(outName, ".c");
+    }
+    if ((out = fopen(outName, "w")) == NULL) {
+        printf("ERROR: unable to write %s\n", outName);
+        return 1;
+    }
+    if (! translate(out)) {
+        printf("ERROR: no temporary file to translate %s into\n", tm->pgmName);
+        fclose(out);
+        return 1;
+    }
+    fclose(out);
+    printf("Wrote %s\n", outName);
+
+    return 0;
+}
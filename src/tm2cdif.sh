@@ -0,0 +1,61 @@
+# differential test of tm2c against tm
+#
+# usage: tm2cdif.sh dir
+# Every .tm file in dir is run with tm --run and as the program tm2c
+# translates it into, and the output, error output and exit status are
+# compared.  If there is a .in file with the same name it is the input.
+# Both run with tm's usual output limit of 1000 (OUTPUT_LIMIT=n to change
+# it).  The translated programs have no instruction limit so programs
+# that never halt do not belong in dir.  TM2C_FLAGS is passed to tm2c
+# (TM2C_FLAGS=-a for programs that compute their jump addresses) and
+# TM_FLAGS to tm (TM_FLAGS=--jit to check the JIT against tm2c).  The
+# exit status is 0 only if no program differed.
+# Needs ./tm and ./tm2c (make tm tm2c).
+
+tm=./tm
+tm2c=./tm2c
+cc=${CC:-cc}
+limit=${OUTPUT_LIMIT:-1000}
+diffile="tm2cdiff.txt"
+work=tm2c.work
+filesDiff=0
+filesTotal=0
+
+echo "Comparing tm and tm2c on the programs in \"$1\""
+echo ""
+
+rm -f $diffile
+mkdir -p $work
+
+for tmfile in $1/*.tm;
+do
+    infile=/dev/null
+    if [ -f ${tmfile%.tm}.in ]; then infile=${tmfile%.tm}.in; fi
+    filesTotal=$(($filesTotal + 1))
+
+    $tm $TM_FLAGS --run --output-limit $limit $tmfile < $infile > $work/tm.out 2> $work/tm.err
+    echo "exit status $?" >> $work/tm.out
+
+    rm -f $work/prog
+    $tm2c $TM2C_FLAGS -o $work/prog.c $tmfile > /dev/null && $cc -O2 -Wall $work/prog.c -o $work/prog
+    if [ -x $work/prog ]; then
+        $work/prog --output-limit $limit < $infile > $work/tm2c.out 2> $work/tm2c.err
+        echo "exit status $?" >> $work/tm2c.out
+    else
+        echo "tm2c translation failed" > $work/tm2c.out
+        : > $work/tm2c.err
+    fi
+
+    if ! cmp -s $work/tm.out $work/tm2c.out || ! cmp -s $work/tm.err $work/tm2c.err; then
+        filesDiff=$(($filesDiff + 1))
+        echo "====================================" >> $diffile
+        echo "FILE: $tmfile" >> $diffile
+        diff $work/tm.out $work/tm2c.out >> $diffile
+        diff $work/tm.err $work/tm2c.err >> $diffile
+    fi
+done
+rm -rf $work
+
+echo $filesDiff / $filesTotal programs differed. >> $diffile
+cat $diffile
+[ $filesDiff -eq 0 ]
@@ -0,0 +1,66 @@
+#ifndef TMIMAGE_H
+#define TMIMAGE_H
+
+// Binary TM image (.tmb).  Written by c- -B and loaded by tm in place of
+// the .tm text.  All fields are in the byte order of the machine that
+// wrote the image.  The file is laid out as:
+//
+//   TMIMAGE_HEADER
+//   TMIMAGE_INSTR  code[instrCount]       slot i is instruction address i
+//   TMIMAGE_LIT + data words, litCount times
+//   char comments[commentBytes]           '\0' terminated comment strings
+//
+// Instructions that share a comment share its string.
+//
+// A LIT record is followed by length int64 words (the chars of a string
+// LIT) or by a single word when length is TMIMAGE_LIT_NUMBER.  Records
+// are kept in program order because loading them is order dependent
+// exactly like the LIT lines in a .tm file.
+
+#include <stdint.h>
+
+#define TMIMAGE_MAGIC "TMB1"
+#define TMIMAGE_VERSION 1
+#define TMIMAGE_UNUSED -1          // op of an instruction slot never set
+#define TMIMAGE_NO_COMMENT -1      // comment offset when there is none
+#define TMIMAGE_LIT_NUMBER -1      // LIT length for a single number
+
+typedef struct
+{
+    char magic[4];                 // TMIMAGE_MAGIC (no '\0')
+    int32_t version;               // TMIMAGE_VERSION
+    int32_t entry;                 // initial pc
+    int32_t instrCount;            // number of code slots
+    int32_t litCount;              // number of LIT records
+    int32_t litWords;              // total data words after the LIT records
+    int32_t commentBytes;          // size of the comment section (0 if none)
+    int32_t flags;                 // reserved, 0
+} TMIMAGE_HEADER;
+
+typedef struct
+{
+    int32_t op;                    // index into tmImageOpNames or TMIMAGE_UNUSED
+    int32_t comment;               // offset into the comment section
+    int32_t arg1, arg2, arg3;      // r,s,t or r,d,s as in the text (d fits in 32 bits)
+    int32_t pad;                   // 0, keeps the LIT words 8 byte aligned
+} TMIMAGE_INSTR;
+
+typedef struct
+{
+    int32_t loc;                   // LIT address (offset from the top of dMem)
+    int32_t length;                // chars in a string or TMIMAGE_LIT_NUMBER
+} TMIMAGE_LIT;
+
+// opcodes are stored by their index here so that the image does not
+// depend on the numbering of the OPCODE enum inside tm
+static const char *tmImageOpNames[] = {
+    "HALT", "NOP", "IN", "INB", "INC", "OUT", "OUTB", "OUTC", "OUTNL",
+    "ADD", "SUB", "MUL", "DIV", "MOD", "AND", "OR", "XOR", "NOT", "NEG",
+    "SWP", "RND", "TLT", "SLT", "TLE", "TGT", "SGT", "TGE", "TEQ", "TNE",
+    "MOV", "SET", "CO", "COA",
+    "LD", "ST", "LDA", "LDC", "JZR", "JNZ", "JMP"
+};
+
+#define TMIMAGE_NUM_OPS ((int)(sizeof(tmImageOpNames)/sizeof(tmImageOpNames[0])))
+
+#endif
@@ -0,0 +1,468 @@
+#ifndef TMMACHINE_H
+#define TMMACHINE_H
+
+// The inside of a TMMachine for the programs built on libtm that need
+// more than libtm.h gives them: the debugger views of tm.c and the
+// translator in tm2c.c.  Nothing here is for outside clients.
+
+#include <stdlib.h>
+#include "libtm.h"
+#include "tmTrace.h"
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+#define USED 1
+#define UNUSED 0                /* what freshly mapped (zero) memory holds */
+#define READONLY -1
+#define COVERED 1               /* coverMap: the address has run */
+#define COVER_FRESH 2           /* marked by a block that may yet stop before it */
+
+/******* const *******/
+#define   IADDR_SIZE  10000	/* default, see the -I option */
+#define   DADDR_SIZE  10000	/* default, see the -D option */
+#define   MAX_ADDR_SIZE  (1<<30)
+#define   NO_REGS 8
+#define   PC_REG  7
+#define   FP_REG  1                   /* the frame pointer of c- code */
+
+#define   LINESIZE  200
+#define   WORDSIZE  1000        /* maximum length of a word of text */
+#define   DEFAULT_OUTPUT_LIMIT 1000
+#define   INPUT_BUFFER_SIZE (1<<16)   /* stdio buffer for the input stream */
+#define   MESSAGE_SIZE 512            /* longest tmMessage() */
+#define   FLAME_INTERVAL 1000         /* default instructions between stack samples */
+#define   FLAME_DEPTH 4096            /* deepest call stack a sample records */
+#define   FLAME_HASH 4096             /* buckets in the table of sampled stacks */
+#define   SNAPSHOT_CHUNK 512          /* dMem words a snapshot keeps or skips at a time */
+#define   GUARD_WORDS (1ULL<<31)      /* words of guard region each side of dMem: any int address */
+#define   ZERO_BY_HAND (1<<18)        /* bytes a clear zeroes itself rather than unmapping the pages */
+#define   JIT_HOT 8                   /* entries of a block before the JIT compiles it */
+#define   JIT_CODE_SIZE (1<<26)       /* bytes mapped for the code the JIT makes */
+
+/******* type  *******/
+
+// classes of op codes by format
+typedef enum
+{
+    opclRR,			/* reg operands r, s, t */
+    opclRA,			/* reg r, int d+s */
+    opclLIT                     /* literal command */
+} OPCLASS;
+
+// list of all of the op codes
+typedef enum
+{
+    // RR instructions
+    opHALT,			// RR     halt, operands are ignored
+    opNOP,			// RR     no op, operands are ignored
+    opIN,			// RR     read integer into reg(r); s and t are ignored
+    opINB,			// RR     read bool into reg(r); s and t are ignored
+    opINC,			// RR     read char into reg(r); s and t are ignored
+    opOUT,			// RR     write integer from reg(r), s and t are ignored
+    opOUTB,			// RR     write bool from reg(r), s and t are ignored
+    opOUTC,			// RR     write char from reg(r), s and t are ignored
+    opOUTNL,			// RR     write newline regs r, s and t are ignored
+    opADD,			// RR     reg(r) = reg(s)+reg(t)
+    opSUB,			// RR     reg(r) = reg(s)-reg(t)
+    opMUL,			// RR     reg(r) = reg(s)*reg(t)
+    opDIV,			// RR     reg(r) = reg(s)/reg(t)
+    opMOD,			// RR     reg(r) = reg(s)%reg(t)
+    opAND,			// RR     reg(r) = reg(s)&reg(t)
+    opOR,			// RR     reg(r) = reg(s)|reg(t)
+    opXOR,			// RR     reg(r) = reg(s)^reg(t)
+    opNOT,			// RR     reg(r) = ~reg(s)
+    opNEG,			// RR     reg(r) = -reg(s)
+    opSWP,			// RR     reg[r] = min(reg[r], reg[s]), reg[s] = max(reg[r], reg[s])
+    opRND,			// RR     reg[r] = random(0, abs(reg[s]))
+
+    opTLT,			// RR     if reg(s)<reg(t) then reg(r) = 1  else reg(r) = 0
+    opSLT,			// RR     if (reg[r]>=0) reg[r] = (reg[s]<reg[t] ? 1 : 0); else reg[r] = (reg[t]<reg[s] ? 1 : 0);
+    opTLE,			// RR     if reg(s)<=reg(t) then reg(r) = 1  else reg(r) = 0
+    opTGT,			// RR     if reg(s)>reg(t) then reg(r) = 1  else reg(r) = 0
+    opSGT,	                // RR     if (reg[r]>=0) reg[r] = (reg[s]>reg[t] ? 1 : 0); else reg[r] = (reg[t]>reg[s] ? 1 : 0);
+    opTGE,			// RR     if reg(s)>=reg(t) then reg(r) = 1  else reg(r) = 0
+    opTEQ,			// RR     if reg(s)==reg(t) then reg(r) = 1  else reg(r) = 0
+    opTNE,			// RR     if reg(s)!=reg(t) then reg(r) = 1  else reg(r) = 0
+
+    opMOV,                      // RR     dMem[reg[r] + (0..reg[t]-1)] = dMem[reg[s] + (0..reg[t]-1)]
+    opSET,                      // RR     dMem[reg[r] + (0..reg[t]-1)] = reg[s]
+    opCO,                       // RR     compare memory instruction
+    opCOA,                      // RR     compare memory instruction returning address
+    opRRLim,			// limit of RR opcodes
+
+    // RA instructions
+    opLD,			// RM     reg(r) = mem(d+reg(s))
+    opST,			// RM     mem(d+reg(s)) = reg(r)
+    opLDA,			// RA     reg(r) = d+reg(s)
+    opLDC,			// RA     reg(r) = d ; reg(t) is ignored
+    opJZR,			// RA     if reg(r)==0 then reg(7) = d+reg(s)
+    opJNZ,			// RA     if reg(r)!=0 then reg(7) = d+reg(s)
+    opJMP,                      // RA     reg(7) = d+reg(s)
+
+    opRALim,                    // limit of RA opcodes
+    opLIT,                      // the special litteral op code
+
+    opEND			// Limit of RA opcodes
+} OPCODE;
+
+/* The structure for a instruction.  Its comment is in iMemCmt. */
+typedef struct
+{
+    int iop;
+    long long int iarg1;
+    long long int iarg2;
+    long long int iarg3;
+} INSTRUCTION;
+
+// handlers for the fast execution engine.  Most are the op code of
+// the same name with operands that never touch the pc.  The K forms
+// are pc relative jumps whose target was computed when decoded.  The
+// superinstructions stand for a short run of instructions starting at
+// their address (see fuseInstructions()).
+typedef enum
+{
+    fxSLOW,                     // anything else: done by executeInstruction()
+    fxHALT,
+    fxNOP,
+    fxADD,
+    fxSUB,
+    fxMUL,
+    fxDIV,
+    fxMOD,
+    fxAND,
+    fxOR,
+    fxXOR,
+    fxNOT,
+    fxNEG,
+    fxSWP,
+    fxTLT,
+    fxSLT,
+    fxTLE,
+    fxTGT,
+    fxSGT,
+    fxTGE,
+    fxTEQ,
+    fxTNE,
+    fxLD,
+    fxST,
+    fxSTV,                      // ST without tagging (lean mode)
+    fxLDA,
+    fxLDC,                      // also LDA r,d(7) with d+pc+1 precomputed
+    fxLDAFP,                    // LDA and LD to the frame pointer: they keep
+    fxLDFP,                     // the stack statistics (see frameMoved())
+    fxJZR,
+    fxJNZ,
+    fxJMP,                      // also LDA 7,d(s)
+    fxJZRK,
+    fxJNZK,
+    fxJMPK,                     // also LDA 7,d(7) and LDC 7,d
+    fxLDLDOP,                   // superinstruction LD; LD; RR op
+    fxSTLD,                     // superinstruction ST r,d(s); LD q,d(s)
+    fxSTLDV,                    // the same without tagging (lean mode)
+    fxCALL,                     // superinstruction LDA r,1(7); JMP 7,f(7)
+    fxLDLDJMP,                  // superinstruction LD; LD; JMP 7,d(s)
+    fxIMEM,                     // sentinel just past the end of iMem
+    fxBLOCK,                    // block header in blockCode: d instructions from loc
+    fxNEXT,                     // fall through from a block to the block at d
+    fxTRAP,                     // a breakpoint: stop or do the instruction by executeInstruction()
+
+    // the forms of the above used by unchecked mode: no bounds checks on
+    // dMem.  The guard regions catch what they would.  See runGuarded().
+    fxLDU,
+    fxSTU,
+    fxSTVU,
+    fxLDLDOPU,
+    fxSTLDU,
+    fxSTLDVU,
+    fxLDLDJMPU,
+    fxBLOCKU,                   // also records the block for a fault
+
+    // a block header while coverage is on, until the block first runs.
+    // It marks the block and becomes fxBLOCK, fxBLOCKU or fxBLOCKJ (see
+    // coverBlock()).
+    fxBLOCKC,
+
+    // the JIT (see jitBlock()).  A block header while it is on counts
+    // the entries of the block and, when it is hot, compiles it and
+    // becomes the header that runs the code made for it.
+    fxBLOCKJ,
+    fxJIT,
+    fxEND
+} FASTOP;
+
+/* The structure for a decoded instruction.  An instruction whose d
+   does not fit in an int is left to fxSLOW. */
+typedef struct
+{
+    unsigned char op;           // a FASTOP
+    unsigned char plain;        // the FASTOP for this instruction alone
+    unsigned char r, s, t;
+    int d;                      // displacement or precomputed target
+} DECODED;
+
+/* The structure for a micro-op of a translated block: 16 bytes, four
+   to a cache line */
+typedef struct
+{
+    unsigned char op;           // a FASTOP
+    unsigned char r, s, t;
+    int loc;                    // address of its instruction
+    int next;                   // 1 + blockCode index of the block jumped to, 0 not yet known
+                                // (in an fxBLOCKJ header: the entries so far)
+    int d;                      // as in DECODED
+} MICROOP;
+
+// a call stack seen by sampleStack()
+typedef struct FLAMESTACK
+{
+    int *frames;                  // funcName indexes from the leaf up
+    int depth;                    // number of frames
+    int truncated;                // the root end did not fit
+    long long int count;          // samples that saw it
+    struct FLAMESTACK *next;
+} FLAMESTACK;
+
+/* The ad hoc scanner.  in_Line is the text being scanned: a command,
+   a line of typed input or a line of a .tm file. */
+typedef struct
+{
+    char *in_Line;
+    int lineLen;
+    int inCol;
+    char ch;                    // in_Line[inCol] or ' ' past the end
+    long long int num;          // the number getNum() and friends found
+    char word[WORDSIZE];        // the word getWord() or string getString() found
+    int wordset;                // bool that says if word was set last (truly horrible, needs total rewrite)
+} TMSCAN;
+
+/* what tmGetStats() reports that is not read off the rest of the
+   machine.  Kept since the load or clear. */
+typedef struct
+{
+    double wallSeconds;        // running in runSampled() and tmRun()
+    double cpuSeconds;
+    int frames;                // reg[1] has been set: the frame fields are good
+    int callDepth;             // frames on the stack now
+    int callPeak;              // and at most
+    long long int fpFirst;     // the first frame pointer
+    long long int fpLow;       // the lowest frame pointer
+    long long int movWords;    // words copied by MOV
+    long long int setWords;    // words set by SET
+    long long int coWords;     // words compared by CO and COA
+} RUNSTATS;
+
+/* a snapshot of a machine.  dMem is kept as the chunks of
+   SNAPSHOT_CHUNK words that are not all zero. */
+struct TMSnapshot
+{
+    const TMMachine *program;  // the machine that loaded the program
+    int loads;                 // and which of its loads it was
+    long long int reg[NO_REGS];
+    int pc, lastpc;
+    long long int instrCount;
+    int outputInstrCount;
+    int readOnlyLow;
+    int leanRan;
+    long long int fuseRuns[fxEND];
+    RUNSTATS stats;
+    int chunks;
+    int *chunkAt;              // first address of each chunk
+    long long int *dMem;       // dMem and dMemTag of the chunks
+    int *dMemTag;
+};
+
+/* The machine */
+struct TMMachine
+{
+    // The memories are mapped by tmNew() and are only committed as
+    // they are touched, so they start out, and are cleared back to, all
+    // zero: HALT instructions, UNUSED tags and NULL comments.  The
+    // comments and tags are kept apart from what the engines run.
+    int iMemSize;
+    int dMemSize;
+    int iMemTop;               // one past the highest instruction loaded
+    INSTRUCTION *iMem;
+    int *iMemTag;
+    char **iMemCmt;            // comment of each instruction
+    long long int *dMem;
+    int *dMemTag;              // if > 0 then 1 + addr of instr that last set it (its comment
+                               // is iMemCmt[dMemTag-1]), == 0 unused, == -1 read/only
+    long long int reg[NO_REGS];
+
+    int pc, lastpc;
+    int entryPc;               // pc after a clear (set by a binary image)
+    long long int instrCount;
+    int outputInstrCount;
+    int readOnlyLow;           // lowest READONLY (LIT) location
+    int dirtyLow, dirtyHigh;   // dMem and dMemTag written since the last clear
+                               // are in dirtyLow..dirtyHigh (none if dirtyLow>dirtyHigh)
+    int litIn;                 // the rest of dMem holds the LIT data as loaded (not zeros)
+    RUNSTATS stats;
+
+    // the loaded program.  iMem comments point into its text or image.
+    char pgmName[WORDSIZE];
+    char *loadBuffer;          // text of the last .tm file
+    char *imageMap;            // binary image, mapped or (imageMapped false) malloc'd
+    size_t imageMapSize;
+    int imageMapped;
+    char loadLine[LINESIZE];   // a piece of an overlong line being loaded
+    TMMachine *program;        // tmNewShared(): the machine whose iMem, iMemTag, iMemCmt,
+                               // iMemLine, iMemFunc and funcName these are (NULL: own)
+    int loads;                 // programs loaded, so a snapshot knows its program
+    int litFrom;               // [litFrom, dMemSize) of dMem and dMemTag as loaded,
+    long long int *litDMem;    // for a clear that keeps the LIT data (litFrom is
+    int *litTag;               // dMemSize if there is none)
+
+    // settings
+    int leanflag;              // runTM() does not record dMemTag
+    int tagflag;               // setDMem() records dMemTag
+    int leanRan;               // a lean run has happened since the last clear
+    int outputLimit;
+    OUTPUTMODE outputMode;
+
+    // I/O
+    TMIO io;
+    FILE *outputFile;          // for the default write and flush
+    FILE *inputFile;           // stream for the default input (NULL: none)
+    char *inputName;
+    int inputEcho;             // the default input writes "entered: value" for IN and INB
+    char message[MESSAGE_SIZE];
+
+    // RND.  Each machine has its own generator so a seed gives the same
+    // numbers whatever other machines do.
+    char randomState[128];
+#ifdef __GLIBC__
+    struct random_data randomData;
+#else
+    unsigned long long randomNext;
+#endif
+
+    // breakpoints, sorted by address.  See patchTraps().
+    TMBREAKPOINT *breaks;
+    int breakCount;
+    int breakSize;
+    int breakSkip;             // the breakpoint a run stopped at: not checked
+                               // for the next instruction (-1 none)
+
+    // unchecked mode.  dMem and dMemTag are moved into the middle of
+    // mappings with no access to the rest, so the fast engine can leave
+    // their bounds to the MMU.  See guardDMem() and runGuarded().
+    int uncheckedflag;
+    int verified;              // the loaded program passed verifyProgram()
+    char *dMemGuard;           // the mappings dMem and dMemTag are in (NULL: their own)
+    size_t dMemGuardSize;
+    char *dMemTagGuard;
+    size_t dMemTagGuardSize;
+    int faultBlock;            // blockCode index of the block entered last
+    long long int faultLeft;   // and the steps runTM() had left after it
+
+    // the fast engine
+    DECODED *fastCode;         // iMem decoded for runTM() plus a sentinel
+    int fastCodeStale;         // iMem has changed since it was decoded
+    int fuseSites[fxEND];      // superinstructions made by the last decode
+    long long int fuseRuns[fxEND];  // superinstructions run since load or clear
+
+    // the block cache of runTM().  See translateBlock().
+    char *blockStart;          // a basic block starts at this address
+    int blockStartTop;         // one past the highest address marked in blockStart
+    int *blockAt;              // 1 + blockCode index of the block translated from here
+    MICROOP *blockCode;        // the translated blocks
+    int blockCodeSize;
+    int blockCodeUsed;
+    int blockTop;              // one past the highest address with a block
+    int blocksMade;            // blocks translated since the last decode
+
+    // the profile.  Counting is done by stepTM() so runTM() has no cost
+    // for it; tmRun() steps instead of using runTM() while profileflag is on.
+    int profileflag;           // count executions of each address
+    long long int *iMemCount;  // executions of each address since load or clear
+    int *iMemLine;             // C- source line of each address (0 unknown)
+    int *iMemFunc;             // its function: index in funcName (0 none)
+    char **funcName;           // functions named by * FUNCTION comments
+    int funcCount;             // funcName[1..funcCount-1] are in use
+    int srcLine, srcFunc;      // line and function of the next instruction loaded
+    int profileTop;            // one past the highest address counted
+
+    // call stack sampling.  tmRun() runs runTM() flameInterval
+    // instructions at a time and sampleStack() walks the frames between
+    // the runs.
+    int flameflag;             // sample the call stack
+    int flameInterval;
+    int flameLeft;             // instructions until the next sample
+    FLAMESTACK *flameTab[FLAME_HASH];
+    int flameStacks;           // stacks in flameTab
+    int flameFrames[FLAME_DEPTH];
+
+    // the binary trace.  stepTM() writes a record for each instruction
+    // into the mapped file; tmRun() steps while it is on.  See
+    // tmTraceFile().
+    TMTRACE_HEADER *trace;     // the mapped file (NULL: not tracing)
+    TMTRACE_RECORD *traceRecords;
+    size_t traceMapSize;
+    long long int traceSlots;  // records the mapping holds
+    long long int traceNext;   // the slot of the next record
+    int traceWrapped;          // the ring is full: a record replaces the oldest
+    int traceFd;
+    long long int traceRegs[NO_REGS];  // the registers as the records leave them
+
+    // coverage.  A byte for each address of iMem, set once it has run
+    // and kept across clears.  runTM() marks a whole block the first
+    // time it is entered; see coverBlock().
+    char *coverMap;            // NULL: coverage is off
+    int coverFresh;            // blockCode index of the block that set the
+                               // COVER_FRESH bytes (-1 none)
+
+    // the JIT.  Hot blocks of the block cache are compiled to x86-64
+    // code in jitCode, which is dropped with the blocks.  See jitBlock().
+    int jitflag;               // runTM() compiles blocks entered JIT_HOT times
+    unsigned char *jitCode;    // JIT_CODE_SIZE bytes mapped executable (NULL: never turned on)
+    int jitExit;               // offset of the code that goes back to runTM()
+    int jitFirst;              // offset of the code of the first block
+    int jitUsed;               // bytes in use
+    int *jitAt;                // offset of the code of the block translated from here (0 none)
+    int jitBlocks;             // blocks compiled since the blocks were last dropped
+};
+
+/******** libtm.c ********/
+extern const char *opCodeTab[];
+extern const char *stepResultTab[];
+extern char *emptyString;
+
+int opClass(int c);
+int lookupOp(const char *name);
+
+// the scanner
+int getCh(TMSCAN *sc);
+int nonBlank(TMSCAN *sc);
+int uptoComment(TMSCAN *sc);
+void getCleanChar(TMSCAN *sc);
+int getString(TMSCAN *sc);
+int getChar(TMSCAN *sc);
+int getNum(TMSCAN *sc);
+int getNumOrChar(TMSCAN *sc);
+int getWord(TMSCAN *sc);
+int getBool(TMSCAN *sc);
+int skipCh(TMSCAN *sc, char c);
+char *getRemaining(TMSCAN *sc);
+int atEOL(TMSCAN *sc);
+
+// the machine.  stepTM() and runSampled() are tmStep() and tmRun()
+// without the messages for the plain faults.  runSampled() neither
+// checks breakpoints nor keeps the profile.
+STEPRESULT stepTM(TMMachine *m);
+STEPRESULT runSampled(TMMachine *m, long long int limit, long long int *count);
+void dropBlocks(TMMachine *m);
+int blockStarts(TMMachine *m);
+
+// the profile and call stack samples
+void writeProfile(TMMachine *m, FILE *out, int top);
+void writeProfileData(TMMachine *m, FILE *out);
+void sampleStack(TMMachine *m);
+void writeSamples(TMMachine *m, FILE *out);
+const char *profileFunc(TMMachine *m, int f);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef TMTRACE_H
+#define TMTRACE_H
+
+// Binary execution trace (see tmTraceFile() in libtm.h).  Written by
+// libtm while a machine runs and turned back into the text of the t(race
+// command of tm by tmtrace.c.  All fields are in the byte order of the
+// machine that wrote the trace.  The file is laid out as:
+//
+//   TMTRACE_HEADER
+//   TMTRACE_RECORD records[]      ring of them, or as many as were written
+//
+// With a ring of n records record i (counting from 0 since the trace
+// started) is in slot i%n and only the last n are kept.  Without one
+// the file grows and record i is in slot i.
+//
+// A record is one instruction executed: its address, the registers it
+// changed (not the pc, whose new value is next) and for an RA
+// instruction the dMem word its d(s) operand names after it ran.  The
+// registers of the first record kept are in the header, so a reader
+// gets every register at every record by applying the changes in order.
+// Registers changed between instructions (by a clear, a snapshot restore
+// or the = command of tm) come as TMTRACE_SYNC records before the next
+// instruction.
+
+#include <stdint.h>
+
+#define TMTRACE_MAGIC "TMT1"
+#define TMTRACE_VERSION 1
+#define TMTRACE_SYNC -1            // pc of a record that only sets registers
+#define TMTRACE_NOREG 0xff         // reg or reg2 of a record that changed none
+#define TMTRACE_NOADDR -1          // addr of an RR instruction or one outside dMem
+#define TMTRACE_GROW (1<<16)       // records a growing file is extended by
+#define TMTRACE_REGS 8
+#define TMTRACE_NAME 256
+
+typedef struct
+{
+    char magic[4];                 // TMTRACE_MAGIC (no '\0')
+    int32_t version;               // TMTRACE_VERSION
+    int32_t recordSize;            // sizeof(TMTRACE_RECORD)
+    int32_t dMemSize;              // of the machine traced
+    int64_t ring;                  // records the ring holds, 0 if the file grows
+    int64_t records;               // records written since the trace started
+    int64_t regs[TMTRACE_REGS];    // the registers before the first record kept
+    char program[TMTRACE_NAME];    // the program file traced ('\0' terminated)
+} TMTRACE_HEADER;
+
+typedef struct
+{
+    int32_t pc;                    // address of the instruction or TMTRACE_SYNC
+    int32_t next;                  // the pc after it
+    int32_t addr;                  // RA: d+reg[s] after it ran or TMTRACE_NOADDR
+    uint8_t op;                    // index into tmImageOpNames (see tmImage.h)
+    uint8_t reg, reg2;             // registers it changed or TMTRACE_NOREG
+    uint8_t result;                // its STEPRESULT
+    int64_t value;                 // the new value of reg
+    int64_t other;                 // the new value of reg2, or dMem[addr] for RA
+} TMTRACE_RECORD;
+
+// the registers after rec given those before it
+static inline void tmTraceApply(int64_t *regs, const TMTRACE_RECORD *rec)
+{
+    if (rec->reg != TMTRACE_NOREG) regs[rec->reg] = rec->value;
+    if (rec->reg2 != TMTRACE_NOREG) regs[rec->reg2] = rec->other;
+    regs[TMTRACE_REGS-1] = rec->next;
+}
+
+#endif
@@ -0,0 +1,758 @@
+// // // // // // // // // // // // // // // // // // // // // // // //
+//
+// File: tmbatch.c
+// Run many TM programs, each with its own input, on all the cores
+//
+// A batch is a list of runs: a program and the file its IN, INB and
+// INC read.  Each program is loaded once by libtm and every run of it
+// is a machine sharing that load (see tmNewShared()), so only the data
+// memory and registers are per run.  The runs are spread over worker
+// threads by a work stealing scheduler: the runs are sorted by program
+// and dealt out to the workers in contiguous pieces, each worker takes
+// runs from the front of its own queue and a worker that runs out
+// steals the back half of the queue of another.  A worker keeps its
+// machine while it runs the same program so the fast engine's decoded
+// code and block cache are made once per worker and program.
+//
+// With --snapshot-main the init code of each program (the STATIC INIT
+// c- generates and the setup of the first frame) is run once, up to
+// the entry of main, and every run of the program starts from a
+// snapshot taken there (see tmSnapshot()).
+//
+// With --coverage every machine marks the instructions it runs (see
+// tmSetCoverage()) and adds its marks to its program's when the worker
+// is done with it.  The lines and functions covered by all the runs of
+// each program are written as one lcov tracefile.
+//
+// Each run behaves like tm --run with the limits of the batch: the
+// output is captured, the result is the one tm --run reports and the
+// status is its exit status.  A run with no input file has no input.
+// The summary is JSON: one entry per run in the order of the manifest
+// with the statistics of tmGetStats(), followed by the totals, the
+// throughput and the most stack, call depth and globals of any run.
+//
+// TO COMPILE: make tmbatch     (or gcc tmbatch.c libtm.c -o tmbatch -pthread)
+// TO RUN:     tmbatch [-j threads] [--limit n] [--output-limit n] [--seed n]
+//                     [-I imemsize] [-D dmemsize] [-L] [-U] [--jit] [-o outdir]
+//                     [--snapshot-main] [--coverage file] [--summary file]
+//                     manifest|directory
+//             A manifest has a run per line: a program and optionally
+//             an input file, separated by blanks.  Blank lines and lines
+//             starting with # are skipped.  For a directory every .tm
+//             and .tmb file in it is run with the .in file of the same
+//             name if there is one.  Names get .tm as tm gives them.
+//             -j is the number of worker threads (default all cores).
+//             --limit and --output-limit cap each run (0 is no limit,
+//             defaults 100000000 and 1000).  --seed seeds RND (default 1).
+//             -U runs the programs that pass the verifier unchecked (see
+//             tm -U).  dmemsize must then be a multiple of the page size.
+//             --jit compiles the hot blocks of each run (see tm --jit).
+//             -o writes the output of run n to outdir/n.out instead of
+//             putting it in the summary, making outdir if it is not there.
+//             A run whose output can't be written is an output_error.
+//             --coverage file writes the coverage of all the runs.
+//             --summary file (default stdout).
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include "tmMachine.h"
+
+char *tmbatchVersion = (char *)"tmbatch for TM version " TM_VERSION;
+
+/******* const *******/
+#define   DEFAULT_RUN_LIMIT 100000000  /* instructions a run may execute */
+#define   RUN_FAIL_STATUS 1            /* as tm --run: the run could not be done */
+#define   RUN_LIMIT_STATUS 8           /* as tm --run: the instruction limit */
+
+// result names as tm --run --json gives them
+static const char *resultKey[] = {
+    "instruction_limit",
+    "halted",
+    "imem_fault",
+    "dmem_set_fault",
+    "dmem_readonly_fault",
+    "dmem_read_fault",
+    "zero_divide",
+    "output_limit",
+    "input_error",
+    "load_error",
+    "output_error"
+};
+#define   LOAD_ERROR (srINPUT_ERR + 1)  /* resultKey of a program that did not load */
+#define   OUTPUT_ERROR (LOAD_ERROR + 1) /* resultKey of a run whose -o file failed */
+#define   RESULT_KEYS (OUTPUT_ERROR + 1)
+
+/******* type  *******/
+
+/* a program of the batch: loaded once and shared by its runs */
+typedef struct
+{
+    char *name;
+    TMMachine *load;           // NULL if it did not load
+    char *message;             // why not
+    TMSnapshot *atMain;        // --snapshot-main: the state at the entry of main
+} PROGRAM;
+
+/* a run of the batch and what came of it */
+typedef struct
+{
+    char *programName;
+    char *inputName;           // NULL: no input
+    int program;               // index in programs
+    int result;                // a STEPRESULT, LOAD_ERROR or OUTPUT_ERROR
+    int status;                // the exit status tm --run would give
+    long long int instructions;
+    int outputs;               // output instructions executed
+    int pc;
+    double seconds;
+    TMSTATS stats;             // tmGetStats() at the end
+    char *output;              // what it wrote
+    int outputSize;
+    int outputRoom;
+    char *message;             // tmMessage() of a fault
+} RUN;
+
+/* the queue of runs of a worker.  The owner takes from the head and
+   thieves from the tail. */
+typedef struct
+{
+    pthread_mutex_t lock;
+    int *run;                  // run indexes
+    int head, tail;            // run[head..tail-1] are left
+    int ran;                   // runs it did
+    int steals;                // times it stole
+} WORKQUEUE;
+
+
+/******** GLOBAL VARIABLES ********/
+RUN *runs = NULL;
+int runCount = 0;
+PROGRAM *programs = NULL;
+int programCount = 0;
+WORKQUEUE *queues;
+int workers;
+long long int runLimit = DEFAULT_RUN_LIMIT;
+int outputLimit = DEFAULT_OUTPUT_LIMIT;
+unsigned int seed = 1;
+int leanflag = FALSE;
+int uncheckedflag = FALSE; // -U
+int jitflag = FALSE;       // --jit
+int snapshotflag = FALSE;  // --snapshot-main
+char *outDir = NULL;
+char *coverageName = NULL; // --coverage lcov file
+pthread_mutex_t coverageLock = PTHREAD_MUTEX_INITIALIZER;   // adding to a program's coverage
+
+
+/* seconds on a clock */
+double clockTime(clockid_t clock)
+{
+    struct timespec t;
+
+    clock_gettime(clock, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+
+/* the program name as tm takes it: with .tm if it has no extension */
+char *programFileName(const char *name)
+{
+    char *fileName;
+
+    fileName = (char *)malloc(strlen(name) + 4);
+    strcpy(fileName, name);
+    if (strchr(fileName, '.') == NULL) strcat(fileName, ".tm");
+    return fileName;
+}
+
+
+void addRun(const char *program, const char *input)
+{
+    if ((runCount & (runCount - 1)) == 0) {
+        runs = (RUN *)realloc(runs, (runCount ? 2*runCount : 1)*sizeof(RUN));
+    }
+    memset(&runs[runCount], 0, sizeof(RUN));
+    runs[runCount].programName = programFileName(program);
+    runs[runCount].inputName = (input ? strdup(input) : NULL);
+    runCount++;
+}
+
+
+/* read the runs of a manifest.  FALSE if it can't be read. */
+int readManifest(const char *name)
+{
+    FILE *in;
+    char line[LINESIZE*4], program[LINESIZE*4], input[LINESIZE*4];
+    int n;
+
+    if ((in = fopen(name, "r")) == NULL) return FALSE;
+    while (fgets(line, sizeof(line), in)) {
+        n = sscanf(line, "%s %s", program, input);
+        if (n<1 || program[0] == '#') continue;
+        addRun(program, (n == 2 ? input : NULL));
+    }
+    fclose(in);
+    return TRUE;
+}
+
+
+static int nameCompare(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* the runs of a directory: each .tm and .tmb file with its .in file */
+int readDirectory(const char *name)
+{
+    DIR *dir;
+    struct dirent *entry;
+    char **file, *path, *input, *dot;
+    int files, i;
+
+    if ((dir = opendir(name)) == NULL) return FALSE;
+    file = NULL;
+    files = 0;
+    while ((entry = readdir(dir))) {
+        dot = strrchr(entry->d_name, '.');
+        if (dot == NULL || (strcmp(dot, ".tm") != 0 && strcmp(dot, ".tmb") != 0)) continue;
+        file = (char **)realloc(file, (files + 1)*sizeof(char *));
+        file[files++] = strdup(entry->d_name);
+    }
+    closedir(dir);
+    qsort(file, files, sizeof(char *), nameCompare);
+
+    for (i = 0; i<files; i++) {
+        path = (char *)malloc(strlen(name) + strlen(file[i]) + 5);
+        sprintf(path, "%s/%s", name, file[i]);
+        input = (char *)malloc(strlen(path) + 4);
+        strcpy(input, path);
+        strcpy(strrchr(input, '.'), ".in");
+        addRun(path, (access(input, R_OK) == 0 ? input : NULL));
+        free(path);
+        free(input);
+        free(file[i]);
+    }
+    free(file);
+    return TRUE;
+}
+
+
+/* run the init code of program p up to main and take a snapshot there.
+   Programs whose init code reads input, writes output or does not
+   reach main are run from the start instead. */
+void snapshotMain(PROGRAM *p)
+{
+    TMMachine *m;
+    int entry;
+
+    m = tmNewShared(p->load);
+    if (m == NULL) return;
+    if (coverageName) tmSetCoverage(m, TRUE);
+    entry = tmMainEntry(m);
+    if (entry >= 0) {
+        tmSetBreakpoint(m, entry);
+        tmSetOutputLimit(m, outputLimit);
+        tmSetLean(m, leanflag);
+        if (tmRun(m, runLimit, NULL) == srHALT && tmGetReg(m, PC_REG) == entry && tmOutputs(m) == 0 &&
+            (runLimit == 0 || tmInstructions(m)<runLimit)) {
+            p->atMain = tmSnapshot(m);
+        }
+    }
+    if (coverageName) tmAddCoverage(p->load, m);
+    tmFree(m);
+}
+
+
+/* load each program once.  order is the runs sorted by program. */
+void loadPrograms(int *order, int iSize, int dSize)
+{
+    PROGRAM *p;
+    int i;
+
+    programs = (PROGRAM *)calloc(runCount, sizeof(PROGRAM));
+    for (i = 0; i<runCount; i++) {
+        if (i == 0 || strcmp(runs[order[i]].programName, runs[order[i-1]].programName) != 0) {
+            p = &programs[programCount++];
+            p->name = runs[order[i]].programName;
+            p->load = tmNew(iSize, dSize);
+            if (p->load == NULL) p->message = strdup("ERROR: unable to map memory for TM");
+            else if (! tmLoadFile(p->load, p->name)) {
+                p->message = strdup(tmMessage(p->load));
+                tmFree(p->load);
+                p->load = NULL;
+            }
+            else {
+                if (coverageName) tmSetCoverage(p->load, TRUE);
+                if (snapshotflag) snapshotMain(p);
+            }
+        }
+        runs[order[i]].program = programCount - 1;
+    }
+}
+
+
+static int runCompare(const void *a, const void *b)
+{
+    int ra = *(const int *)a, rb = *(const int *)b;
+    int c;
+
+    c = strcmp(runs[ra].programName, runs[rb].programName);
+    return (c ? c : ra - rb);
+}
+
+
+
+/********************************************/
+/* a run */
+
+/* the write callback: the run's output goes into its buffer */
+static void captureWrite(TMMachine *m, void *context, const char *text, int length)
+{
+    RUN *r = (RUN *)context;
+
+    (void)m;
+    if (r->outputSize + length>r->outputRoom) {
+        r->outputRoom = 2*(r->outputSize + length) + 256;
+        r->output = (char *)realloc(r->output, r->outputRoom);
+    }
+    memcpy(&r->output[r->outputSize], text, length);
+    r->outputSize += length;
+}
+
+static void captureFlush(TMMachine *m, void *context)
+{
+    (void)m;
+    (void)context;
+}
+
+
+/* do run r on m, a machine sharing the run's program */
+void doRun(TMMachine *m, RUN *r)
+{
+    TMIO io;
+    STEPRESULT result;
+    double start;
+    long long int limit;
+
+    start = clockTime(CLOCK_MONOTONIC);
+    memset(&io, 0, sizeof(io));
+    io.context = r;
+    io.write = captureWrite;
+    io.flush = captureFlush;
+    tmSetIO(m, &io);
+    tmSetSeed(m, seed);
+
+    /* like tm --run, a run whose input won't open does not start */
+    if (! tmSetInputFile(m, r->inputName)) {
+        r->result = srINPUT_ERR;
+        r->status = RUN_FAIL_STATUS;
+        r->message = strdup(tmMessage(m));
+        return;
+    }
+
+    /* the limit counts the instructions of a snapshot too */
+    limit = runLimit;
+    if (limit>0) limit -= tmInstructions(m);
+    result = tmRun(m, limit, NULL);
+
+    r->result = result;
+    if (result == srHALT) r->status = 0;
+    else if (result == srOKAY) r->status = RUN_LIMIT_STATUS;
+    else if (result == srINPUT_ERR) r->status = RUN_FAIL_STATUS;
+    else r->status = result;
+    if (result != srHALT && result != srOKAY) r->message = strdup(tmMessage(m));
+    r->instructions = tmInstructions(m);
+    r->outputs = tmOutputs(m);
+    r->pc = tmPc(m);
+    tmGetStats(m, &r->stats);
+    r->seconds = clockTime(CLOCK_MONOTONIC) - start;
+}
+
+
+/* a worker is done with m, a machine of program p */
+void endMachine(TMMachine *m, int p)
+{
+    if (m && coverageName) {
+        pthread_mutex_lock(&coverageLock);
+        tmAddCoverage(programs[p].load, m);
+        pthread_mutex_unlock(&coverageLock);
+    }
+    tmFree(m);
+}
+
+
+/* the next run for worker w: from its own queue or stolen from the
+   back of another's.  -1 when there are none left anywhere. */
+int nextRun(int w)
+{
+    WORKQUEUE *q, *victim;
+    int i, n, next, stolen[1024];
+
+    q = &queues[w];
+    for (;;) {
+        pthread_mutex_lock(&q->lock);
+        next = (q->head<q->tail ? q->run[q->head++] : -1);
+        pthread_mutex_unlock(&q->lock);
+        if (next >= 0) return next;
+
+        /* runs are never added, so when every queue is empty the batch
+           is done */
+        n = 0;
+        for (i = 1; i<workers && n == 0; i++) {
+            victim = &queues[(w + i)%workers];
+            pthread_mutex_lock(&victim->lock);
+            n = (victim->tail - victim->head + 1)/2;
+            if (n>(int)(sizeof(stolen)/sizeof(int))) n = sizeof(stolen)/sizeof(int);
+            victim->tail -= n;
+            memcpy(stolen, &victim->run[victim->tail], n*sizeof(int));
+            pthread_mutex_unlock(&victim->lock);
+        }
+        if (n == 0) return -1;
+
+        pthread_mutex_lock(&q->lock);
+        memcpy(q->run, stolen, n*sizeof(int));
+        q->head = 0;
+        q->tail = n;
+        q->steals++;
+        pthread_mutex_unlock(&q->lock);
+    }
+}
+
+
+void *worker(void *arg)
+{
+    int w = (int)(long)arg;
+    TMMachine *m;
+    RUN *r;
+    int i, program;
+
+    m = NULL;
+    program = -1;
+    while ((i = nextRun(w)) >= 0) {
+        r = &runs[i];
+        if (programs[r->program].load == NULL) {
+            r->result = LOAD_ERROR;
+            r->status = RUN_FAIL_STATUS;
+            r->message = strdup(programs[r->program].message);
+            continue;
+        }
+
+        /* a new machine for a new program, otherwise a clear one.
+           Either way a snapshot at main puts it where runs start. */
+        if (r->program != program) {
+            endMachine(m, program);
+            m = tmNewShared(programs[r->program].load);
+            program = r->program;
+            if (m == NULL) {
+                r->result = LOAD_ERROR;
+                r->status = RUN_FAIL_STATUS;
+                r->message = strdup("ERROR: unable to map memory for TM");
+                program = -1;
+                continue;
+            }
+            tmSetOutputLimit(m, outputLimit);
+            tmSetLean(m, leanflag);
+            tmSetUnchecked(m, uncheckedflag);
+            tmSetJit(m, jitflag);
+            if (coverageName) tmSetCoverage(m, TRUE);
+        }
+        else if (programs[r->program].atMain == NULL) tmClear(m);
+        if (programs[r->program].atMain) tmRestore(m, programs[r->program].atMain);
+        doRun(m, r);
+        queues[w].ran++;
+    }
+    endMachine(m, program);
+    return NULL;
+}
+
+
+
+/********************************************/
+/* the summary */
+
+void writeString(FILE *out, const char *s, int n)
+{
+    const unsigned char *p;
+
+    putc('"', out);
+    for (p = (const unsigned char *)s; p<(const unsigned char *)s + n; p++) {
+        if (*p=='"' || *p=='\\') fprintf(out, "\\%c", *p);
+        else if (*p=='\n') fprintf(out, "\\n");
+        else if (*p<' ' || *p>=127) fprintf(out, "\\u%04x", *p);
+        else putc(*p, out);
+    }
+    putc('"', out);
+}
+
+
+/* write the output of run i to outDir/i.out.  NULL if it was written,
+   otherwise why not. */
+const char *writeOutput(int i, char *fileName)
+{
+    FILE *out;
+    int written;
+
+    sprintf(fileName, "%s/%d.out", outDir, i + 1);
+    if ((out = fopen(fileName, "w")) == NULL) return strerror(errno);
+    written = (int)fwrite(runs[i].output, 1, runs[i].outputSize, out);
+    if (fclose(out) != 0 || written != runs[i].outputSize) return strerror(errno ? errno : EIO);
+    return NULL;
+}
+
+
+void writeSummary(FILE *out, double wall, double cpu)
+{
+    long long int instructions, stackWords, globalWords;
+    int resultCount[RESULT_KEYS], steals, snapshots, callDepth, i, first;
+    char *fileName;
+    const char *outputError;
+    RUN *r;
+
+    fileName = (char *)malloc((outDir ? strlen(outDir) : 0) + 20);
+    instructions = stackWords = globalWords = 0;
+    callDepth = 0;
+    for (i = 0; i<RESULT_KEYS; i++) resultCount[i] = 0;
+
+    fprintf(out, "{\"runs\": [\n");
+    for (i = 0; i<runCount; i++) {
+        r = &runs[i];
+        outputError = NULL;
+        if (outDir) {
+            errno = 0;
+            outputError = writeOutput(i, fileName);
+        }
+        if (outputError) {
+            r->result = OUTPUT_ERROR;
+            r->status = RUN_FAIL_STATUS;
+        }
+        instructions += r->instructions;
+        resultCount[r->result]++;
+        if (r->stats.stackWords>stackWords) stackWords = r->stats.stackWords;
+        if (r->stats.callDepth>callDepth) callDepth = r->stats.callDepth;
+        if (r->stats.globalWords>globalWords) globalWords = r->stats.globalWords;
+        fprintf(out, "  {\"run\": %d, \"program\": ", i + 1);
+        writeString(out, r->programName, strlen(r->programName));
+        fprintf(out, ", \"input\": ");
+        if (r->inputName) writeString(out, r->inputName, strlen(r->inputName));
+        else fprintf(out, "null");
+        fprintf(out, ", \"result\": \"%s\", \"status\": %d, \"instructions\": %lld, ",
+                resultKey[r->result], r->status, r->instructions);
+        fprintf(out, "\"output_instructions\": %d, \"pc\": %d, \"wall_seconds\": %.6f, ",
+                r->outputs, r->pc, r->seconds);
+        fprintf(out, "\"cpu_seconds\": %.6f, \"stack_words\": %lld, \"call_depth\": %d, \"global_words\": %lld, ",
+                r->stats.cpuSeconds, r->stats.stackWords, r->stats.callDepth, r->stats.globalWords);
+        fprintf(out, "\"mov_words\": %lld, \"set_words\": %lld, \"co_words\": %lld, ",
+                r->stats.movWords, r->stats.setWords, r->stats.coWords);
+        if (r->message) {
+            fprintf(out, "\"message\": ");
+            writeString(out, r->message, strlen(r->message));
+            fprintf(out, ", ");
+        }
+        if (outDir == NULL) {
+            fprintf(out, "\"output\": ");
+            writeString(out, r->output, r->outputSize);
+        }
+        else if (outputError == NULL) {
+            fprintf(out, "\"output_file\": ");
+            writeString(out, fileName, strlen(fileName));
+        }
+        else {
+            fprintf(out, "\"output_error\": ");
+            writeString(out, outputError, strlen(outputError));
+        }
+        fprintf(out, "}%s\n", (i + 1<runCount ? "," : ""));
+    }
+
+    steals = 0;
+    for (i = 0; i<workers; i++) steals += queues[i].steals;
+    snapshots = 0;
+    for (i = 0; i<programCount; i++) if (programs[i].atMain) snapshots++;
+    fprintf(out, "],\n\"stats\": {\"runs\": %d, \"programs\": %d, \"threads\": %d, \"steals\": %d,\n",
+            runCount, programCount, workers, steals);
+    fprintf(out, "  \"snapshots_at_main\": %d,\n", snapshots);
+    fprintf(out, "  \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, \"instructions\": %lld,\n",
+            wall, cpu, instructions);
+    fprintf(out, "  \"runs_per_second\": %.1f, \"instructions_per_second\": %.0f,\n",
+            (wall>0 ? runCount/wall : 0.0), (wall>0 ? instructions/wall : 0.0));
+    fprintf(out, "  \"max_stack_words\": %lld, \"max_call_depth\": %d, \"max_global_words\": %lld,\n",
+            stackWords, callDepth, globalWords);
+    fprintf(out, "  \"results\": {");
+    first = TRUE;
+    for (i = 0; i<RESULT_KEYS; i++) {
+        if (resultCount[i] == 0) continue;
+        fprintf(out, "%s\"%s\": %d", (first ? "" : ", "), resultKey[i], resultCount[i]);
+        first = FALSE;
+    }
+    fprintf(out, "}}}\n");
+    free(fileName);
+}
+
+
+
+/* the coverage of each program that loaded, one lcov record each */
+int writeCoverage(const char *name)
+{
+    FILE *out;
+    int i;
+
+    if ((out = fopen(name, "w")) == NULL) return FALSE;
+    for (i = 0; i<programCount; i++) {
+        if (programs[i].load) tmWriteCoverage(programs[i].load, out, NULL);
+    }
+    fclose(out);
+    return TRUE;
+}
+
+
+
+/********************************************/
+void usage()
+{
+    printf("%s\n", tmbatchVersion);
+    printf("usage: tmbatch [-j threads] [--limit n] [--output-limit n] [--seed n]\n");
+    printf("               [-I imemsize] [-D dmemsize] [-L] [-U] [--jit] [-o outdir] [--snapshot-main]\n");
+    printf("               [--coverage file] [--summary file] manifest|directory\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    char *batchName, *summaryName;
+    FILE *summary;
+    pthread_t *thread;
+    TMMachine *m;
+    int *order, i, w, iSize, dSize, per;
+    long long int n;
+    double wallStart, cpuStart;
+    struct stat dirStat;
+
+    batchName = summaryName = NULL;
+    iSize = IADDR_SIZE;
+    dSize = DADDR_SIZE;
+    workers = sysconf(_SC_NPROCESSORS_ONLN);
+    for (i = 1; i<argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i+1<argc) {
+            workers = atoi(argv[++i]);
+            if (workers<1) {
+                printf("ERROR: -j must be at least 1\n");
+                return 1;
+            }
+        }
+        else if ((strcmp(argv[i], "--limit") == 0 || strcmp(argv[i], "--output-limit") == 0 ||
+                  strcmp(argv[i], "--seed") == 0) && i+1<argc) {
+            n = atoll(argv[i+1]);
+            if (n<0 || (n>0x7fffffff && strcmp(argv[i], "--limit") != 0)) {
+                printf("ERROR: %s must be from 0 to %d\n", argv[i], 0x7fffffff);
+                return 1;
+            }
+            if (argv[i][2] == 'l') runLimit = n;
+            else if (argv[i][2] == 'o') outputLimit = n;
+            else seed = n;
+            i++;
+        }
+        else if ((strcmp(argv[i], "-I") == 0 || strcmp(argv[i], "-D") == 0) && i+1<argc) {
+            n = atol(argv[i+1]);
+            if (n<1 || n>MAX_ADDR_SIZE) {
+                printf("ERROR: memory size for %s must be from 1 to %d\n", argv[i], MAX_ADDR_SIZE);
+                return 1;
+            }
+            if (argv[i][1] == 'I') iSize = n;
+            else dSize = n;
+            i++;
+        }
+        else if (strcmp(argv[i], "-L") == 0) leanflag = TRUE;
+        else if (strcmp(argv[i], "-U") == 0) uncheckedflag = TRUE;
+        else if (strcmp(argv[i], "--jit") == 0) jitflag = TRUE;
+        else if (strcmp(argv[i], "-o") == 0 && i+1<argc) outDir = argv[++i];
+        else if (strcmp(argv[i], "--snapshot-main") == 0) snapshotflag = TRUE;
+        else if (strcmp(argv[i], "--summary") == 0 && i+1<argc) summaryName = argv[++i];
+        else if (strcmp(argv[i], "--coverage") == 0 && i+1<argc) coverageName = argv[++i];
+        else if (argv[i][0] == '-' || batchName) {
+            usage();
+            return 1;
+        }
+        else batchName = argv[i];
+    }
+    if (batchName == NULL) {
+        usage();
+        return 1;
+    }
+    if (uncheckedflag) {
+        /* find out now if the memory size will do */
+        m = tmNew(1, dSize);
+        if (m == NULL || ! tmSetUnchecked(m, TRUE)) {
+            printf("%s\n", (m ? tmMessage(m) : "ERROR: unable to map memory for TM"));
+            return 1;
+        }
+        tmFree(m);
+    }
+    if (jitflag) {
+        m = tmNew(1, 1);
+        if (m == NULL || ! tmSetJit(m, TRUE)) {
+            printf("%s\n", (m ? tmMessage(m) : "ERROR: unable to map memory for TM"));
+            return 1;
+        }
+        tmFree(m);
+    }
+    if (! readDirectory(batchName) && ! readManifest(batchName)) {
+        printf("ERROR: unable to read %s\n", batchName);
+        return 1;
+    }
+    if (runCount == 0) {
+        printf("ERROR: no runs in %s\n", batchName);
+        return 1;
+    }
+    if (outDir && mkdir(outDir, 0777) != 0 &&
+        (errno != EEXIST || stat(outDir, &dirStat) != 0 || ! S_ISDIR(dirStat.st_mode))) {
+        printf("ERROR: unable to make output directory %s: %s\n", outDir, strerror(errno == EEXIST ? ENOTDIR : errno));
+        return 1;
+    }
+    summary = (summaryName ? fopen(summaryName, "w") : stdout);
+    if (summary == NULL) {
+        printf("ERROR: unable to write summary file: %s\n", summaryName);
+        return 1;
+    }
+    if (workers>runCount) workers = runCount;
+
+    wallStart = clockTime(CLOCK_MONOTONIC);
+    cpuStart = clockTime(CLOCK_PROCESS_CPUTIME_ID);
+
+    /* the runs of a program next to each other, then dealt out */
+    order = (int *)malloc(runCount*sizeof(int));
+    for (i = 0; i<runCount; i++) order[i] = i;
+    qsort(order, runCount, sizeof(int), runCompare);
+    loadPrograms(order, iSize, dSize);
+
+    queues = (WORKQUEUE *)calloc(workers, sizeof(WORKQUEUE));
+    per = (runCount + workers - 1)/workers;
+    for (w = 0; w<workers; w++) {
+        pthread_mutex_init(&queues[w].lock, NULL);
+        queues[w].run = (int *)malloc((per>0 ? per : 1)*sizeof(int));
+        for (i = w*per; i<runCount && i<(w + 1)*per; i++) queues[w].run[queues[w].tail++] = order[i];
+    }
+
+    thread = (pthread_t *)malloc(workers*sizeof(pthread_t));
+    for (w = 0; w<workers; w++) pthread_create(&thread[w], NULL, worker, (void *)(long)w);
+    for (w = 0; w<workers; w++) pthread_join(thread[w], NULL);
+
+    writeSummary(summary, clockTime(CLOCK_MONOTONIC) - wallStart,
+                 clockTime(CLOCK_PROCESS_CPUTIME_ID) - cpuStart);
+    if (summary != stdout) fclose(summary);
+    if (coverageName && ! writeCoverage(coverageName)) {
+        printf("ERROR: unable to write coverage file: %s\n", coverageName);
+        return 1;
+    }
+
+    for (i = 0; i<programCount; i++) {
+        tmFreeSnapshot(programs[i].atMain);
+        tmFree(programs[i].load);
+    }
+    return 0;
+}
@@ -0,0 +1,316 @@
+// // // // // // // // // // // // // // // // // // // // // // // //
+//
+// File: tmbench.c
+// Time the fast engine on loops too big for the cache
+//
+// Each program is a loop of tmRun() over a body of n instructions, the
+// mix c- writes for expressions: loads and stores off the frame
+// pointer, register ops, constants and a conditional jump every eight
+// instructions to end a block.  Its blocks take n micro-ops of
+// blockCode (see translateBlock()), so as n grows the code the engine
+// reads leaves L1 and then L2.  For each size it prints the rate, the
+// time per instruction and, where the kernel lets perf_event_open()
+// count them, the L1 data cache reads per instruction and the part of
+// them that missed.  Comparing the output of two builds shows what a
+// change in the layout of the decoded code does.
+//
+// With -s the body is mostly stores off the frame pointer, and each size
+// runs once tagged and once lean (see tmSetLean()), so the two rates
+// show what skipping dMemTag saves on stores.
+//
+// With -l it times the loader instead: a listing of n instructions
+// (default 1000000) laid out as c- writes them, with comments and a
+// comment line every few instructions, is built in memory and loaded
+// with tmLoadBuffer() a few times.  It prints the best time and the
+// rate in instructions and megabytes a second.
+//
+// TO COMPILE: make tmbench     (or gcc tmbench.c libtm.c -o tmbench -pthread)
+// TO RUN:     tmbench [-n instructions] [-j] [-s] [size ...]
+//             tmbench -l [instructions ...]
+//             Each size (default 256 1024 4096 16384 65536) runs about
+//             -n instructions (default 50000000).  -j runs them with the
+//             JIT (see tmSetJit()).  -s times the store body tagged and
+//             lean.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "libtm.h"
+#include "tmMachine.h"
+
+#define GROUP 8                 // instructions in each piece of the body
+
+int l1Reads = -1, l1Misses = -1;   // perf_event_open() counters (-1 none)
+int jitflag = FALSE;               // -j
+int storeflag = FALSE;             // -s
+int loadflag = FALSE;              // -l
+
+
+double now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+
+/* a counter of L1 data cache reads of this thread, or their misses */
+int openL1(int group, int misses)
+{
+    struct perf_event_attr pe;
+
+    memset(&pe, 0, sizeof(pe));
+    pe.size = sizeof(pe);
+    pe.type = PERF_TYPE_HW_CACHE;
+    pe.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ<<8) |
+        ((misses ? PERF_COUNT_HW_CACHE_RESULT_MISS : PERF_COUNT_HW_CACHE_RESULT_ACCESS)<<16);
+    pe.disabled = (group == -1);
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &pe, 0, -1, group, 0);
+}
+
+
+long long int readCounter(int fd)
+{
+    long long int value;
+
+    if (fd<0 || read(fd, &value, sizeof(value)) != sizeof(value)) return -1;
+    return value;
+}
+
+
+/* the text of a program running a body of size instructions iterations
+   times, five in eight of them stores with store.  r1 is the frame
+   pointer, r2 counts down and r6 stays 0. */
+char *makeProgram(int size, long long int iterations, int store, long *length)
+{
+    char *text, *p;
+    int loc, g, k;
+
+    text = (char *)malloc((size + 16)*64);
+    if (text == NULL) return NULL;
+    p = text;
+    p += sprintf(p, "* tmbench: a loop over %d instructions\n", size);
+    p += sprintf(p, "0: LDC 1,4000(0) frame\n");
+    p += sprintf(p, "1: LDC 2,%lld(0) iterations\n", iterations);
+    loc = 2;
+    for (g = 0; g<size/GROUP && store; g++) {
+        k = (g*5) % 60;
+        p += sprintf(p, "%d: ST 3,%d(1) store a\n", loc++, -k);
+        p += sprintf(p, "%d: ST 4,%d(1) store b\n", loc++, -(k+1));
+        p += sprintf(p, "%d: LDA 3,1(3) step\n", loc++);
+        p += sprintf(p, "%d: ST 3,%d(1) store a\n", loc++, -(k+2));
+        p += sprintf(p, "%d: ST 5,%d(1) store c\n", loc++, -(k+3));
+        p += sprintf(p, "%d: LDC 5,%d(0) constant\n", loc++, g & 1023);
+        p += sprintf(p, "%d: ST 5,%d(1) store c\n", loc++, -(k+4));
+        p += sprintf(p, "%d: JNZ 6,0(7) never taken\n", loc++);
+    }
+    for (g = 0; g<size/GROUP && !store; g++) {
+        k = (g*3) % 60;
+        p += sprintf(p, "%d: LD 3,%d(1) load a\n", loc++, -k);
+        p += sprintf(p, "%d: LD 4,%d(1) load b\n", loc++, -(k+1));
+        p += sprintf(p, "%d: XOR 3,3,4 op\n", loc++);
+        p += sprintf(p, "%d: LDC 5,%d(0) constant\n", loc++, g & 1023);
+        p += sprintf(p, "%d: OR 3,3,5 op\n", loc++);
+        p += sprintf(p, "%d: ST 3,%d(1) store\n", loc++, -(k+2));
+        p += sprintf(p, "%d: TLT 4,3,5 compare\n", loc++);
+        p += sprintf(p, "%d: JNZ 6,0(7) never taken\n", loc++);
+    }
+    p += sprintf(p, "%d: LDA 2,-1(2) count down\n", loc);
+    p += sprintf(p, "%d: JNZ 2,%d(7) loop\n", loc+1, 2 - (loc+2));
+    p += sprintf(p, "%d: HALT 0,0,0\n", loc+2);
+    *length = p - text;
+    return text;
+}
+
+
+/* the text of a listing of size instructions as c- writes them: a
+   comment line for each group and a comment on each instruction */
+char *makeListing(int size, long *length)
+{
+    static const char *ops[GROUP] = {"ST", "LD", "LDA", "LDC", "ADD", "TLT", "JZR", "JMP"};
+    static const char *comments[GROUP] = {"Store return address", "Load variable", "Adjust fp",
+                                          "Load constant", "Op +", "Op <", "Jump if false", "Return"};
+    char *text, *p;
+    int loc, k;
+
+    text = (char *)malloc((size + size/GROUP + 16)*64L);
+    if (text == NULL) return NULL;
+    p = text;
+    p += sprintf(p, "* tmbench: a listing of %d instructions\n", size);
+    for (loc = 0; loc<size - 1; loc++) {
+        k = loc % GROUP;
+        if (k == 0) p += sprintf(p, "* FUNCTION f%d\n", loc/GROUP);
+        if (k == 4 || k == 5) p += sprintf(p, "%5d: %6s  %d,%d,%d\t%s \n", loc, ops[k], 3, 4, 3, comments[k]);
+        else p += sprintf(p, "%5d: %6s  %d,%d(%d)\t%s \n", loc, ops[k], k % 6, -(loc % 100), 1, comments[k]);
+    }
+    p += sprintf(p, "%5d:   HALT  0,0,0\t%s \n", loc, "DONE!");
+    *length = p - text;
+    return text;
+}
+
+
+/* time loading a listing of size instructions */
+int benchLoad(int size)
+{
+    TMMachine *m;
+    long length;
+    double start, seconds, best;
+    char *text;
+    int i;
+
+    if (size<1) size = 1;
+    text = makeListing(size, &length);
+    m = tmNew(size + 16, 0);
+    if (text == NULL || m == NULL) {
+        printf("ERROR: no memory for a listing of %d instructions\n", size);
+        return FALSE;
+    }
+    best = 0;
+    for (i = 0; i<5; i++) {
+        start = now();
+        if (! tmLoadBuffer(m, "tmbench", text, length)) {
+            printf("%s\n", tmMessage(m));
+            return FALSE;
+        }
+        seconds = now() - start;
+        if (i == 0 || seconds<best) best = seconds;
+    }
+    printf("%8d %9.1f %11.2f %11.2f %9.1f\n", size, length/1e6, best*1e3, size/best/1e6, length/best/1e6);
+
+    tmFree(m);
+    free(text);
+    return TRUE;
+}
+
+
+/* time one size, lean or tagged */
+int bench(int size, long long int total, int lean)
+{
+    TMMachine *m;
+    long long int iterations, count, reads, misses;
+    long length;
+    double start, seconds;
+    STEPRESULT result;
+    char *text;
+
+    size -= size % GROUP;
+    if (size<GROUP) size = GROUP;
+    iterations = total/size;
+    if (iterations<1) iterations = 1;
+    text = makeProgram(size, iterations, storeflag, &length);
+    m = tmNew(size + 16, 0);
+    if (text == NULL || m == NULL) {
+        printf("ERROR: no memory for a body of %d instructions\n", size);
+        return FALSE;
+    }
+    if (jitflag && ! tmSetJit(m, TRUE)) {
+        printf("%s\n", tmMessage(m));
+        return FALSE;
+    }
+    tmSetLean(m, lean);
+    if (! tmLoadBuffer(m, "tmbench", text, length)) {
+        printf("%s\n", tmMessage(m));
+        return FALSE;
+    }
+
+    /* a first run translates the blocks */
+    tmRunToHalt(m, NULL);
+    tmRerun(m);
+
+    if (l1Reads >= 0) {
+        ioctl(l1Reads, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(l1Reads, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    start = now();
+    result = tmRunToHalt(m, &count);
+    seconds = now() - start;
+    if (l1Reads >= 0) ioctl(l1Reads, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    if (result != srHALT) {
+        printf("ERROR: the body of %d instructions stopped with %s\n", size, tmResultText(result));
+        return FALSE;
+    }
+
+    printf("%8d %9.1f %11.1f %9.2f", size, size*sizeof(MICROOP)/1024.0, count/seconds/1e6, seconds*1e9/count);
+    if (storeflag) printf(" %7s", (lean ? "lean" : "tagged"));
+    reads = readCounter(l1Reads);
+    misses = readCounter(l1Misses);
+    if (reads>0 && misses >= 0) printf(" %11.2f %9.3f%%\n", (double)reads/count, 100.0*misses/reads);
+    else printf(" %11s %10s\n", "-", "-");
+
+    tmFree(m);
+    free(text);
+    return TRUE;
+}
+
+
+/* time one size, and with -s lean too */
+int benchSize(int size, long long int total)
+{
+    if (! bench(size, total, FALSE)) return FALSE;
+    return ! storeflag || bench(size, total, TRUE);
+}
+
+
+int main(int argc, char *argv[])
+{
+    static int sizes[] = {256, 1024, 4096, 16384, 65536};
+    long long int total;
+    int i, ran;
+
+    total = 50000000;
+    for (i = 1; i<argc && argv[i][0] == '-'; i++) {
+        if (i+1<argc && strcmp(argv[i], "-n") == 0) total = atoll(argv[++i]);
+        else if (strcmp(argv[i], "-j") == 0) jitflag = TRUE;
+        else if (strcmp(argv[i], "-s") == 0) storeflag = TRUE;
+        else if (strcmp(argv[i], "-l") == 0) loadflag = TRUE;
+        else total = 0;
+    }
+    if (total<1) {
+        printf("usage: tmbench [-n instructions] [-j] [-s] [size ...]\n");
+        printf("       tmbench -l [instructions ...]\n");
+        return 1;
+    }
+
+    if (loadflag) {
+        printf("%8s %9s %11s %11s %9s\n", "instrs", "text MB", "best ms", "Minstr/s", "MB/s");
+        ran = FALSE;
+        for (; i<argc; i++) {
+            if (! benchLoad(atoi(argv[i]))) return 1;
+            ran = TRUE;
+        }
+        if (! ran && ! benchLoad(1000000)) return 1;
+        return 0;
+    }
+
+    l1Reads = openL1(-1, FALSE);
+    if (l1Reads >= 0) l1Misses = openL1(l1Reads, TRUE);
+    if (l1Misses<0) {
+        if (l1Reads >= 0) close(l1Reads);
+        l1Reads = -1;
+        fprintf(stderr, "tmbench: no L1 cache counters here (perf_event_open), timing only\n");
+    }
+
+    printf("tmbench: %d bytes a micro-op, %d a decoded and %d a loaded instruction\n",
+           (int)sizeof(MICROOP), (int)sizeof(DECODED), (int)sizeof(INSTRUCTION));
+    printf("%8s %9s %11s %9s", "body", "code KB", "Minstr/s", "ns/instr");
+    if (storeflag) printf(" %7s", "mode");
+    printf(" %11s %10s\n", "L1D rd/ins", "L1D miss");
+    ran = FALSE;
+    for (; i<argc; i++) {
+        if (! benchSize(atoi(argv[i]), total)) return 1;
+        ran = TRUE;
+    }
+    if (! ran) {
+        for (i = 0; i<(int)(sizeof(sizes)/sizeof(sizes[0])); i++) if (! benchSize(sizes[i], total)) return 1;
+    }
+    return 0;
+}
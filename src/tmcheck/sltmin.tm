@@ -0,0 +1,17 @@
+* SLT and SGT with a negative r and LLONG_MIN in t.  A negative r swaps
+* the comparison: -s < -t is t < s, which negating LLONG_MIN gets wrong.
+* The loop is run often enough for the JIT to compile it, and every
+* engine should print 1 0 on each of its 20 lines.
+  0:    LDC  5,-9223372036854775807(0)	s = -LLONG_MAX
+  1:    LDA  3,-1(5)	t = LLONG_MIN
+  2:    LDC  4,20(0)	loop count
+  3:    LDC  1,-1(0)	a negative r swaps the compare
+  4:    SLT  1,5,3	t < s
+  5:    OUT  1,0,0	1
+  6:    LDC  2,-1(0)
+  7:    SGT  2,5,3	t > s
+  8:    OUT  2,0,0	0
+  9:    OUTNL  0,0,0
+ 10:    LDA  4,-1(4)
+ 11:    JNZ  4,-9(7)	back to 3
+ 12:    HALT  0,0,0
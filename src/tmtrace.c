@@ -0,0 +1,155 @@
+// // // // // // // // // // // // // // // // // // // // // // // //
+//
+// File: tmtrace.c
+// Print a binary trace recorded by tm --trace (or t file) as text
+//
+// Each instruction in the trace is printed the way the t(race command
+// of tm prints it as it runs: the instruction, the registers after it
+// and for an RA instruction the dMem word its d(s) operand names.  The
+// lines are kept in step with writeInstruction() in tm.c, except that
+// breakpoints are not marked.  The instructions and their comments come
+// from the program, loaded by libtm exactly as tm loads it.  The trace
+// has the registers of its first record and the changes each record
+// makes (see tmTrace.h), so nothing is run.
+//
+// TO COMPILE: make tmtrace     (or gcc tmtrace.c libtm.c -o tmtrace -pthread)
+// TO RUN:     tmtrace [-I imemsize] trace [file]
+//             file is the program traced.  It defaults to the name tm
+//             loaded it by, kept in the trace.  -I must match the size
+//             tm ran it with.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tmImage.h"
+#include "tmMachine.h"
+
+#define OUTPUT_BUFFER_SIZE (1<<16)
+
+TMMachine *tm;             // the program traced
+char outputBuffer[OUTPUT_BUFFER_SIZE];
+
+
+/* the line writeInstruction(rec->pc, TRACE) printed for rec with
+   the registers reg after it */
+void writeRecord(const TMTRACE_RECORD *rec, const int64_t *reg)
+{
+    INSTRUCTION *in;
+    int i;
+
+    in = &tm->iMem[rec->pc];
+    printf("%4d: ", rec->pc);
+    printf("%4s%3lld,", opCodeTab[in->iop], in->iarg1);
+    if (opClass(in->iop) == opclRR) printf("%3lld, %1lld ", in->iarg2, in->iarg3);
+    else printf("%4lld(%1lld)", in->iarg2, in->iarg3);
+    printf(" | ");
+    for (i=0; i<7; i++) printf(" r[%1d]:%-3lld", i, (long long int)reg[i]);
+    if (opClass(in->iop) == opclRR) printf(" | ");
+    else if (rec->addr != TMTRACE_NOADDR) {
+        printf(" m[%d]:%-3lld", rec->addr, (long long int)rec->other);
+        printf(" | ");
+    }
+    printf(" %s\n", (tm->iMemCmt[rec->pc] ? tm->iMemCmt[rec->pc] : "* initially empty"));
+}
+
+
+int main(int argc, char *argv[])
+{
+    char *traceName, *fileName;
+    const TMTRACE_HEADER *h;
+    const TMTRACE_RECORD *records, *rec;
+    int64_t reg[TMTRACE_REGS];
+    long long int first, kept, n, room;
+    struct stat st;
+    long size;
+    int i, iSize, fd;
+    char *map;
+
+    traceName = fileName = NULL;
+    iSize = IADDR_SIZE;
+    for (i = 1; i<argc; i++) {
+        if (strcmp(argv[i], "-I") == 0 && i+1<argc) {
+            size = atol(argv[++i]);
+            if (size<1 || size>MAX_ADDR_SIZE) {
+                printf("ERROR: memory size for -I must be from 1 to %d\n", MAX_ADDR_SIZE);
+                return 1;
+            }
+            iSize = size;
+        }
+        else if (argv[i][0] == '-' || fileName) {
+            printf("usage: tmtrace [-I imemsize] trace [file]\n");
+            return 1;
+        }
+        else if (traceName) fileName = argv[i];
+        else traceName = argv[i];
+    }
+    if (traceName == NULL) {
+        printf("usage: tmtrace [-I imemsize] trace [file]\n");
+        return 1;
+    }
+
+    /* the trace */
+    if ((fd = open(traceName, O_RDONLY)) < 0 || fstat(fd, &st) != 0) {
+        printf("ERROR: unable to read trace file: %s\n", traceName);
+        return 1;
+    }
+    map = (char *)MAP_FAILED;
+    if ((size_t)st.st_size >= sizeof(TMTRACE_HEADER)) {
+        map = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    h = (const TMTRACE_HEADER *)map;
+    if (map == MAP_FAILED || memcmp(h->magic, TMTRACE_MAGIC, 4) != 0 ||
+        h->version != TMTRACE_VERSION || h->recordSize != sizeof(TMTRACE_RECORD)) {
+        printf("ERROR: %s is not a TM trace of version %d\n", traceName, TMTRACE_VERSION);
+        return 1;
+    }
+    records = (const TMTRACE_RECORD *)(h + 1);
+    kept = (h->ring && h->records>h->ring ? h->ring : h->records);
+    first = h->records - kept;
+    room = (st.st_size - sizeof(TMTRACE_HEADER))/sizeof(TMTRACE_RECORD);
+    if ((h->ring ? h->ring : kept)>room) {
+        printf("ERROR: %s is cut short: it has room for %lld of its %lld records\n", traceName, room, kept);
+        return 1;
+    }
+
+    /* the program */
+    if (fileName == NULL) fileName = (char *)h->program;
+    tm = tmNew(iSize, h->dMemSize);
+    if (tm == NULL) {
+        printf("ERROR: unable to map memory for TM\n");
+        return 1;
+    }
+    if (! tmLoadFile(tm, fileName)) {
+        printf("%s\n", tmMessage(tm));
+        return 1;
+    }
+
+    setvbuf(stdout, outputBuffer, _IOFBF, OUTPUT_BUFFER_SIZE);
+    if (first>0) fprintf(stderr, "tmtrace: the ring kept the last %lld of %lld records\n", kept, (long long int)h->records);
+    memcpy(reg, h->regs, sizeof(reg));
+    rec = NULL;
+    for (n = first; n<h->records; n++) {
+        rec = &records[(h->ring ? n % h->ring : n)];
+        tmTraceApply(reg, rec);
+        if (rec->pc == TMTRACE_SYNC) continue;
+        if (rec->pc<0 || rec->pc>=tm->iMemSize || rec->op>=TMIMAGE_NUM_OPS ||
+            strcmp(opCodeTab[tm->iMem[rec->pc].iop], tmImageOpNames[rec->op]) != 0) {
+            fflush(stdout);
+            printf("ERROR: record %lld is not an instruction of %s: was it the program traced?\n", n, fileName);
+            return 1;
+        }
+        writeRecord(rec, reg);
+    }
+    fflush(stdout);
+    if (rec && rec->pc != TMTRACE_SYNC && rec->result != srOKAY && rec->result != srHALT) {
+        fprintf(stderr, "tmtrace: the last instruction stopped with %s\n", tmResultText((STEPRESULT)rec->result));
+    }
+
+    return 0;
+}